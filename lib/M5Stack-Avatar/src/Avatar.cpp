@@ -31,6 +31,14 @@ long random(long howbig) {
 #define TaskDelay(ms) vTaskDelay(ms/portTICK_PERIOD_MS)
 #endif
 
+// bit of pendingFace holding the release flag of setFace()
+const uintptr_t FACE_RELEASE_BIT = 1;
+// pendingPalette value that switches back to the palette set by
+// setColorPalette()
+const int8_t OWN_PALETTE = MAX_PRELOADED_PALETTES;
+// bit of ownReady set while the published palette is not yet taken
+const uint8_t OWN_READY_NEW = 0x80;
+
 // TODO(meganetaaan): make read-only
 DriveContext::DriveContext(Avatar *avatar) : avatar{avatar} {}
 
@@ -39,10 +47,14 @@ Avatar *DriveContext::getAvatar() { return avatar; }
 TaskHandle_t drawTaskHandle;
 
 TaskResult_t drawLoop(void *args) {
+  static const uint8_t drawStack = stackProfiler.operation("avatar.draw");
   DriveContext *ctx = reinterpret_cast<DriveContext *>(args);
   Avatar *avatar = ctx->getAvatar();
   while (avatar->isDrawing()) {
     if (avatar->isDrawing()) {
+      TRACE_SCOPE("avatar.draw");
+      StackScope stackScope(drawStack);
+      HeapScope heapScope(HeapTag::Render);
       avatar->draw();
     }
     TaskDelay(10);
@@ -63,7 +75,10 @@ TaskResult_t facialLoop(void *args) {
   float horizontal = 0.0f;
   float breath = 0.0f;
   init_rand();
+  avatar->facialDeadline.restart();
   while (avatar->isDrawing()) {
+    avatar->facialDeadline.tick(lgfx::micros());
+    TRACE_BEGIN("avatar.facial");
 
     if ((lgfx::millis() - last_saccade_millis) > saccade_interval) {
       vertical = _rand() / (RAND_MAX / 2.0) - 1;
@@ -87,6 +102,7 @@ TaskResult_t facialLoop(void *args) {
     c = (c + 1) % 100;
     breath = sin(c * 2 * PI / 100.0);
     avatar->setBreath(breath);
+    TRACE_END("avatar.facial");
     TaskDelay(33);
   }
   TaskResult();
@@ -96,6 +112,15 @@ Avatar::Avatar() : Avatar(new Face()) {}
 
 Avatar::Avatar(Face *face)
     : face{face},
+      pendingFace{0},
+      pendingPalette{-1},
+      switchRequestFrame{0},
+      retiredFace{nullptr},
+      preloadedFaces{},
+      preloadedFaceCount{0},
+      preloadedPaletteCount{0},
+      frameCount{0},
+      switchStats{},
       _isDrawing{false},
       expression{Expression::Neutral},
       breath{0},
@@ -105,16 +130,149 @@ Avatar::Avatar(Face *face)
       gazeH{0},
       rotation{0},
       scale{1},
-      palette{ColorPalette()},
+      ownPalettes{},
+      ownFront{0},
+      ownBack{1},
+      ownReady{2},
+      activePalette{&ownPalettes[0]},
       speechText{""},
       colorDepth{1},
-      batteryIconStatus{BatteryIconStatus::invisible}{}
+      batteryIconStatus{BatteryIconStatus::invisible},
+      batteryLevel{0},
+      speechFont{nullptr},
+      parallelRendering{false},
+      drawPriority{1},
+      facialPriority{2},
+      drawDeadline{DRAW_DEADLINE_MICROS},
+      facialDeadline{FACIAL_DEADLINE_MICROS}{}
 
 Avatar::~Avatar() {
-  delete face;
+  if (!isPreloaded(face)) {
+    delete face;
+  }
+  for (uint8_t i = 0; i < preloadedFaceCount; i++) {
+    delete preloadedFaces[i];
+  }
+  delete retiredFace;
+}
+
+bool Avatar::isPreloaded(const Face *face) const {
+  for (uint8_t i = 0; i < preloadedFaceCount; i++) {
+    if (preloadedFaces[i] == face) {
+      return true;
+    }
+  }
+  return false;
 }
 
-void Avatar::setFace(Face *face) { this->face = face; }
+void Avatar::setFace(Face *face, bool release) {
+  if (!_isDrawing) {
+    Face *old = this->face;
+    face->getBoundingRect()->setPosition(old->getBoundingRect()->getTop(),
+                                         old->getBoundingRect()->getLeft());
+    this->face = face;
+    if (release && old != face && !isPreloaded(old)) {
+      delete old;
+    }
+    return;
+  }
+  switchRequestFrame = frameCount;
+  uintptr_t request = reinterpret_cast<uintptr_t>(face);
+  if (release) {
+    request |= FACE_RELEASE_BIT;
+  }
+  uintptr_t displaced =
+      pendingFace.exchange(request, std::memory_order_acq_rel);
+  // a face replaced before the draw task took it was never shown
+  Face *skipped = reinterpret_cast<Face *>(displaced & ~FACE_RELEASE_BIT);
+  if ((displaced & FACE_RELEASE_BIT) != 0 && skipped != face &&
+      skipped != this->face && !isPreloaded(skipped)) {
+    delete skipped;
+  }
+}
+
+int Avatar::preloadFace(Face *face) {
+  if (preloadedFaceCount >= MAX_PRELOADED_FACES) {
+    return -1;
+  }
+  preloadedFaces[preloadedFaceCount] = face;
+  return preloadedFaceCount++;
+}
+
+int Avatar::preloadColorPalette(const ColorPalette &palette) {
+  if (preloadedPaletteCount >= MAX_PRELOADED_PALETTES) {
+    return -1;
+  }
+  preloadedPalettes[preloadedPaletteCount] = palette;
+  return preloadedPaletteCount++;
+}
+
+bool Avatar::switchFace(int handle) {
+  if (handle < 0 || handle >= preloadedFaceCount) {
+    return false;
+  }
+  setFace(preloadedFaces[handle]);
+  return true;
+}
+
+bool Avatar::switchColorPalette(int handle) {
+  if (handle < 0 || handle >= preloadedPaletteCount) {
+    return false;
+  }
+  if (!_isDrawing) {
+    activePalette = &preloadedPalettes[handle];
+    return true;
+  }
+  switchRequestFrame = frameCount;
+  pendingPalette.store(handle, std::memory_order_release);
+  return true;
+}
+
+FaceSwitchStats Avatar::getFaceSwitchStats() const { return switchStats; }
+
+// runs on the draw task between frames, where no part of the face is in use
+void Avatar::applyPendingSwitches() {
+  // the face replaced one frame ago is no longer referenced by the draw task
+  delete retiredFace;
+  retiredFace = nullptr;
+
+  bool switched = false;
+  uintptr_t request = pendingFace.exchange(0, std::memory_order_acq_rel);
+  Face *next = reinterpret_cast<Face *>(request & ~FACE_RELEASE_BIT);
+  if (next != nullptr && next != face) {
+    Face *old = face;
+    next->getBoundingRect()->setPosition(old->getBoundingRect()->getTop(),
+                                         old->getBoundingRect()->getLeft());
+    face = next;
+    if ((request & FACE_RELEASE_BIT) != 0 && !isPreloaded(old)) {
+      retiredFace = old;
+    }
+    switchStats.faceSwitches++;
+    switched = true;
+  }
+  int8_t handle = pendingPalette.exchange(-1, std::memory_order_acquire);
+  if (handle >= 0) {
+    if (handle != OWN_PALETTE) {
+      activePalette = &preloadedPalettes[handle];
+    } else {
+      // the buffer given back is no longer drawn, so the caller may refill it
+      if ((ownReady.load(std::memory_order_acquire) & OWN_READY_NEW) != 0) {
+        ownFront = ownReady.exchange(ownFront, std::memory_order_acq_rel) &
+                   ~OWN_READY_NEW;
+      }
+      activePalette = &ownPalettes[ownFront];
+    }
+    switchStats.paletteSwitches++;
+    switched = true;
+  }
+  if (switched) {
+    // counts the frame about to be drawn
+    switchStats.lastLatencyFrames = frameCount - switchRequestFrame + 1;
+    if (switchStats.lastLatencyFrames > switchStats.maxLatencyFrames) {
+      switchStats.maxLatencyFrames = switchStats.lastLatencyFrames;
+    }
+  }
+}
 
 Face *Avatar::getFace() const { return face; }
 
@@ -168,6 +326,7 @@ void Avatar::start(int colorDepth) {
   _isDrawing = true;
 
   this->colorDepth = colorDepth;
+  drawDeadline.restart();
   DriveContext *ctx = new DriveContext(this);
 #ifdef SDL_h_
   drawTaskHandle = SDL_CreateThreadWithStackSize(drawLoop, "drawLoop", 2048, ctx);
@@ -178,7 +337,7 @@ void Avatar::start(int colorDepth) {
                           "drawLoop",   /* Name of the task */
                           2048,         /* Stack size in words */
                           ctx,          /* Task input parameter */
-                          1,            /* Priority of the task */
+                          drawPriority, /* Priority of the task */
                           &drawTaskHandle,        /* Task handle. */
                           APP_CPU_NUM);
 
@@ -186,19 +345,27 @@ void Avatar::start(int colorDepth) {
                           "facialLoop",    /* Name of the task */
                           1024,         /* Stack size in words */
                           ctx,          /* Task input parameter */
-                          2,            /* Priority of the task */
+                          facialPriority, /* Priority of the task */
                           NULL,         /* Task handle. */
                           APP_CPU_NUM);
 #endif
 }
 
 void Avatar::draw() {
+  drawDeadline.tick(lgfx::micros());
+  applyPendingSwitches();
   Gaze g = Gaze(this->gazeV, this->gazeH);
   DrawContext *ctx = new DrawContext(this->expression, this->breath,
-                                     &this->palette, g, this->eyeOpenRatio,
+                                     this->activePalette, g, this->eyeOpenRatio,
                                      this->mouthOpenRatio, this->speechText,
                                      this->rotation, this->scale, this->colorDepth, this->batteryIconStatus, this->batteryLevel, this->speechFont);
+  ctx->setMorph(morph.getFrom(), morph.getStep(lgfx::millis()));
+  ctx->setFrameBudget(&frameBudget);
+  ctx->setParallelStrips(parallelRendering);
+  frameBudget.begin(lgfx::micros());
   face->draw(ctx);
+  frameBudget.end(lgfx::micros());
+  frameCount++;
   delete ctx;
 }
 
@@ -206,10 +373,53 @@ bool Avatar::isDrawing() { return _isDrawing; }
 
 void Avatar::setExpression(Expression expression) {
   suspend();
+  if (morph.getDuration() > 0 && expression != this->expression) {
+    morph.start(this->expression, expression, lgfx::millis());
+  }
   this->expression = expression;
   resume();
 }
 
+void Avatar::setExpressionTransition(uint32_t durationMillis) {
+  morph.setDuration(durationMillis);
+}
+
+void Avatar::setFrameBudget(uint32_t micros) { frameBudget.setBudget(micros); }
+
+FrameStats Avatar::getFrameStats() const { return frameBudget.getStats(); }
+
+void Avatar::resetFrameStats() { frameBudget.resetStats(); }
+
+void Avatar::setParallelRendering(bool parallel) {
+  parallelRendering = parallel;
+}
+
+bool Avatar::isParallelRendering() const { return parallelRendering; }
+
+void Avatar::setTaskPriorities(UBaseType_t drawPriority,
+                               UBaseType_t facialPriority) {
+  this->drawPriority = drawPriority;
+  this->facialPriority = facialPriority;
+}
+
+void Avatar::setDeadlines(uint32_t drawMicros, uint32_t facialMicros) {
+  drawDeadline.setDeadline(drawMicros);
+  facialDeadline.setDeadline(facialMicros);
+}
+
+DeadlineStats Avatar::getDrawDeadlineStats() const {
+  return drawDeadline.getStats();
+}
+
+DeadlineStats Avatar::getFacialDeadlineStats() const {
+  return facialDeadline.getStats();
+}
+
+void Avatar::resetDeadlineStats() {
+  drawDeadline.resetStats();
+  facialDeadline.resetStats();
+}
+
 Expression Avatar::getExpression() {
   return this->expression;
 }
@@ -228,9 +438,25 @@ void Avatar::setPosition(int top, int left) {
   this->getFace()->getBoundingRect()->setPosition(top, left);
 }
 
-void Avatar::setColorPalette(ColorPalette cp) { palette = cp; }
+void Avatar::setColorPalette(ColorPalette cp) {
+  if (!_isDrawing) {
+    ownPalettes[ownFront] = cp;
+    activePalette = &ownPalettes[ownFront];
+    return;
+  }
+  // written where the draw task never reads, then swapped in at the next
+  // frame boundary; a palette published but not yet taken is replaced
+  ownPalettes[ownBack] = cp;
+  ownBack = ownReady.exchange(ownBack | OWN_READY_NEW,
+                              std::memory_order_acq_rel) &
+            ~OWN_READY_NEW;
+  switchRequestFrame = frameCount;
+  pendingPalette.store(OWN_PALETTE, std::memory_order_release);
+}
 
-ColorPalette Avatar::getColorPalette(void) const { return this->palette; }
+ColorPalette Avatar::getColorPalette(void) const {
+  return *this->activePalette;
+}
 
 void Avatar::setMouthOpenRatio(float ratio) { this->mouthOpenRatio = ratio; }
 
@@ -5,8 +5,14 @@
 #ifndef AVATAR_H_
 #define AVATAR_H_
 #include "ColorPalette.h"
+#include "DeadlineMonitor.h"
+#include "HeapTracker.h"
+#include "Metrics.h"
+#include "StackProfiler.h"
+#include "Trace.h"
 #include "Face.h"
 #include <M5GFX.h>
+#include <atomic>
 
 #ifdef SDL_h_
 typedef SDL_ThreadFunction TaskFunction_t;
@@ -29,9 +35,39 @@ typedef std::string String;
 #endif  // ARDUINO
 
 namespace m5avatar {
+// default periods after which a frame or facial update counts as late
+const uint32_t DRAW_DEADLINE_MICROS = 50000;
+const uint32_t FACIAL_DEADLINE_MICROS = 50000;
+
+// number of faces and palettes that can be preloaded for switching
+const uint8_t MAX_PRELOADED_FACES = 4;
+const uint8_t MAX_PRELOADED_PALETTES = 4;
+
+struct FaceSwitchStats {
+  uint32_t faceSwitches;
+  uint32_t paletteSwitches;
+  // frames drawn from a switch request until the new face or palette is shown
+  uint32_t lastLatencyFrames;
+  uint32_t maxLatencyFrames;
+};
+
 class Avatar {
  private:
   Face *face;
+  // set by any task, taken by the draw task at the next frame boundary. The
+  // release flag of setFace() is kept in bit 0 of the face pointer, so the
+  // two are always swapped together.
+  std::atomic<uintptr_t> pendingFace;
+  std::atomic<int8_t> pendingPalette;
+  std::atomic<uint32_t> switchRequestFrame;
+  // replaced face, deleted once the frame after the switch is drawn
+  Face *retiredFace;
+  Face *preloadedFaces[MAX_PRELOADED_FACES];
+  ColorPalette preloadedPalettes[MAX_PRELOADED_PALETTES];
+  uint8_t preloadedFaceCount;
+  uint8_t preloadedPaletteCount;
+  uint32_t frameCount;
+  FaceSwitchStats switchStats;
   bool _isDrawing;
   Expression expression;
   float breath;
@@ -41,12 +77,31 @@ class Avatar {
   float gazeH;
   float rotation;
   float scale;
-  ColorPalette palette;
+  // palettes given to setColorPalette(), triple buffered: the caller fills
+  // ownBack and publishes it in ownReady, the draw task takes the published
+  // one as ownFront at the next frame boundary
+  ColorPalette ownPalettes[3];
+  uint8_t ownFront;
+  uint8_t ownBack;
+  std::atomic<uint8_t> ownReady;
+  // palette drawn with: ownPalettes[ownFront] or one of preloadedPalettes,
+  // so that switching never copies a palette on the draw task
+  ColorPalette *activePalette;
   String speechText;
   int colorDepth;
   BatteryIconStatus batteryIconStatus;
   int32_t batteryLevel;
   const lgfx::IFont *speechFont;
+  ExpressionMorph morph;
+  FrameBudget frameBudget;
+  bool parallelRendering;
+  UBaseType_t drawPriority;
+  UBaseType_t facialPriority;
+  DeadlineMonitor drawDeadline;
+  DeadlineMonitor facialDeadline;
+  void applyPendingSwitches();
+  friend TaskResult_t facialLoop(void *args);
+  bool isPreloaded(const Face *face) const;
 
  public:
   Avatar();
@@ -57,7 +112,18 @@ class Avatar {
   Face *getFace() const;
   ColorPalette getColorPalette() const;
   void setColorPalette(ColorPalette cp);
-  void setFace(Face *face);
+  // The face is swapped in at the next frame boundary. With release, the
+  // replaced face is deleted after the swap; otherwise the caller keeps it.
+  void setFace(Face *face, bool release = false);
+  // Takes ownership of a face built ahead of time and returns its handle,
+  // or -1 when no slot is left.
+  int preloadFace(Face *face);
+  int preloadColorPalette(const ColorPalette &palette);
+  // swap to a preloaded face or palette at the next frame boundary
+  bool switchFace(int handle);
+  bool switchColorPalette(int handle);
+  FaceSwitchStats getFaceSwitchStats() const;
+  // colorDepth: 1, COLOR_DEPTH_INDEXED(8-bit palette) or 16
   void init(int colorDepth = 1);
   Expression getExpression();
   void setBreath(float f);
@@ -65,6 +131,20 @@ class Avatar {
   void setGaze(float vertical, float horizontal);
   void getGaze(float *vertical, float *horizontal);
   void setExpression(Expression exp);
+  void setExpressionTransition(uint32_t durationMillis);
+  // 0 disables shedding of optional work when frames run long
+  void setFrameBudget(uint32_t micros);
+  FrameStats getFrameStats() const;
+  void resetFrameStats();
+  // prepare every other strip on the other core (no effect on SDL builds)
+  void setParallelRendering(bool parallel);
+  bool isParallelRendering() const;
+  // priorities of the draw and facial tasks; takes effect on start()
+  void setTaskPriorities(UBaseType_t drawPriority, UBaseType_t facialPriority);
+  void setDeadlines(uint32_t drawMicros, uint32_t facialMicros);
+  DeadlineStats getDrawDeadlineStats() const;
+  DeadlineStats getFacialDeadlineStats() const;
+  void resetDeadlineStats();
   void setEyeOpenRatio(float ratio);
   void setMouthOpenRatio(float ratio);
   void setSpeechText(const char *speechText);
@@ -7,7 +7,8 @@
 #define LGFX_USE_V1
 #include <M5Unified.h>
 #include "DrawContext.h"
-#include "Drawable.h"
+#include "GlyphCache.h"
+#include "Overlay.h"
 
 #ifndef ARDUINO
 #include <string>
@@ -22,37 +23,82 @@ const int16_t MIN_WIDTH = 40;
 const int cx = 210; // Adjust for SSD1306
 // const int cy = 220;
 const int cy = 210; // Adjust for SSD1306
-static int tid = 0; // Add for scroll
+// distance from the top of the balloon layer to the text baseline center
+const int16_t BALLOON_CY = 40;
 
 namespace m5avatar {
-class Balloon final : public Drawable {
+class Balloon final : public Overlay {
+ private:
+  String text;
+  const lgfx::IFont *font = nullptr;
+  int textWidth = 0;
+  int tid = 0; // Add for scroll
+  int wait = 0;
+
  public:
   // constructor
   Balloon() = default;
   ~Balloon() = default;
   Balloon(const Balloon &other) = default;
   Balloon &operator=(const Balloon &other) = default;
+
+  BoundingRect getBoundingRect() override {
+    return BoundingRect(cy - BALLOON_CY, 0, 320, 70);
+  }
+
+  bool isVisible(DrawContext *drawContext) override {
+    return drawContext->getspeechText().length() > 0;
+  }
+
+  bool update(DrawContext *drawContext, bool animate) override {
+    String newText = drawContext->getspeechText();
+    const lgfx::IFont *newFont = drawContext->getSpeechFont();
+    if (newText != text || newFont != font) {
+      text = newText;
+      font = newFont;
+      textWidth = glyphCache.textWidth(font, text.c_str(), TEXT_SIZE);
+      tid = 0;
+      wait = 0;
+      return true;
+    }
+    if (!animate || textWidth < getBoundingRect().getWidth()) {
+      return false;
+    }
+// Add for scroll
+    int textLength = text.length();
+    if (--wait < 0)
+    {
+      if(text[tid] < 0x80){
+        tid++;
+      }else if(text[tid] < 0xe0) {
+        tid += 2;
+      }else if(text[tid] >= 0xe0) {
+        tid += 3;
+      }
+      if (tid >= textLength) { tid = 0; }
+      if(tid == 0){
+        // wait = 50;
+        wait = 10; // Adjust for SSD1306
+      }else{
+        // wait = 10;
+        wait = 1; // Adjust for SSD1306
+      }
+      return true;
+    }
+    return false;
+  }
+
   void draw(M5Canvas *spi, BoundingRect rect,
             DrawContext *drawContext) override {
-    String text = drawContext->getspeechText();
-    const lgfx::IFont *font = drawContext->getSpeechFont();
     if (text.length() == 0) {
       return;
     }
-    ColorPalette* cp = drawContext->getColorPalette();
-    uint16_t primaryColor = cp->get(COLOR_BALLOON_FOREGROUND);
-    uint16_t backgroundColor = cp->get(COLOR_BALLOON_BACKGROUND);
-    M5.Lcd.setTextSize(TEXT_SIZE);
-    M5.Lcd.setTextDatum(MC_DATUM);
-    spi->setTextSize(TEXT_SIZE);
+    uint16_t primaryColor = drawContext->getColor(COLOR_BALLOON_FOREGROUND);
+    uint16_t backgroundColor = drawContext->getColor(COLOR_BALLOON_BACKGROUND);
+    // NOTE: glyphs come from glyphCache, so the canvas text settings are
+    // not used
 //    spi->setTextColor(primaryColor, backgroundColor);
-    spi->setTextColor(backgroundColor, primaryColor); // Change for scroll
-    spi->setTextDatum(MC_DATUM);
-    M5.Lcd.setFont(font);
-    int textWidth = M5.Lcd.textWidth(text.c_str());
-    int textHeight = TEXT_HEIGHT * TEXT_SIZE;
-// Add for scroll
-    int textLength = text.length();
+    int y = rect.getTop() + BALLOON_CY - glyphCache.fontHeight(font, TEXT_SIZE) / 2;
 // Comment for scroll
 //    spi->fillEllipse(cx - 20, cy,textWidth + 2, textHeight * 2 + 2,
 //                     primaryColor);
@@ -65,34 +111,14 @@ class Balloon final : public Drawable {
 //    spi->drawString(text, cx - textWidth / 6 - 15, cy, font);  // Continue printing from new x position
 
 // Add for scroll
-    static int wait = 0;
-    if (textWidth < spi->width()){
-      spi->drawString(text, cx - textWidth / 6 - 15, cy, font);  // Continue printing from new x position
-      tid = 0;
-      wait = 0;
+    if (textWidth < rect.getWidth()){
+      int x = rect.getLeft() + cx - textWidth / 6 - 15 - textWidth / 2;
+      glyphCache.drawString(spi, font, text.c_str(), TEXT_SIZE, x, y,
+                            backgroundColor, primaryColor);  // Change for scroll
     } else {
-      spi->setTextDatum(ML_DATUM);
-      spi->drawString(&text[tid], 0, cy, font);  // Continue printing from new x position
-      if (--wait < 0)
-      {
-        if(text[tid] < 0x80){
-          tid++;
-        }else if(text[tid] < 0xe0) {
-          tid += 2;
-        }else if(text[tid] >= 0xe0) {
-          tid += 3;
-        }
-        if (tid >= textLength) { tid = 0; }
-        if(tid == 0){
-          // wait = 50;
-          wait = 10; // Adjust for SSD1306
-        }else{
-          // wait = 10;
-          wait = 1; // Adjust for SSD1306
-        }
-      }
+      glyphCache.drawString(spi, font, &text[tid], TEXT_SIZE, rect.getLeft(), y,
+                            backgroundColor, primaryColor);  // Continue printing from new x position
     }
-
   }
 };
 
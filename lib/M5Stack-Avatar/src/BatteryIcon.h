@@ -7,12 +7,15 @@
 #include <M5GFX.h>
 #include <M5Unified.h>
 #include "DrawContext.h"
-#include "Drawable.h"
+#include "Overlay.h"
 
 namespace m5avatar {
 
-class BatteryIcon final : public Drawable {
+class BatteryIcon final : public Overlay {
  private:
+  BatteryIconStatus lastStatus = BatteryIconStatus::invisible;
+  int32_t lastLevel = -1;
+
   void drawBatteryIcon(M5Canvas *spi, uint32_t x, uint32_t y, uint16_t fgcolor, uint16_t bgcolor, float offset, BatteryIconStatus batteryIconStatus, int32_t batteryLevel) {
     spi->drawRect(x, y + 5, 5, 5, fgcolor);
     spi->drawRect(x + 5, y, 30, 15, fgcolor);
@@ -34,13 +37,32 @@ class BatteryIcon final : public Drawable {
   ~BatteryIcon() = default;
   BatteryIcon(const BatteryIcon &other) = default;
   BatteryIcon &operator=(const BatteryIcon &other) = default;
+
+  BoundingRect getBoundingRect() override {
+    return BoundingRect(5, 285, 35, 15);
+  }
+
+  bool isVisible(DrawContext *ctx) override {
+    return ctx->getBatteryIconStatus() != BatteryIconStatus::invisible;
+  }
+
+  bool update(DrawContext *ctx, bool animate) override {
+    if (!animate || (ctx->getBatteryIconStatus() == lastStatus &&
+                     ctx->getBatteryLevel() == lastLevel)) {
+      return false;
+    }
+    lastStatus = ctx->getBatteryIconStatus();
+    lastLevel = ctx->getBatteryLevel();
+    return true;
+  }
+
   void draw(M5Canvas *spi, BoundingRect rect, DrawContext *ctx) override {
     if (ctx->getBatteryIconStatus() != BatteryIconStatus::invisible) {
-      uint16_t primaryColor = ctx->getColorDepth() == 1 ? 1 : ctx->getColorPalette()->get(COLOR_PRIMARY);
-      uint16_t bgColor = ctx->getColorDepth() == 1 ? ERACER_COLOR : ctx->getColorPalette()->get(COLOR_BACKGROUND);
+      uint16_t primaryColor = ctx->getColor(COLOR_PRIMARY);
+      uint16_t bgColor = ctx->getColor(COLOR_BACKGROUND);
       float offset = ctx->getBreath();
       int32_t batteryLevel = ctx->getBatteryLevel();
-      drawBatteryIcon(spi, 285, 5, primaryColor, bgColor, -offset, ctx->getBatteryIconStatus(), batteryLevel);
+      drawBatteryIcon(spi, rect.getLeft(), rect.getTop(), primaryColor, bgColor, -offset, ctx->getBatteryIconStatus(), batteryLevel);
     }
   };
 
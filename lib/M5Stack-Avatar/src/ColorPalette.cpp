@@ -10,7 +10,14 @@ ColorPalette::ColorPalette()
              {COLOR_SECONDARY, TFT_BLACK},
              {COLOR_BACKGROUND, TFT_BLACK},
              {COLOR_BALLOON_FOREGROUND, TFT_BLACK},
-             {COLOR_BALLOON_BACKGROUND, TFT_WHITE}} {}
+             {COLOR_BALLOON_BACKGROUND, TFT_WHITE},
+             {COLOR_TONGUE, TFT_RED}},
+      indices{{COLOR_BACKGROUND, 0},
+              {COLOR_PRIMARY, 1},
+              {COLOR_SECONDARY, 2},
+              {COLOR_BALLOON_FOREGROUND, 3},
+              {COLOR_BALLOON_BACKGROUND, 4},
+              {COLOR_TONGUE, 5}} {}
 
 uint16_t ColorPalette::get(const char* key) const {
   auto itr = colors.find(key);
@@ -28,7 +35,49 @@ void ColorPalette::set(const char* key, uint16_t value) {
   auto itr = colors.find(key);
   if (itr != colors.end()) {
     M5_LOGI("Overwriting");
+    itr->second = value;
+    return;
+  }
+  // background and primary keep their slots across clear()
+  if (indices.find(key) == indices.end()) {
+    if (indices.size() >= PALETTE_SIZE) {
+      M5_LOGW("palette is full, ignoring the color %s", key);
+      return;
+    }
+    // NOTE: taken before inserting; in indices[key] = indices.size() the
+    // insertion may come first before C++17
+    uint8_t index = indices.size();
+    indices[key] = index;
+  }
+  colors[key] = value;
+}
+
+void ColorPalette::clear(void) {
+  colors.clear();
+  indices = {{COLOR_BACKGROUND, 0}, {COLOR_PRIMARY, 1}};
+}
+
+uint8_t ColorPalette::getIndex(const char* key) const {
+  auto itr = indices.find(key);
+  if (itr != indices.end()) {
+    return itr->second;
+  }
+  // NOTE: unknown colors fall back to the background like get() does
+  M5_LOGI("no color with the key %s", key);
+  return 0;
+}
+
+size_t ColorPalette::size() const { return indices.size(); }
+
+void ColorPalette::getLut(uint16_t* lut) const {
+  for (auto& entry : indices) {
+    lut[entry.second] = get(entry.first.c_str());
+  }
+}
+
+void ColorPalette::applyTo(M5Canvas* canvas) const {
+  for (auto& entry : indices) {
+    canvas->setPaletteColor(entry.second, get(entry.first.c_str()));
   }
-  itr->second = value;
 }
 }  // namespace m5avatar
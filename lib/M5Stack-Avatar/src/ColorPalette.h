@@ -12,6 +12,12 @@
 #define COLOR_BACKGROUND "background"
 #define COLOR_BALLOON_FOREGROUND "balloon_f"
 #define COLOR_BALLOON_BACKGROUND "balloon_b"
+#define COLOR_TONGUE "tongue"
+
+// color depth that selects 8-bit canvases indexed by ColorPalette
+#define COLOR_DEPTH_INDEXED 8
+// number of entries of the palette LUT used by indexed canvases
+#define PALETTE_SIZE 256
 
 namespace m5avatar {
 // enum class ColorType
@@ -28,6 +34,9 @@ class ColorPalette {
   // ColorType colorType;
   // uint16_t colors[2];
   std::map<std::string, uint16_t> colors;
+  // index of each color in the LUT. background is 0 and primary is 1 so that
+  // 1-bit canvases share the layout
+  std::map<std::string, uint8_t> indices;
 
  public:
   // TODO(meganetaaan): constructor with color settings
@@ -39,6 +48,12 @@ class ColorPalette {
   uint16_t get(const char *key) const;
   void set(const char *key, uint16_t value);
   void clear(void);
+  uint8_t getIndex(const char *key) const;
+  size_t size() const;
+  // fills the first size() entries of a PALETTE_SIZE RGB565 LUT
+  void getLut(uint16_t *lut) const;
+  // uploads the LUT to an indexed canvas
+  void applyTo(M5Canvas *canvas) const;
 };
 }  // namespace m5avatar
 
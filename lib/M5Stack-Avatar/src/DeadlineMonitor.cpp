@@ -0,0 +1,43 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "DeadlineMonitor.h"
+
+namespace m5avatar {
+
+DeadlineMonitor::DeadlineMonitor(uint32_t deadlineMicros)
+    : stats{}, lastMicros{0}, started{false} {
+  stats.deadlineMicros = deadlineMicros;
+}
+
+void DeadlineMonitor::setDeadline(uint32_t micros) {
+  stats.deadlineMicros = micros;
+}
+
+void DeadlineMonitor::tick(uint32_t nowMicros) {
+  if (started) {
+    uint32_t period = nowMicros - lastMicros;
+    stats.periods++;
+    if (period > stats.worstMicros) {
+      stats.worstMicros = period;
+    }
+    if (stats.deadlineMicros > 0 && period > stats.deadlineMicros) {
+      stats.missed++;
+    }
+  }
+  lastMicros = nowMicros;
+  started = true;
+}
+
+void DeadlineMonitor::restart() { started = false; }
+
+DeadlineStats DeadlineMonitor::getStats() const { return stats; }
+
+void DeadlineMonitor::resetStats() {
+  uint32_t deadlineMicros = stats.deadlineMicros;
+  stats = DeadlineStats{};
+  stats.deadlineMicros = deadlineMicros;
+}
+
+}  // namespace m5avatar
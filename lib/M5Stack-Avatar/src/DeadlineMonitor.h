@@ -0,0 +1,44 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef DEADLINEMONITOR_H_
+#define DEADLINEMONITOR_H_
+#include <stdint.h>
+
+namespace m5avatar {
+
+struct DeadlineStats {
+  uint32_t periods;
+  uint32_t missed;
+  uint32_t deadlineMicros;
+  uint32_t worstMicros;
+};
+
+/**
+ * Counts the periods of a periodic task that took longer than its deadline.
+ * The task calls tick() once per period, e.g. at the start of each frame.
+ */
+class DeadlineMonitor {
+ private:
+  DeadlineStats stats;
+  uint32_t lastMicros;
+  bool started;
+
+ public:
+  explicit DeadlineMonitor(uint32_t deadlineMicros = 0);
+  ~DeadlineMonitor() = default;
+  DeadlineMonitor(const DeadlineMonitor &other) = default;
+  DeadlineMonitor &operator=(const DeadlineMonitor &other) = default;
+  // 0 only counts periods
+  void setDeadline(uint32_t micros);
+  void tick(uint32_t nowMicros);
+  // forgets the last tick so that an intended pause is not counted as missed
+  void restart();
+  DeadlineStats getStats() const;
+  void resetStats();
+};
+
+}  // namespace m5avatar
+
+#endif  // DEADLINEMONITOR_H_
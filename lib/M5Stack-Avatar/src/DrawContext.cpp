@@ -48,6 +48,20 @@ Gaze DrawContext::getGaze() const { return gaze; }
 
 ColorPalette* const DrawContext::getColorPalette() const { return palette; }
 
+// returns the value parts should draw a palette color with: a palette index
+// on 1-bit and indexed canvases, an RGB565 color otherwise
+uint16_t DrawContext::getColor(const char* key) const {
+  switch (colorDepth) {
+    case 1:
+      // 1-bit canvases only hold the background(0) and the primary(1) color
+      return palette->get(key) == palette->get(COLOR_BACKGROUND) ? 0 : 1;
+    case COLOR_DEPTH_INDEXED:
+      return palette->getIndex(key);
+    default:
+      return palette->get(key);
+  }
+}
+
 int DrawContext::getColorDepth() const { return colorDepth; }
 
 const lgfx::IFont* DrawContext::getSpeechFont() const { return speechFont; }
@@ -56,4 +70,33 @@ BatteryIconStatus DrawContext::getBatteryIconStatus() const { return batteryIcon
 
 int32_t DrawContext::getBatteryLevel() const { return batteryLevel; }
 
+void DrawContext::setMorph(Expression from, uint8_t step) {
+  morphFrom = from;
+  morphStep = step;
+}
+
+void DrawContext::setMorphCache(MorphFrameCache* cache) { morphCache = cache; }
+
+bool DrawContext::isMorphing() const { return morphStep < MORPH_STEPS; }
+
+Expression DrawContext::getMorphFrom() const { return morphFrom; }
+
+uint8_t DrawContext::getMorphStep() const { return morphStep; }
+
+MorphFrameCache* DrawContext::getMorphCache() const { return morphCache; }
+
+void DrawContext::setFrameBudget(const FrameBudget* budget) {
+  frameBudget = budget;
+}
+
+bool DrawContext::isShed(ShedStage stage) const {
+  return frameBudget != nullptr && frameBudget->isShed(stage);
+}
+
+void DrawContext::setParallelStrips(bool parallel) {
+  parallelStrips = parallel;
+}
+
+bool DrawContext::isParallelStrips() const { return parallelStrips; }
+
 }  // namespace m5avatar
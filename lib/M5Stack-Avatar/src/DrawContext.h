@@ -10,6 +10,8 @@
 #include "M5GFX.h"
 #include "ColorPalette.h"
 #include "Expression.h"
+#include "ExpressionMorph.h"
+#include "FrameBudget.h"
 #include "Gaze.h"
 
 #ifndef ARDUINO
@@ -34,6 +36,11 @@ class DrawContext {
   BatteryIconStatus batteryIconStatus = BatteryIconStatus::invisible;
   int32_t batteryLevel = 0;
   const lgfx::IFont* speechFont = nullptr; // = &fonts::lgfxJapanGothicP_16; //  = &fonts::efontCN_10;
+  Expression morphFrom = Expression::Neutral;
+  uint8_t morphStep = MORPH_STEPS;
+  MorphFrameCache* morphCache = nullptr;
+  const FrameBudget* frameBudget = nullptr;
+  bool parallelStrips = false;
 
  public:
   DrawContext() = delete;
@@ -54,11 +61,22 @@ class DrawContext {
   float getRotation() const;
   Gaze getGaze() const;
   ColorPalette* const getColorPalette() const;
+  uint16_t getColor(const char* key) const;
   String getspeechText() const;
   int getColorDepth() const;
   BatteryIconStatus getBatteryIconStatus() const;
   int32_t getBatteryLevel() const;
   const lgfx::IFont* getSpeechFont() const; 
+  void setMorph(Expression from, uint8_t step);
+  void setMorphCache(MorphFrameCache* cache);
+  bool isMorphing() const;
+  Expression getMorphFrom() const;
+  uint8_t getMorphStep() const;
+  MorphFrameCache* getMorphCache() const;
+  void setFrameBudget(const FrameBudget* budget);
+  bool isShed(ShedStage stage) const;
+  void setParallelStrips(bool parallel);
+  bool isParallelStrips() const;
 };
 }  // namespace m5avatar
 
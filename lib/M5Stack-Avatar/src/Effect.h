@@ -7,12 +7,16 @@
 #define LGFX_USE_V1
 #include <M5GFX.h>
 #include "DrawContext.h"
-#include "Drawable.h"
+#include "Overlay.h"
+#include "SpanCache.h"
 
 namespace m5avatar {
 
-class Effect final : public Drawable {
+class Effect final : public Overlay {
  private:
+  Expression lastExpression = Expression::Neutral;
+  float lastOffset = 0;
+
   void drawBubbleMark(M5Canvas *spi, uint32_t x, uint32_t y, uint32_t r,
                       uint16_t color) {
     drawBubbleMark(spi, x, y, r, color, 0);
@@ -34,7 +38,7 @@ class Effect final : public Drawable {
                  uint16_t color, float offset) {
     y = y + floor(5 * offset);
     r = r + floor(r * 0.2 * offset);
-    spi->fillCircle(x, y, r, color);
+    spanCache.fillCircle(spi, x, y, r, color);
     uint32_t a = (sqrt(3) * r) / 2;
     spi->fillTriangle(x, y - r * 2, x - a, y - r * 0.5, x + a, y - r * 0.5,
                       color);
@@ -75,8 +79,8 @@ class Effect final : public Drawable {
   void drawHeartMark(M5Canvas *spi, uint32_t x, uint32_t y, uint32_t r,
                  uint16_t color, float offset) {
     r = r + floor(r * 0.4 * offset);
-    spi->fillCircle(x - r / 2, y, r / 2, color);
-    spi->fillCircle(x + r / 2, y, r / 2, color);
+    spanCache.fillCircle(spi, x - r / 2, y, r / 2, color);
+    spanCache.fillCircle(spi, x + r / 2, y, r / 2, color);
     float a = (sqrt(2) * r) / 4.0;
     spi->fillTriangle(x, y, x - r / 2 - a, y + a, x + r / 2 + a, y + a, color);
     spi->fillTriangle(x, y + (r / 2) + 2 * a, x - r / 2 - a, y + a,
@@ -89,28 +93,51 @@ class Effect final : public Drawable {
   ~Effect() = default;
   Effect(const Effect &other) = default;
   Effect &operator=(const Effect &other) = default;
+
+  BoundingRect getBoundingRect() override {
+    return BoundingRect(24, 248, 64, 100);
+  }
+
+  bool isVisible(DrawContext *ctx) override {
+    return ctx->getExpression() != Expression::Neutral;
+  }
+
+  bool update(DrawContext *ctx, bool animate) override {
+    if (ctx->getExpression() == lastExpression &&
+        (!animate || ctx->getBreath() == lastOffset)) {
+      return false;
+    }
+    lastExpression = ctx->getExpression();
+    lastOffset = ctx->getBreath();
+    return true;
+  }
+
   void draw(M5Canvas *spi, BoundingRect rect, DrawContext *ctx) override {
-    uint16_t primaryColor = ctx->getColorDepth() == 1 ? 1 : ctx->getColorPalette()->get(COLOR_PRIMARY);
-    uint16_t bgColor = ctx->getColorDepth() == 1 ? ERACER_COLOR : ctx->getColorPalette()->get(COLOR_BACKGROUND);
+    uint16_t primaryColor = ctx->getColor(COLOR_PRIMARY);
+    uint16_t bgColor = ctx->getColor(COLOR_BACKGROUND);
     float offset = ctx->getBreath();
     Expression exp = ctx->getExpression();
+    // marks are placed relative to the area given by the rect
+    int32_t left = rect.getLeft();
+    int32_t top = rect.getTop();
     switch (exp) {
       case Expression::Doubt:
-        drawSweatMark(spi, 290, 110, 7, primaryColor, -offset);
+        drawSweatMark(spi, left + 42, top + 86, 7, primaryColor, -offset);
         break;
       case Expression::Angry:
-        drawAngerMark(spi, 280, 50, 12, primaryColor, bgColor, offset);
+        drawAngerMark(spi, left + 32, top + 26, 12, primaryColor, bgColor,
+                      offset);
         break;
       case Expression::Happy:
-        drawHeartMark(spi, 280, 50, 12, primaryColor, offset);
+        drawHeartMark(spi, left + 32, top + 26, 12, primaryColor, offset);
         break;
       case Expression::Sad:
         // drawChillMark(spi, 270, 0, 30, primaryColor, offset);
-        drawChillMark(spi, 270, 50, 30, primaryColor, offset); // Adjust for SSD1306
+        drawChillMark(spi, left + 22, top + 26, 30, primaryColor, offset); // Adjust for SSD1306
         break;
       case Expression::Sleepy:
-        drawBubbleMark(spi, 290, 40, 10, primaryColor, offset);
-        drawBubbleMark(spi, 270, 52, 6, primaryColor, -offset);
+        drawBubbleMark(spi, left + 42, top + 16, 10, primaryColor, offset);
+        drawBubbleMark(spi, left + 22, top + 28, 6, primaryColor, -offset);
         break;
       default:
         // noop
@@ -0,0 +1,109 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "ExpressionMorph.h"
+
+namespace m5avatar {
+
+ExpressionMorph::ExpressionMorph()
+    : from{Expression::Neutral},
+      to{Expression::Neutral},
+      startMillis{0},
+      durationMillis{0} {}
+
+void ExpressionMorph::setDuration(uint32_t durationMillis) {
+  this->durationMillis = durationMillis;
+}
+
+uint32_t ExpressionMorph::getDuration() const { return durationMillis; }
+
+void ExpressionMorph::start(Expression from, Expression to, uint32_t now) {
+  this->from = from;
+  this->to = to;
+  this->startMillis = now;
+}
+
+Expression ExpressionMorph::getFrom() const { return from; }
+
+Expression ExpressionMorph::getTo() const { return to; }
+
+uint8_t ExpressionMorph::getStep(uint32_t now) const {
+  uint32_t elapsed = now - startMillis;
+  if (from == to || elapsed >= durationMillis) {
+    return MORPH_STEPS;
+  }
+  return elapsed * MORPH_STEPS / durationMillis;
+}
+
+MorphFrameCache::MorphFrameCache() : entries{}, clock{0}, hits{0}, misses{0} {}
+
+MorphFrameCache::~MorphFrameCache() { clear(); }
+
+M5Canvas *MorphFrameCache::get(const void *part, Expression from,
+                               Expression to, uint8_t step, int colorDepth,
+                               uint16_t primaryColor, uint16_t backgroundColor,
+                               int16_t width, int16_t height, bool *created) {
+  clock++;
+  Entry *victim = &entries[0];
+  for (Entry &e : entries) {
+    if (e.frame != nullptr && e.part == part && e.from == from &&
+        e.to == to && e.step == step && e.colorDepth == colorDepth &&
+        e.primaryColor == primaryColor &&
+        e.backgroundColor == backgroundColor) {
+      e.lastUsed = clock;
+      hits++;
+      *created = false;
+      return e.frame;
+    }
+    if (victim->frame != nullptr &&
+        (e.frame == nullptr || e.lastUsed < victim->lastUsed)) {
+      victim = &e;
+    }
+  }
+
+  misses++;
+  if (victim->frame == nullptr) {
+    victim->frame = new M5Canvas();
+  } else {
+    victim->frame->deleteSprite();
+  }
+  if (colorDepth == COLOR_DEPTH_INDEXED) {
+    victim->frame->setColorDepth(lgfx::palette_8bit);
+  } else {
+    victim->frame->setColorDepth(colorDepth);
+  }
+  if (victim->frame->createSprite(width, height) == nullptr) {
+    delete victim->frame;
+    victim->frame = nullptr;
+    return nullptr;
+  }
+  if (colorDepth == COLOR_DEPTH_INDEXED) {
+    // NOTE: frames hold palette indices which are copied as they are
+    victim->frame->createPalette();
+  }
+  victim->frame->fillSprite(backgroundColor);
+  victim->part = part;
+  victim->from = from;
+  victim->to = to;
+  victim->step = step;
+  victim->colorDepth = colorDepth;
+  victim->primaryColor = primaryColor;
+  victim->backgroundColor = backgroundColor;
+  victim->lastUsed = clock;
+  *created = true;
+  return victim->frame;
+}
+
+void MorphFrameCache::clear() {
+  for (Entry &e : entries) {
+    delete e.frame;
+    e.frame = nullptr;
+  }
+}
+
+uint32_t MorphFrameCache::getHits() const { return hits; }
+
+uint32_t MorphFrameCache::getMisses() const { return misses; }
+
+}  // namespace m5avatar
@@ -0,0 +1,92 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef EXPRESSIONMORPH_H_
+#define EXPRESSIONMORPH_H_
+
+#define LGFX_USE_V1
+#include <M5GFX.h>
+#include "ColorPalette.h"
+#include "Expression.h"
+
+namespace m5avatar {
+
+// number of in-between frames an expression transition is quantized to
+const uint8_t MORPH_STEPS = 8;
+// maximum number of rasterized in-between frames kept by MorphFrameCache
+const uint8_t MORPH_CACHE_SIZE = 48;
+
+// blend weight of the target expression for an in-between step
+inline float morphWeight(uint8_t step) {
+  return (step + 1.0f) / (MORPH_STEPS + 1);
+}
+
+/**
+ * Timeline of a transition between two expressions
+ */
+class ExpressionMorph {
+ private:
+  Expression from;
+  Expression to;
+  uint32_t startMillis;
+  uint32_t durationMillis;
+
+ public:
+  ExpressionMorph();
+  ~ExpressionMorph() = default;
+  ExpressionMorph(const ExpressionMorph &other) = default;
+  ExpressionMorph &operator=(const ExpressionMorph &other) = default;
+  void setDuration(uint32_t durationMillis);
+  uint32_t getDuration() const;
+  void start(Expression from, Expression to, uint32_t now);
+  Expression getFrom() const;
+  Expression getTo() const;
+  // returns MORPH_STEPS once the transition is complete
+  uint8_t getStep(uint32_t now) const;
+};
+
+/**
+ * LRU cache of part-local in-between frames keyed by
+ * (part, from, to, step, colors), so that a repeated transition costs a blit
+ * per part instead of rasterizing the blended shapes again.
+ */
+class MorphFrameCache {
+ private:
+  struct Entry {
+    const void *part;
+    Expression from;
+    Expression to;
+    uint8_t step;
+    int colorDepth;
+    uint16_t primaryColor;
+    uint16_t backgroundColor;
+    uint32_t lastUsed;
+    M5Canvas *frame;
+  };
+  Entry entries[MORPH_CACHE_SIZE];
+  uint32_t clock;
+  uint32_t hits;
+  uint32_t misses;
+
+ public:
+  MorphFrameCache();
+  ~MorphFrameCache();
+  MorphFrameCache(const MorphFrameCache &other) = delete;
+  MorphFrameCache &operator=(const MorphFrameCache &other) = delete;
+
+  // Returns the frame for the key. When it is not cached yet a blank frame of
+  // the given size is allocated (evicting the least recently used one) and
+  // *created is set so that the caller rasterizes into it.
+  // Returns nullptr when no frame can be allocated.
+  M5Canvas *get(const void *part, Expression from, Expression to, uint8_t step,
+                int colorDepth, uint16_t primaryColor, uint16_t backgroundColor,
+                int16_t width, int16_t height, bool *created);
+  void clear();
+  uint32_t getHits() const;
+  uint32_t getMisses() const;
+};
+
+}  // namespace m5avatar
+
+#endif  // EXPRESSIONMORPH_H_
@@ -10,6 +10,44 @@ Eye::Eye(uint16_t x, uint16_t y, uint16_t r, bool isLeft) : Eye(r, isLeft) {}
 
 Eye::Eye(uint16_t r, bool isLeft) : r{r}, isLeft{isLeft} {}
 
+// NOTE: weight scales the mask from nothing (0) to its full shape (1)
+void Eye::drawMask(M5Canvas *spi, int32_t x, int32_t y, Expression exp,
+                   float weight, uint16_t backgroundColor) {
+  // TODO(meganetaaan): Refactor
+  if (exp == Expression::Angry || exp == Expression::Sad) {
+    int x0, y0, x1, y1, x2, y2;
+    x0 = x - r;
+    y0 = y - r;
+    x1 = x0 + r * 2;
+    y1 = y0;
+    x2 = !isLeft != !(exp == Expression::Sad) ? x0 : x1;
+    y2 = y0 + r * weight;
+    spi->fillTriangle(x0, y0, x1, y1, x2, y2, backgroundColor);
+  }
+  if (exp == Expression::Happy || exp == Expression::Sleepy) {
+    int x0, y0, w, h;
+    x0 = x - r;
+    y0 = y - r;
+    w = r * 2 + 4;
+    h = (r + 2) * weight;
+    if (exp == Expression::Happy) {
+      y0 += r + (r + 2) - h;
+      spanCache.fillCircle(spi, x, y, r / 1.5 * weight, backgroundColor);
+    }
+    spi->fillRect(x0, y0, w, h, backgroundColor);
+  }
+}
+
+void Eye::drawOpenEye(M5Canvas *spi, int32_t x, int32_t y, Expression from,
+                      Expression to, float weight, uint16_t primaryColor,
+                      uint16_t backgroundColor) {
+  spanCache.fillCircle(spi, x, y, r, primaryColor);
+  if (from != to) {
+    drawMask(spi, x, y, from, 1.0f - weight, backgroundColor);
+  }
+  drawMask(spi, x, y, to, weight, backgroundColor);
+}
+
 void Eye::draw(M5Canvas *spi, BoundingRect rect, DrawContext *ctx) {
   Expression exp = ctx->getExpression();
   uint32_t x = rect.getCenterX();
@@ -18,34 +56,32 @@ void Eye::draw(M5Canvas *spi, BoundingRect rect, DrawContext *ctx) {
   float openRatio = ctx->getEyeOpenRatio();
   uint32_t offsetX = g.getHorizontal() * 3;
   uint32_t offsetY = g.getVertical() * 3;
-  uint16_t primaryColor = ctx->getColorDepth() == 1 ? 1 : ctx->getColorPalette()->get(COLOR_PRIMARY);
-  uint16_t backgroundColor = ctx->getColorDepth() == 1 ? 0 : ctx->getColorPalette()->get(COLOR_BACKGROUND);
+  uint16_t primaryColor = ctx->getColor(COLOR_PRIMARY);
+  uint16_t backgroundColor = ctx->getColor(COLOR_BACKGROUND);
 
   if (openRatio > 0) {
-    spi->fillCircle(x + offsetX, y + offsetY, r, primaryColor);
-    // TODO(meganetaaan): Refactor
-    if (exp == Expression::Angry || exp == Expression::Sad) {
-      int x0, y0, x1, y1, x2, y2;
-      x0 = x + offsetX - r;
-      y0 = y + offsetY - r;
-      x1 = x0 + r * 2;
-      y1 = y0;
-      x2 = !isLeft != !(exp == Expression::Sad) ? x0 : x1;
-      y2 = y0 + r;
-      spi->fillTriangle(x0, y0, x1, y1, x2, y2, backgroundColor);
-    }
-    if (exp == Expression::Happy || exp == Expression::Sleepy) {
-      int x0, y0, w, h;
-      x0 = x + offsetX - r;
-      y0 = y + offsetY - r;
-      w = r * 2 + 4;
-      h = r + 2;
-      if (exp == Expression::Happy) {
-        y0 += r;
-        spi->fillCircle(x + offsetX, y + offsetY, r / 1.5, backgroundColor);
+    MorphFrameCache *cache = ctx->getMorphCache();
+    if (ctx->isMorphing() && cache != nullptr) {
+      // in-between frames are rasterized once around a local center (r, r)
+      // and blitted at the current gaze position afterwards
+      bool created = false;
+      M5Canvas *frame =
+          cache->get(this, ctx->getMorphFrom(), exp, ctx->getMorphStep(),
+                     ctx->getColorDepth(), primaryColor, backgroundColor,
+                     r * 2 + 4, r * 2 + 2, &created);
+      if (frame != nullptr) {
+        if (created) {
+          drawOpenEye(frame, r, r, ctx->getMorphFrom(), exp,
+                      morphWeight(ctx->getMorphStep()), primaryColor,
+                      backgroundColor);
+        }
+        frame->pushSprite(spi, x + offsetX - r, y + offsetY - r,
+                          backgroundColor);
+        return;
       }
-      spi->fillRect(x0, y0, w, h, backgroundColor);
     }
+    drawOpenEye(spi, x + offsetX, y + offsetY, exp, exp, 1.0f, primaryColor,
+                backgroundColor);
   } else {
     int x1 = x - r + offsetX;
     int y1 = y - 2 + offsetY;
@@ -9,6 +9,7 @@
 #include <M5GFX.h>
 #include "DrawContext.h"
 #include "Drawable.h"
+#include "SpanCache.h"
 
 namespace m5avatar {
 
@@ -16,6 +17,11 @@ class Eye final : public Drawable {
  private:
   uint16_t r;
   bool isLeft;
+  void drawMask(M5Canvas *spi, int32_t x, int32_t y, Expression exp,
+                float weight, uint16_t backgroundColor);
+  void drawOpenEye(M5Canvas *spi, int32_t x, int32_t y, Expression from,
+                   Expression to, float weight, uint16_t primaryColor,
+                   uint16_t backgroundColor);
 
  public:
   // constructor
@@ -8,14 +8,68 @@ namespace m5avatar {
 Eyeblow::Eyeblow(uint16_t w, uint16_t h, bool isLeft)
     : width{w}, height{h}, isLeft{isLeft} {}
 
+float Eyeblow::getTilt(Expression exp) {
+  if (exp == Expression::Angry || exp == Expression::Sad) {
+    return isLeft ^ (exp == Expression::Sad) ? -1 : 1;
+  }
+  return 0;
+}
+
+float Eyeblow::getLift(Expression exp) {
+  return exp == Expression::Happy ? -5 : 0;
+}
+
+void Eyeblow::drawMorph(M5Canvas *spi, int32_t x, int32_t y, Expression from,
+                        Expression to, float weight, uint16_t primaryColor) {
+  float a = getTilt(from) * (1.0f - weight) + getTilt(to) * weight;
+  int lift = getLift(from) * (1.0f - weight) + getLift(to) * weight;
+  if (a == 0) {
+    spi->fillRect(x - width / 2, y - height / 2 + lift, width, height,
+                  primaryColor);
+    return;
+  }
+  int dx = a * 3;
+  int dy = a * 5;
+  int x1 = x - width / 2;
+  int x2 = x1 - dx;
+  int x4 = x + width / 2;
+  int x3 = x4 + dx;
+  int y1 = y - height / 2 - dy + lift;
+  int y2 = y + height / 2 - dy + lift;
+  int y3 = y - height / 2 + dy + lift;
+  int y4 = y + height / 2 + dy + lift;
+  spi->fillTriangle(x1, y1, x2, y2, x3, y3, primaryColor);
+  spi->fillTriangle(x2, y2, x3, y3, x4, y4, primaryColor);
+}
+
 void Eyeblow::draw(M5Canvas *spi, BoundingRect rect, DrawContext *ctx) {
   Expression exp = ctx->getExpression();
   uint32_t x = rect.getLeft();
   uint32_t y = rect.getTop();
-  uint16_t primaryColor = ctx->getColorDepth() == 1 ? 1 : ctx->getColorPalette()->get(COLOR_PRIMARY);
+  uint16_t primaryColor = ctx->getColor(COLOR_PRIMARY);
   if (width == 0 || height == 0) {
     return;
   }
+  MorphFrameCache *cache = ctx->getMorphCache();
+  if (ctx->isMorphing() && cache != nullptr) {
+    // in-between frames keep a margin for the tilt (3, 5) and the lift (5)
+    uint16_t backgroundColor = ctx->getColor(COLOR_BACKGROUND);
+    int32_t ox = width / 2 + 4;
+    int32_t oy = height / 2 + 11;
+    bool created = false;
+    M5Canvas *frame =
+        cache->get(this, ctx->getMorphFrom(), exp, ctx->getMorphStep(),
+                   ctx->getColorDepth(), primaryColor, backgroundColor,
+                   ox * 2 + 1, oy * 2 + 1, &created);
+    if (frame != nullptr) {
+      if (created) {
+        drawMorph(frame, ox, oy, ctx->getMorphFrom(), exp,
+                  morphWeight(ctx->getMorphStep()), primaryColor);
+      }
+      frame->pushSprite(spi, x - ox, y - oy, backgroundColor);
+      return;
+    }
+  }
   // draw two triangles to make rectangle
   if (exp == Expression::Angry || exp == Expression::Sad) {
     int x1, y1, x2, y2, x3, y3, x4, y4;
@@ -17,6 +17,10 @@ class Eyeblow final : public Drawable {
   uint16_t width;
   uint16_t height;
   bool isLeft;
+  float getTilt(Expression exp);
+  float getLift(Expression exp);
+  void drawMorph(M5Canvas *spi, int32_t x, int32_t y, Expression from,
+                 Expression to, float weight, uint16_t primaryColor);
 
  public:
   // constructor
@@ -3,13 +3,16 @@
 // license information.
 
 #include "Face.h"
+#include "HeapTracker.h"
+#include "StackProfiler.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 #ifndef _min
 #define _min(a, b) std::min(a, b)
 #endif
 
 namespace m5avatar {
-BoundingRect br;
 
 Face::Face()
     : Face(new Mouth(50, 90, 4, 60), new BoundingRect(148, 163),
@@ -50,7 +53,26 @@ Face::Face(Drawable *mouth, BoundingRect *mouthPos, Drawable *eyeR,
       eyeblowLPos{eyeblowLPos},
       boundingRect{boundingRect},
       sprite{spr},
-      tmpSprite{tmpSpr} {}
+      tmpSprite{tmpSpr},
+      partsSprite{new M5Canvas()},
+      partsState{},
+      partsValid{false},
+      spriteDepth{0},
+      balloonLayer{new Layer(new Balloon(), 2)},
+      effectLayer{new Layer(new Effect(), 1)},
+      batteryIconLayer{new Layer(new BatteryIcon(), 3)},
+      layers{effectLayer, balloonLayer, batteryIconLayer},
+      morphCache{new MorphFrameCache()},
+      workerStrip{new M5Canvas()},
+      stripRotation{0},
+      stripScale{1},
+      stripTransparentColor{0}
+#ifndef SDL_h_
+      , stripTask{nullptr},
+      stripJobs{nullptr},
+      stripDone{nullptr}
+#endif
+      {}
 
 Face::~Face() {
   delete mouth;
@@ -64,17 +86,47 @@ Face::~Face() {
   delete eyeblowL;
   delete eyeblowLPos;
   delete sprite;
+  delete tmpSprite;
+  delete partsSprite;
   delete boundingRect;
-  delete b;
-  delete h;
-  delete battery;
+  delete balloonLayer;
+  delete effectLayer;
+  delete batteryIconLayer;
+  delete morphCache;
+#ifndef SDL_h_
+  // NOTE: the worker is idle between frames, waiting for the next job
+  if (stripTask != nullptr) {
+    vTaskDelete(stripTask);
+  }
+  if (stripJobs != nullptr) {
+    vQueueDelete(stripJobs);
+  }
+  if (stripDone != nullptr) {
+    vSemaphoreDelete(stripDone);
+  }
+#endif
+  delete workerStrip;
+}
+
+bool Face::PartsState::operator==(const PartsState &other) const {
+  return expression == other.expression && morphFrom == other.morphFrom &&
+         morphStep == other.morphStep && gazeV == other.gazeV &&
+         gazeH == other.gazeH && eyeOpenRatio == other.eyeOpenRatio &&
+         primaryColor == other.primaryColor &&
+         backgroundColor == other.backgroundColor;
 }
 
 void Face::setMouth(Drawable *mouth) { this->mouth = mouth; }
 
-void Face::setLeftEye(Drawable *eyeL) { this->eyeL = eyeL; }
+void Face::setLeftEye(Drawable *eyeL) {
+  this->eyeL = eyeL;
+  partsValid = false;
+}
 
-void Face::setRightEye(Drawable *eyeR) { this->eyeR = eyeR; }
+void Face::setRightEye(Drawable *eyeR) {
+  this->eyeR = eyeR;
+  partsValid = false;
+}
 
 Drawable *Face::getMouth() { return mouth; }
 
@@ -84,50 +136,198 @@ Drawable *Face::getRightEye() { return eyeR; }
 
 BoundingRect *Face::getBoundingRect() { return boundingRect; }
 
-void Face::draw(DrawContext *ctx) {
-  sprite->createSprite(boundingRect->getWidth(), boundingRect->getHeight());
-  sprite->setColorDepth(ctx->getColorDepth());
-  // NOTE: setting below for 1-bit color depth
-  sprite->setBitmapColor(ctx->getColorPalette()->get(COLOR_PRIMARY),
-    ctx->getColorPalette()->get(COLOR_BACKGROUND));
-  if (ctx->getColorDepth() != 1) {
-    sprite->fillSprite(ctx->getColorPalette()->get(COLOR_BACKGROUND));
+Layer *Face::getBalloonLayer() { return balloonLayer; }
+
+Layer *Face::getEffectLayer() { return effectLayer; }
+
+Layer *Face::getBatteryIconLayer() { return batteryIconLayer; }
+
+// keeps the face sprites allocated across frames; returns false when the
+// parts cache cannot be used
+bool Face::prepareSprites(DrawContext *ctx) {
+  int depth = ctx->getColorDepth();
+  if (depth != spriteDepth) {
+    sprite->deleteSprite();
+    partsSprite->deleteSprite();
+    partsValid = false;
+    spriteDepth = depth;
+  }
+  M5Canvas *canvases[] = {sprite, partsSprite};
+  for (M5Canvas *canvas : canvases) {
+    if (canvas->getBuffer() != nullptr) {
+      continue;
+    }
+    if (depth == COLOR_DEPTH_INDEXED) {
+      canvas->setColorDepth(lgfx::palette_8bit);
+      canvas->createSprite(boundingRect->getWidth(), boundingRect->getHeight());
+      canvas->createPalette();
+    } else {
+      canvas->setColorDepth(depth);
+      canvas->createSprite(boundingRect->getWidth(), boundingRect->getHeight());
+    }
+  }
+  if (depth == COLOR_DEPTH_INDEXED) {
+    // parts draw palette indices; the LUT converts them to RGB565 only when
+    // the strips are pushed
+    ctx->getColorPalette()->applyTo(sprite);
   } else {
-    sprite->fillSprite(0);
+    // NOTE: setting below for 1-bit color depth
+    sprite->setBitmapColor(ctx->getColorPalette()->get(COLOR_PRIMARY),
+      ctx->getColorPalette()->get(COLOR_BACKGROUND));
   }
-  float breath = _min(1.0f, ctx->getBreath());
-
-  // TODO(meganetaaan): unify drawing process of each parts
-  BoundingRect rect = *mouthPos;
-  rect.setPosition(rect.getTop() + breath * 3, rect.getLeft());
-  // copy context to each draw function
-  mouth->draw(sprite, rect, ctx);
+  return partsSprite->getBuffer() != nullptr;
+}
 
-  rect = *eyeRPos;
-  rect.setPosition(rect.getTop() + breath * 3, rect.getLeft());
-  eyeR->draw(sprite, rect, ctx);
+void Face::drawParts(M5Canvas *canvas, float offset, DrawContext *ctx) {
+  BoundingRect rect = *eyeRPos;
+  rect.setPosition(rect.getTop() + offset, rect.getLeft());
+  eyeR->draw(canvas, rect, ctx);
 
   rect = *eyeLPos;
-  rect.setPosition(rect.getTop() + breath * 3, rect.getLeft());
-  eyeL->draw(sprite, rect, ctx);
+  rect.setPosition(rect.getTop() + offset, rect.getLeft());
+  eyeL->draw(canvas, rect, ctx);
 
   rect = *eyeblowRPos;
-  rect.setPosition(rect.getTop() + breath * 3, rect.getLeft());
-  eyeblowR->draw(sprite, rect, ctx);
+  rect.setPosition(rect.getTop() + offset, rect.getLeft());
+  eyeblowR->draw(canvas, rect, ctx);
 
   rect = *eyeblowLPos;
-  rect.setPosition(rect.getTop() + breath * 3, rect.getLeft());
-  eyeblowL->draw(sprite, rect, ctx);
+  rect.setPosition(rect.getTop() + offset, rect.getLeft());
+  eyeblowL->draw(canvas, rect, ctx);
+}
+
+#ifndef SDL_h_
+void Face::stripLoop(void *args) {
+  static const uint8_t stripStack =
+      stackProfiler.operation("face.worker_strip");
+  Face *face = reinterpret_cast<Face *>(args);
+  int y;
+  for (;;) {
+    if (xQueueReceive(face->stripJobs, &y, portMAX_DELAY) == pdTRUE) {
+      TRACE_SCOPE("face.worker_strip");
+      StackScope stackScope(stripStack, y);
+      HeapScope heapScope(HeapTag::Render);
+      face->prepareStrip(face->workerStrip, y);
+      xSemaphoreGive(face->stripDone);
+    }
+  }
+}
+
+bool Face::startStripWorker() {
+  if (stripTask != nullptr) {
+    return true;
+  }
+  if (stripJobs == nullptr) {
+    stripJobs = xQueueCreate(1, sizeof(int));
+  }
+  if (stripDone == nullptr) {
+    stripDone = xSemaphoreCreateBinary();
+  }
+  if (stripJobs == nullptr || stripDone == nullptr) {
+    return false;
+  }
+  // the draw task runs on APP_CPU_NUM, so the worker takes the other core
+  xTaskCreatePinnedToCore(stripLoop, "stripLoop", STRIP_WORKER_STACK_SIZE,
+                          this, 1, &stripTask, PRO_CPU_NUM);
+  return stripTask != nullptr;
+}
+#endif
+
+void Face::prepareStrip(M5Canvas *strip, int y) {
+  // 背景色で塗り潰し
+  strip->clear();
+
+  // 傾きとズームを反映してspriteから短冊に転写
+  sprite->pushRotateZoom(strip, boundingRect->getWidth()>>1, (boundingRect->getHeight()>>1) - y, stripRotation, stripScale, stripScale);
 
-  // TODO(meganetaaan): make balloons and effects selectable
-  b->draw(sprite, br, ctx);
-  h->draw(sprite, br, ctx);
-  battery->draw(sprite, br, ctx);
+  // 各オーバーレイのレイヤーを同じ変換で短冊に重ねる
+  for (int i = 0; i < LAYER_COUNT; i++) {
+    layers[i]->push(strip, y, boundingRect->getWidth()>>1, boundingRect->getHeight()>>1, stripRotation, stripScale, stripTransparentColor);
+  }
+}
+
+void Face::pushStrip(M5Canvas *strip, int y) {
+  // 短冊から画面に転写
+  M5.Display.startWrite();
+
+  // 事前にstartWriteしておくことで、pushSprite はDMA転送を開始するとすぐに処理を終えて戻ってくる。
+  strip->pushSprite(&M5.Display, boundingRect->getLeft(), boundingRect->getTop() + y);
+
+  // DMA転送中にdelay処理を設けることにより、DMA転送中に他のタスクへCPU処理時間を譲ることができる。
+  lgfx::delay(1);
+
+  // endWriteによってDMA転送の終了を待つ。
+  M5.Display.endWrite();
+}
+
+void Face::draw(DrawContext *ctx) {
+  static const uint8_t drawMetric = metrics.histogram("face.draw_us");
+  static const uint8_t partsRedrawMetric = metrics.counter("face.parts_redraws");
+  uint32_t startMicros = lgfx::micros();
+  bool cacheParts = prepareSprites(ctx);
+  if (sprite->getBuffer() == nullptr) {
+    return;
+  }
+  uint16_t backgroundColor = ctx->getColor(COLOR_BACKGROUND);
+  float breath = _min(1.0f, ctx->getBreath());
+  // every part, the mouth included, moves by the same whole number of
+  // pixels; rounded down like the int coordinates of the old offset rects
+  int32_t shift = static_cast<int32_t>(floorf(breath * 3));
+  ctx->setMorphCache(morphCache);
+
+  // TODO(meganetaaan): unify drawing process of each parts
+  if (cacheParts) {
+    // a frame where only breath changed is a shifted copy of the cached parts
+    Gaze g = ctx->getGaze();
+    PartsState state{ctx->getExpression(), ctx->getMorphFrom(),
+                     ctx->getMorphStep(), g.getVertical(), g.getHorizontal(),
+                     ctx->getEyeOpenRatio(), ctx->getColor(COLOR_PRIMARY),
+                     backgroundColor};
+    if (!partsValid || !(state == partsState)) {
+      TRACE_SCOPE("face.parts");
+      partsSprite->fillSprite(backgroundColor);
+      drawParts(partsSprite, 0, ctx);
+      partsState = state;
+      partsValid = true;
+      metrics.increment(partsRedrawMetric);
+    }
+    int32_t height = sprite->height();
+    size_t stride = sprite->bufferLength() / height;
+    uint8_t *dst = static_cast<uint8_t *>(sprite->getBuffer());
+    const uint8_t *src = static_cast<const uint8_t *>(partsSprite->getBuffer());
+    if (shift >= 0) {
+      memcpy(dst + shift * stride, src, (height - shift) * stride);
+      sprite->fillRect(0, 0, sprite->width(), shift, backgroundColor);
+    } else {
+      memcpy(dst, src - shift * stride, (height + shift) * stride);
+      sprite->fillRect(0, height + shift, sprite->width(), -shift,
+                       backgroundColor);
+    }
+  } else {
+    sprite->fillSprite(backgroundColor);
+    drawParts(sprite, shift, ctx);
+  }
+
+  BoundingRect rect = *mouthPos;
+  rect.setPosition(rect.getTop() + shift, rect.getLeft());
+  // copy context to each draw function
+  mouth->draw(sprite, rect, ctx);
+
+  // overlays are redrawn into their own layers only when they have changed
+  balloonLayer->update(ctx, !ctx->isShed(ShedStage::BalloonLayout));
+  effectLayer->update(ctx, !ctx->isShed(ShedStage::EffectAnimation));
+  batteryIconLayer->update(ctx, !ctx->isShed(ShedStage::BatteryIcon));
+  for (int i = 1; i < LAYER_COUNT; i++) {
+    for (int j = i; j > 0 && layers[j - 1]->getZOrder() > layers[j]->getZOrder(); j--) {
+      std::swap(layers[j - 1], layers[j]);
+    }
+  }
   // drawAccessory(sprite, position, ctx);
 
   // TODO(meganetaaan): rethink responsibility for transform function
-  float scale = ctx->getScale();
-  float rotation = ctx->getRotation();
+  stripScale = ctx->getScale();
+  // a face drawn upright skips the most expensive part of the transform
+  stripRotation = ctx->isShed(ShedStage::RotationQuality) ? 0.0f : ctx->getRotation();
 
 // ▼▼▼▼ここから▼▼▼▼
   static constexpr uint8_t y_step = 8;
@@ -141,34 +341,49 @@ void Face::draw(DrawContext *ctx) {
     tmpSprite->createSprite(boundingRect->getWidth(), y_step);
   }
 
+  stripTransparentColor = ctx->getColor(COLOR_BACKGROUND);
+
   // 背景クリア用の色を設定
   tmpSprite->setBaseColor(ctx->getColorPalette()->get(COLOR_BACKGROUND));
+
+  // 並列モードでは1本おきの短冊をもう一方のコアで準備し、転送順は維持する
+  bool parallel = false;
+#ifndef SDL_h_
+  if (ctx->isParallelStrips() && startStripWorker()) {
+    if (workerStrip->getBuffer() == nullptr) {
+      workerStrip->setColorDepth(M5.Display.getColorDepth());
+      workerStrip->createSprite(boundingRect->getWidth(), y_step);
+    }
+    parallel = workerStrip->getBuffer() != nullptr;
+    workerStrip->setBaseColor(ctx->getColorPalette()->get(COLOR_BACKGROUND));
+  }
+#endif
+  TRACE_BEGIN("face.strips");
   int y = 0;
   do {
-    // 背景色で塗り潰し
-    tmpSprite->clear();
-
-    // 傾きとズームを反映してspriteからtmpSpriteに転写
-    sprite->pushRotateZoom(tmpSprite, boundingRect->getWidth()>>1, (boundingRect->getHeight()>>1) - y, rotation, scale, scale);
-
-    // tmpSpriteから画面に転写
-    M5.Display.startWrite();
-
-    // 事前にstartWriteしておくことで、pushSprite はDMA転送を開始するとすぐに処理を終えて戻ってくる。
-    tmpSprite->pushSprite(&M5.Display, boundingRect->getLeft(), boundingRect->getTop() + y);
-
-    // DMA転送中にdelay処理を設けることにより、DMA転送中に他のタスクへCPU処理時間を譲ることができる。
-    lgfx::delay(1);
-
-    // endWriteによってDMA転送の終了を待つ。
-    M5.Display.endWrite();
-
-  } while ((y += y_step) < boundingRect->getHeight());
+    int next = y + y_step;
+    bool offload = parallel && next < boundingRect->getHeight();
+#ifndef SDL_h_
+    if (offload) {
+      xQueueSend(stripJobs, &next, portMAX_DELAY);
+    }
+#endif
+    prepareStrip(tmpSprite, y);
+    pushStrip(tmpSprite, y);
+#ifndef SDL_h_
+    if (offload) {
+      xSemaphoreTake(stripDone, portMAX_DELAY);
+      pushStrip(workerStrip, next);
+      next += y_step;
+    }
+#endif
+    y = next;
+  } while (y < boundingRect->getHeight());
+  TRACE_END("face.strips");
+  metrics.record(drawMetric, lgfx::micros() - startMicros);
 
 // 削除するのが良いかどうか要検討 (次回メモリ確保できない場合は描画できなくなるので、維持しておいても良いかも？)
 // tmpSprite->deleteSprite();
 // ▲▲▲▲ここまで▲▲▲▲
-
-  sprite->deleteSprite();
 }
 }  // namespace m5avatar
\ No newline at end of file
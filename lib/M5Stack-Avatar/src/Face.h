@@ -12,11 +12,31 @@
 #include "Mouth.h"
 #include "Effect.h"
 #include "BatteryIcon.h"
+#include "Layer.h"
 
 namespace m5avatar {
 
+// number of overlay layers a face composites (balloon, effect, battery icon)
+const uint8_t LAYER_COUNT = 3;
+// stack of the strip worker in bytes; pushRotateZoom with the overlay
+// layers plus the trace and heap scopes around it. Check "face.worker_strip"
+// in the stack profiler when changing what a strip draws.
+const uint32_t STRIP_WORKER_STACK_SIZE = 4096;
+
 class Face {
  private:
+  // inputs of the eyes and eyebrows cached in partsSprite
+  struct PartsState {
+    Expression expression;
+    Expression morphFrom;
+    uint8_t morphStep;
+    float gazeV;
+    float gazeH;
+    float eyeOpenRatio;
+    uint16_t primaryColor;
+    uint16_t backgroundColor;
+    bool operator==(const PartsState &other) const;
+  };
   Drawable *mouth;
   Drawable *eyeR;
   Drawable *eyeL;
@@ -30,9 +50,31 @@ class Face {
   BoundingRect *boundingRect;
   M5Canvas *sprite;
   M5Canvas *tmpSprite;
-  Balloon *b;
-  Effect *h;
-  BatteryIcon *battery;
+  // eyes and eyebrows rasterized without breath, reused while only breath
+  // and the mouth change
+  M5Canvas *partsSprite;
+  PartsState partsState;
+  bool partsValid;
+  int spriteDepth;
+  Layer *balloonLayer;
+  Layer *effectLayer;
+  Layer *batteryIconLayer;
+  // overlays sorted in ascending z-order before compositing
+  Layer *layers[LAYER_COUNT];
+  MorphFrameCache *morphCache;
+  // second strip buffer, prepared on the other core in parallel mode
+  M5Canvas *workerStrip;
+  // transform of the strips of the frame being pushed
+  float stripRotation;
+  float stripScale;
+  uint16_t stripTransparentColor;
+#ifndef SDL_h_
+  TaskHandle_t stripTask;
+  QueueHandle_t stripJobs;
+  SemaphoreHandle_t stripDone;
+  static void stripLoop(void *args);
+  bool startStripWorker();
+#endif
 
  public:
   // constructor
@@ -61,6 +103,9 @@ class Face {
 
   Drawable *getMouth();
   BoundingRect *getBoundingRect();
+  Layer *getBalloonLayer();
+  Layer *getEffectLayer();
+  Layer *getBatteryIconLayer();
 
   void setLeftEye(Drawable *eye);
   void setRightEye(Drawable *eye);
@@ -69,6 +114,12 @@ class Face {
   void setRightEyeblow();
 
   void draw(DrawContext *ctx);
+
+ private:
+  bool prepareSprites(DrawContext *ctx);
+  void drawParts(M5Canvas *canvas, float offset, DrawContext *ctx);
+  void prepareStrip(M5Canvas *strip, int y);
+  void pushStrip(M5Canvas *strip, int y);
 };
 }  // namespace m5avatar
 
@@ -0,0 +1,66 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "FrameBudget.h"
+
+namespace m5avatar {
+
+FrameBudget::FrameBudget()
+    : stats{}, frameStartMicros{0}, headroomFrames{0} {}
+
+void FrameBudget::setBudget(uint32_t micros) {
+  stats.budgetMicros = micros;
+  if (micros == 0) {
+    stats.shedLevel = 0;
+  }
+}
+
+void FrameBudget::begin(uint32_t nowMicros) {
+  frameStartMicros = nowMicros;
+  for (uint8_t i = 0; i < stats.shedLevel; i++) {
+    stats.shedFrames[i]++;
+  }
+}
+
+void FrameBudget::end(uint32_t nowMicros) {
+  uint32_t elapsed = nowMicros - frameStartMicros;
+  stats.frames++;
+  stats.lastFrameMicros = elapsed;
+  if (elapsed > stats.maxFrameMicros) {
+    stats.maxFrameMicros = elapsed;
+  }
+  if (stats.budgetMicros == 0) {
+    return;
+  }
+  if (elapsed > stats.budgetMicros) {
+    stats.overBudgetFrames++;
+    headroomFrames = 0;
+    if (stats.shedLevel < SHED_STAGE_COUNT) {
+      stats.shedLevel++;
+    }
+  } else if (elapsed < stats.budgetMicros / 4 * 3) {
+    // restore one stage only after a run of frames with a quarter to spare
+    if (stats.shedLevel > 0 &&
+        ++headroomFrames >= FRAME_BUDGET_RECOVERY_FRAMES) {
+      stats.shedLevel--;
+      headroomFrames = 0;
+    }
+  }
+}
+
+bool FrameBudget::isShed(ShedStage stage) const {
+  return static_cast<uint8_t>(stage) < stats.shedLevel;
+}
+
+FrameStats FrameBudget::getStats() const { return stats; }
+
+void FrameBudget::resetStats() {
+  uint32_t budget = stats.budgetMicros;
+  uint8_t level = stats.shedLevel;
+  stats = FrameStats{};
+  stats.budgetMicros = budget;
+  stats.shedLevel = level;
+}
+
+}  // namespace m5avatar
@@ -0,0 +1,63 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef FRAMEBUDGET_H_
+#define FRAMEBUDGET_H_
+#include <stdint.h>
+
+namespace m5avatar {
+
+/**
+ * Optional rendering work, in the order it is shed when frames run long
+ */
+enum class ShedStage : uint8_t {
+  BalloonLayout,
+  EffectAnimation,
+  BatteryIcon,
+  RotationQuality
+};
+const uint8_t SHED_STAGE_COUNT = 4;
+
+// consecutive frames with headroom needed to restore one stage
+const uint8_t FRAME_BUDGET_RECOVERY_FRAMES = 30;
+
+struct FrameStats {
+  uint32_t frames;
+  uint32_t overBudgetFrames;
+  uint32_t lastFrameMicros;
+  uint32_t maxFrameMicros;
+  uint32_t budgetMicros;
+  uint8_t shedLevel;
+  // frames rendered with each stage shed
+  uint32_t shedFrames[SHED_STAGE_COUNT];
+};
+
+/**
+ * Per-frame time accounting. When a frame exceeds the budget the next frame
+ * sheds one more stage of optional work; stages come back one at a time once
+ * frames finish with headroom again.
+ */
+class FrameBudget {
+ private:
+  FrameStats stats;
+  uint32_t frameStartMicros;
+  uint8_t headroomFrames;
+
+ public:
+  FrameBudget();
+  ~FrameBudget() = default;
+  FrameBudget(const FrameBudget &other) = default;
+  FrameBudget &operator=(const FrameBudget &other) = default;
+  // 0 disables shedding
+  void setBudget(uint32_t micros);
+  void begin(uint32_t nowMicros);
+  void end(uint32_t nowMicros);
+  bool isShed(ShedStage stage) const;
+  FrameStats getStats() const;
+  void resetStats();
+};
+
+}  // namespace m5avatar
+
+#endif  // FRAMEBUDGET_H_
@@ -0,0 +1,227 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "GlyphCache.h"
+#ifndef SDL_h_
+#include <esp_heap_caps.h>
+#endif
+
+namespace m5avatar {
+
+GlyphCache glyphCache;
+
+namespace {
+
+// returns the next codepoint and advances text; invalid bytes are skipped
+uint16_t nextCodepoint(const char **text) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(*text);
+  uint16_t c = p[0];
+  int length = 1;
+  if (c >= 0xe0 && p[1] != 0 && p[2] != 0) {
+    c = ((c & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+    length = 3;
+  } else if (c >= 0xc0 && p[1] != 0) {
+    c = ((c & 0x1f) << 6) | (p[1] & 0x3f);
+    length = 2;
+  } else if (c >= 0x80) {
+    c = 0;
+  }
+  *text += length;
+  return c;
+}
+
+uint8_t *allocBitmap(size_t bytes) {
+#ifndef SDL_h_
+  // NOTE: glyphs are only read by the CPU, so PSRAM is good enough
+  void *p = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (p != nullptr) {
+    return static_cast<uint8_t *>(p);
+  }
+#endif
+  return static_cast<uint8_t *>(malloc(bytes));
+}
+
+const lgfx::IFont *fontOrDefault(const lgfx::IFont *font) {
+  return font != nullptr ? font : &fonts::Font0;
+}
+
+}  // namespace
+
+GlyphCache::GlyphCache()
+    : glyphs{}, clock{0}, budget{GLYPH_CACHE_BUDGET}, stats{} {}
+
+GlyphCache::~GlyphCache() { clear(); }
+
+void GlyphCache::evict(Glyph *glyph) {
+  if (!glyph->used) {
+    return;
+  }
+  if (glyph->bitmap != nullptr) {
+    stats.bytes -= ((glyph->width + 7) / 8) * glyph->height;
+    free(glyph->bitmap);
+    glyph->bitmap = nullptr;
+  }
+  glyph->used = false;
+  stats.glyphs--;
+  stats.evictions++;
+}
+
+const GlyphCache::Glyph *GlyphCache::find(const lgfx::IFont *font,
+                                          uint16_t codepoint, uint8_t size) {
+  clock++;
+  Glyph *victim = &glyphs[0];
+  for (Glyph &g : glyphs) {
+    if (g.used && g.font == font && g.codepoint == codepoint &&
+        g.size == size) {
+      g.lastUsed = clock;
+      stats.hits++;
+      return &g;
+    }
+    if (victim->used && (!g.used || g.lastUsed < victim->lastUsed)) {
+      victim = &g;
+    }
+  }
+
+  stats.misses++;
+  char utf8[4] = {};
+  if (codepoint < 0x80) {
+    utf8[0] = codepoint;
+  } else if (codepoint < 0x800) {
+    utf8[0] = 0xc0 | (codepoint >> 6);
+    utf8[1] = 0x80 | (codepoint & 0x3f);
+  } else {
+    utf8[0] = 0xe0 | (codepoint >> 12);
+    utf8[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+    utf8[2] = 0x80 | (codepoint & 0x3f);
+  }
+  M5Canvas scratch;
+  scratch.setColorDepth(1);
+  scratch.setFont(font);
+  scratch.setTextSize(size);
+  int16_t width = scratch.textWidth(utf8);
+  int16_t height = scratch.fontHeight();
+  size_t stride = (width + 7) / 8;
+  size_t bytes = stride * height;
+
+  evict(victim);
+  uint8_t *bitmap = nullptr;
+  if (bytes > 0 && bytes <= budget) {
+    while (stats.bytes + bytes > budget) {
+      Glyph *oldest = nullptr;
+      for (Glyph &g : glyphs) {
+        if (g.bitmap != nullptr &&
+            (oldest == nullptr || g.lastUsed < oldest->lastUsed)) {
+          oldest = &g;
+        }
+      }
+      evict(oldest);
+    }
+    bitmap = allocBitmap(bytes);
+    if (bitmap == nullptr ||
+        scratch.createSprite(width, height) == nullptr) {
+      free(bitmap);
+      return nullptr;
+    }
+    scratch.fillSprite(0);
+    scratch.setTextColor(1, 0);
+    scratch.setTextDatum(TL_DATUM);
+    scratch.drawString(utf8, 0, 0);
+    memset(bitmap, 0, bytes);
+    for (int16_t row = 0; row < height; row++) {
+      for (int16_t col = 0; col < width; col++) {
+        if (scratch.readPixelValue(col, row)) {
+          bitmap[row * stride + col / 8] |= 0x80 >> (col & 7);
+        }
+      }
+    }
+    scratch.deleteSprite();
+    stats.bytes += bytes;
+  }
+
+  victim->font = font;
+  victim->codepoint = codepoint;
+  victim->size = size;
+  victim->width = width;
+  victim->height = height;
+  victim->lastUsed = clock;
+  victim->bitmap = bitmap;
+  victim->used = true;
+  stats.glyphs++;
+  return victim;
+}
+
+int32_t GlyphCache::drawString(M5Canvas *spi, const lgfx::IFont *font,
+                               const char *text, uint8_t size, int32_t x,
+                               int32_t y, uint16_t color, uint16_t bgcolor) {
+  font = fontOrDefault(font);
+  int32_t left = x;
+  int32_t right = spi->width();
+  while (*text != 0 && x < right) {
+    const char *begin = text;
+    uint16_t codepoint = nextCodepoint(&text);
+    const Glyph *glyph = find(font, codepoint, size);
+    if (glyph == nullptr) {
+      // NOTE: out of memory; fall back to the font renderer
+      char utf8[4] = {};
+      memcpy(utf8, begin, text - begin);
+      spi->setFont(font);
+      spi->setTextSize(size);
+      spi->setTextColor(color, bgcolor);
+      spi->setTextDatum(TL_DATUM);
+      x += spi->drawString(utf8, x, y);
+      continue;
+    }
+    if (glyph->bitmap != nullptr && x + glyph->width > 0) {
+      spi->drawBitmap(x, y, glyph->bitmap, glyph->width, glyph->height, color,
+                      bgcolor);
+    }
+    x += glyph->width;
+  }
+  return x - left;
+}
+
+int32_t GlyphCache::textWidth(const lgfx::IFont *font, const char *text,
+                              uint8_t size) {
+  font = fontOrDefault(font);
+  int32_t width = 0;
+  while (*text != 0) {
+    const Glyph *glyph = find(font, nextCodepoint(&text), size);
+    if (glyph != nullptr) {
+      width += glyph->width;
+    }
+  }
+  return width;
+}
+
+int32_t GlyphCache::fontHeight(const lgfx::IFont *font, uint8_t size) {
+  const Glyph *glyph = find(fontOrDefault(font), ' ', size);
+  return glyph != nullptr ? glyph->height : 0;
+}
+
+void GlyphCache::setBudget(uint32_t bytes) {
+  budget = bytes;
+  clear();
+}
+
+void GlyphCache::clear() {
+  uint32_t evictions = stats.evictions;
+  for (Glyph &g : glyphs) {
+    evict(&g);
+  }
+  stats.evictions = evictions;
+}
+
+GlyphCacheStats GlyphCache::getStats() const {
+  GlyphCacheStats s = stats;
+  s.budget = budget;
+  return s;
+}
+
+void GlyphCache::resetStats() {
+  stats.hits = 0;
+  stats.misses = 0;
+  stats.evictions = 0;
+}
+
+}  // namespace m5avatar
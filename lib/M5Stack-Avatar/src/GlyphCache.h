@@ -0,0 +1,77 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef GLYPHCACHE_H_
+#define GLYPHCACHE_H_
+#define LGFX_USE_V1
+#include <M5GFX.h>
+
+namespace m5avatar {
+
+// maximum number of glyphs kept by GlyphCache
+const uint16_t GLYPH_CACHE_SIZE = 128;
+// default upper bound of the memory used by cached glyph bitmaps
+const uint32_t GLYPH_CACHE_BUDGET = 64 * 1024;
+
+struct GlyphCacheStats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+  uint16_t glyphs;
+  uint32_t bytes;
+  uint32_t budget;
+};
+
+/**
+ * Cache of rasterized glyphs keyed by (font, codepoint, text size).
+ * Glyphs are stored as pre-scaled 1bpp bitmaps (MSB first, rows padded to a
+ * byte) in PSRAM when available, so that scrolling text costs one bitmap blit
+ * per glyph instead of decoding the font again every frame.
+ * The least recently used glyphs are evicted to stay within the byte budget.
+ */
+class GlyphCache {
+ private:
+  struct Glyph {
+    const lgfx::IFont *font;
+    uint16_t codepoint;
+    uint8_t size;
+    int16_t width;
+    int16_t height;
+    uint32_t lastUsed;
+    // nullptr for empty glyphs and unused entries
+    uint8_t *bitmap;
+    bool used;
+  };
+  Glyph glyphs[GLYPH_CACHE_SIZE];
+  uint32_t clock;
+  uint32_t budget;
+  GlyphCacheStats stats;
+  const Glyph *find(const lgfx::IFont *font, uint16_t codepoint, uint8_t size);
+  void evict(Glyph *glyph);
+
+ public:
+  GlyphCache();
+  ~GlyphCache();
+  GlyphCache(const GlyphCache &other) = delete;
+  GlyphCache &operator=(const GlyphCache &other) = delete;
+
+  // Draws a UTF-8 string with its top left corner at (x, y) and returns the
+  // width of the string. Glyphs right of the canvas are skipped.
+  int32_t drawString(M5Canvas *spi, const lgfx::IFont *font, const char *text,
+                     uint8_t size, int32_t x, int32_t y, uint16_t color,
+                     uint16_t bgcolor);
+  int32_t textWidth(const lgfx::IFont *font, const char *text, uint8_t size);
+  int32_t fontHeight(const lgfx::IFont *font, uint8_t size);
+  void setBudget(uint32_t bytes);
+  void clear();
+  GlyphCacheStats getStats() const;
+  void resetStats();
+};
+
+// shared by the overlays, which are all drawn from the draw task
+extern GlyphCache glyphCache;
+
+}  // namespace m5avatar
+
+#endif  // GLYPHCACHE_H_
@@ -0,0 +1,366 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "HeapTracker.h"
+#include <atomic>
+#define LGFX_USE_V1
+#include <M5GFX.h>
+#ifndef SDL_h_
+#include <esp_timer.h>
+#endif
+
+// the wrappers run inside every malloc, also while the flash cache is
+// disabled, so everything they call is kept in IRAM
+#if !defined(SDL_h_) && defined(HEAP_TRACKER_WRAP)
+#define HEAP_HOOK_ATTR IRAM_ATTR
+#else
+#define HEAP_HOOK_ATTR
+#endif
+
+namespace m5avatar {
+
+HeapTracker heapTracker;
+
+namespace {
+
+const char *const tagNames[HEAP_TAGS] = {"other", "audio", "render", "tts",
+                                         "serial"};
+
+#ifndef SDL_h_
+portMUX_TYPE trackerLock = portMUX_INITIALIZER_UNLOCKED;
+
+HEAP_HOOK_ATTR void lock() { portENTER_CRITICAL_SAFE(&trackerLock); }
+
+HEAP_HOOK_ATTR void unlock() { portEXIT_CRITICAL_SAFE(&trackerLock); }
+#else
+std::atomic_flag trackerLock = ATOMIC_FLAG_INIT;
+
+void lock() {
+  while (trackerLock.test_and_set(std::memory_order_acquire)) {
+  }
+}
+
+void unlock() { trackerLock.clear(std::memory_order_release); }
+#endif
+
+HEAP_HOOK_ATTR uint32_t nowMillis() {
+#ifndef SDL_h_
+  return esp_timer_get_time() / 1000;
+#else
+  return lgfx::millis();
+#endif
+}
+
+HEAP_HOOK_ATTR void *currentTask() {
+#ifndef SDL_h_
+  return xTaskGetCurrentTaskHandle();
+#else
+  return reinterpret_cast<void *>(static_cast<uintptr_t>(SDL_ThreadID()));
+#endif
+}
+
+HEAP_HOOK_ATTR uint16_t home(const void *ptr) {
+  uint32_t key = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(ptr) >> 2);
+  return (key * 2654435761u) % HEAP_TRACK_CAPACITY;
+}
+
+}  // namespace
+
+const char *heapTagName(HeapTag tag) {
+  uint8_t i = static_cast<uint8_t>(tag);
+  return i < HEAP_TAGS ? tagNames[i] : "?";
+}
+
+HeapTracker::HeapTracker()
+    : stats{},
+      untrackedAllocations{0},
+      untrackedFrees{0},
+      sequence{0},
+      tasks{},
+      enabled{false},
+      entries{},
+      entryCount{0} {}
+
+void HeapTracker::begin() {
+  lock();
+  enabled = true;
+  unlock();
+}
+
+bool HeapTracker::isLinked() const {
+#ifdef HEAP_TRACKER_WRAP
+  return true;
+#else
+  return false;
+#endif
+}
+
+HEAP_HOOK_ATTR HeapTracker::Task *HeapTracker::findTask(void *task) {
+  for (Task &t : tasks) {
+    if (t.task == task) {
+      return &t;
+    }
+  }
+  return nullptr;
+}
+
+HEAP_HOOK_ATTR HeapTag HeapTracker::currentTag() {
+  Task *t = findTask(currentTask());
+  return t != nullptr ? t->tag : HeapTag::Other;
+}
+
+HeapTag HeapTracker::enter(HeapTag tag) {
+  void *task = currentTask();
+  lock();
+  Task *slot = findTask(task);
+  if (slot == nullptr) {
+    slot = findTask(nullptr);
+    if (slot != nullptr) {
+      slot->task = task;
+      slot->depth = 0;
+      slot->tag = HeapTag::Other;
+    }
+  }
+  HeapTag previous = HeapTag::Other;
+  if (slot != nullptr) {
+    previous = slot->tag;
+    slot->tag = tag;
+    slot->depth++;
+  }
+  unlock();
+  return previous;
+}
+
+void HeapTracker::leave(HeapTag previous) {
+  void *task = currentTask();
+  lock();
+  Task *slot = findTask(task);
+  if (slot != nullptr && slot->depth > 0) {
+    slot->tag = previous;
+    if (--slot->depth == 0) {
+      slot->task = nullptr;
+    }
+  }
+  unlock();
+}
+
+HeapSnapshot HeapTracker::snapshot() const {
+  HeapSnapshot snapshot{};
+  lock();
+  snapshot.millis = nowMillis();
+  snapshot.sequence = sequence;
+  for (uint8_t i = 0; i < HEAP_TAGS; i++) {
+    snapshot.tags[i] = stats[i];
+  }
+  snapshot.untrackedAllocations = untrackedAllocations;
+  snapshot.untrackedFrees = untrackedFrees;
+  unlock();
+  return snapshot;
+}
+
+uint32_t HeapTracker::findLeaks(const HeapSnapshot &since, HeapLeak *leaks,
+                                uint16_t max) const {
+  uint32_t found = 0;
+  uint16_t kept = 0;
+  lock();
+  uint32_t now = nowMillis();
+  for (const Entry &e : entries) {
+    // the sequence wraps after 2^32 allocations
+    if (e.ptr == nullptr ||
+        static_cast<int32_t>(e.sequence - since.sequence) < 0) {
+      continue;
+    }
+    found++;
+    // keep the largest ones, sorted by size
+    uint16_t i = kept < max ? kept++ : max;
+    while (i > 0 && leaks[i - 1].size < e.size) {
+      if (i < max) {
+        leaks[i] = leaks[i - 1];
+      }
+      i--;
+    }
+    if (i < max) {
+      leaks[i] = HeapLeak{e.ptr, e.size, e.tag, now - e.millis};
+    }
+  }
+  unlock();
+  return found;
+}
+
+HEAP_HOOK_ATTR bool HeapTracker::insert(void *ptr, uint32_t size,
+                                        HeapTag tag) {
+  // probing gets long when the table fills up
+  if (entryCount >= HEAP_TRACK_CAPACITY * 3 / 4) {
+    return false;
+  }
+  uint16_t i = home(ptr);
+  while (entries[i].ptr != nullptr) {
+    i = (i + 1) % HEAP_TRACK_CAPACITY;
+  }
+  entries[i] = Entry{ptr, size, nowMillis(), sequence++, tag};
+  entryCount++;
+  return true;
+}
+
+HEAP_HOOK_ATTR bool HeapTracker::remove(void *ptr, Entry *removed) {
+  uint16_t i = home(ptr);
+  while (entries[i].ptr != ptr) {
+    if (entries[i].ptr == nullptr) {
+      return false;
+    }
+    i = (i + 1) % HEAP_TRACK_CAPACITY;
+  }
+  *removed = entries[i];
+  // move later entries of the same probe run back into the gap, so that
+  // lookups never stop early at it
+  uint16_t j = i;
+  while (true) {
+    j = (j + 1) % HEAP_TRACK_CAPACITY;
+    if (entries[j].ptr == nullptr) {
+      break;
+    }
+    uint16_t k = home(entries[j].ptr);
+    bool between = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+    if (!between) {
+      entries[i] = entries[j];
+      i = j;
+    }
+  }
+  entries[i].ptr = nullptr;
+  entryCount--;
+  return true;
+}
+
+HEAP_HOOK_ATTR void HeapTracker::release(const Entry &e) {
+  // counted under the tag that allocated it
+  HeapTagStats &s = stats[static_cast<uint8_t>(e.tag)];
+  s.frees++;
+  s.freedBytes += e.size;
+  s.liveAllocations--;
+  s.liveBytes -= e.size;
+}
+
+HEAP_HOOK_ATTR void HeapTracker::onAlloc(void *ptr, size_t size) {
+  if (ptr == nullptr) {
+    return;
+  }
+  lock();
+  if (enabled) {
+    // still tracked: the block was freed where the wrappers do not see it
+    // (heap_caps_free) and handed out again
+    Entry stale;
+    if (remove(ptr, &stale)) {
+      release(stale);
+      untrackedFrees++;
+    }
+    HeapTag tag = currentTag();
+    HeapTagStats &s = stats[static_cast<uint8_t>(tag)];
+    s.allocations++;
+    s.allocatedBytes += size;
+    if (insert(ptr, size, tag)) {
+      s.liveAllocations++;
+      s.liveBytes += size;
+      if (s.liveBytes > s.peakLiveBytes) {
+        s.peakLiveBytes = s.liveBytes;
+      }
+    } else {
+      untrackedAllocations++;
+    }
+  }
+  unlock();
+}
+
+HEAP_HOOK_ATTR void HeapTracker::onFree(void *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  lock();
+  if (enabled) {
+    Entry e;
+    if (remove(ptr, &e)) {
+      release(e);
+    } else {
+      untrackedFrees++;
+    }
+  }
+  unlock();
+}
+
+}  // namespace m5avatar
+
+#ifdef HEAP_TRACKER_WRAP
+// Linked in place of the allocator with -Wl,--wrap=<name>; __real_<name> is
+// the original. Frees are reported before the block goes back to the heap,
+// so that another task cannot get the same address and report it first.
+using m5avatar::heapTracker;
+
+struct _reent;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+#ifndef SDL_h_
+void *__real__malloc_r(struct _reent *r, size_t size);
+void *__real__calloc_r(struct _reent *r, size_t n, size_t size);
+void *__real__realloc_r(struct _reent *r, void *ptr, size_t size);
+void __real__free_r(struct _reent *r, void *ptr);
+#endif
+
+HEAP_HOOK_ATTR void *__wrap_malloc(size_t size) {
+  void *ptr = __real_malloc(size);
+  heapTracker.onAlloc(ptr, size);
+  return ptr;
+}
+
+HEAP_HOOK_ATTR void *__wrap_calloc(size_t n, size_t size) {
+  void *ptr = __real_calloc(n, size);
+  heapTracker.onAlloc(ptr, n * size);
+  return ptr;
+}
+
+// a failed realloc leaves the old block alive but no longer tracked
+HEAP_HOOK_ATTR void *__wrap_realloc(void *ptr, size_t size) {
+  heapTracker.onFree(ptr);
+  void *result = __real_realloc(ptr, size);
+  heapTracker.onAlloc(result, size);
+  return result;
+}
+
+HEAP_HOOK_ATTR void __wrap_free(void *ptr) {
+  heapTracker.onFree(ptr);
+  __real_free(ptr);
+}
+
+#ifndef SDL_h_
+// newlib's own allocations (stdio buffers, ...)
+HEAP_HOOK_ATTR void *__wrap__malloc_r(struct _reent *r, size_t size) {
+  void *ptr = __real__malloc_r(r, size);
+  heapTracker.onAlloc(ptr, size);
+  return ptr;
+}
+
+HEAP_HOOK_ATTR void *__wrap__calloc_r(struct _reent *r, size_t n,
+                                      size_t size) {
+  void *ptr = __real__calloc_r(r, n, size);
+  heapTracker.onAlloc(ptr, n * size);
+  return ptr;
+}
+
+HEAP_HOOK_ATTR void *__wrap__realloc_r(struct _reent *r, void *ptr,
+                                       size_t size) {
+  heapTracker.onFree(ptr);
+  void *result = __real__realloc_r(r, ptr, size);
+  heapTracker.onAlloc(result, size);
+  return result;
+}
+
+HEAP_HOOK_ATTR void __wrap__free_r(struct _reent *r, void *ptr) {
+  heapTracker.onFree(ptr);
+  __real__free_r(r, ptr);
+}
+#endif
+}
+#endif
@@ -0,0 +1,134 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef HEAPTRACKER_H_
+#define HEAPTRACKER_H_
+#include <stdint.h>
+#include <stddef.h>
+
+namespace m5avatar {
+
+enum class HeapTag : uint8_t { Other, Audio, Render, Tts, Serial };
+const uint8_t HEAP_TAGS = 5;
+const char *heapTagName(HeapTag tag);
+
+// maximum number of tasks inside a HeapScope at the same time
+const uint8_t HEAP_TRACKER_TASKS = 16;
+// live allocations remembered (20 bytes each, internal RAM since the
+// allocator also runs while the flash cache is disabled); allocations beyond
+// three quarters of it are counted but not tracked
+const uint16_t HEAP_TRACK_CAPACITY = 512;
+
+struct HeapTagStats {
+  uint32_t allocations;
+  uint32_t frees;
+  uint32_t allocatedBytes;
+  uint32_t freedBytes;
+  uint32_t liveAllocations;
+  uint32_t liveBytes;
+  uint32_t peakLiveBytes;
+};
+
+struct HeapSnapshot {
+  uint32_t millis;
+  // number of allocations tracked so far; later ones are newer
+  uint32_t sequence;
+  HeapTagStats tags[HEAP_TAGS];
+  // allocations and frees the table could not follow
+  uint32_t untrackedAllocations;
+  uint32_t untrackedFrees;
+};
+
+// a tracked allocation still alive
+struct HeapLeak {
+  void *ptr;
+  uint32_t size;
+  HeapTag tag;
+  uint32_t ageMillis;
+};
+
+/**
+ * Heap use per subsystem.
+ * Code runs under a subsystem tag inside a HeapScope. Every malloc, calloc,
+ * realloc and free is reported to onAlloc()/onFree(), which count it under
+ * the tag of the calling task and remember it until freed, so live bytes,
+ * allocation rates and the allocations made since a snapshot are exact.
+ *
+ * The reports come from the linker: building with -DHEAP_TRACKER_WRAP and
+ * -Wl,--wrap=malloc (and calloc, realloc, free and their _r variants)
+ * routes the calls through HeapTracker.cpp. Memory taken directly with
+ * heap_caps_malloc() (sprite and DMA buffers) is not seen.
+ */
+class HeapTracker {
+ private:
+  struct Task {
+    void *task;
+    HeapTag tag;
+    uint8_t depth;
+  };
+  struct Entry {
+    void *ptr;
+    uint32_t size;
+    uint32_t millis;
+    uint32_t sequence;
+    HeapTag tag;
+  };
+  HeapTagStats stats[HEAP_TAGS];
+  uint32_t untrackedAllocations;
+  uint32_t untrackedFrees;
+  uint32_t sequence;
+  Task tasks[HEAP_TRACKER_TASKS];
+  bool enabled;
+  Entry entries[HEAP_TRACK_CAPACITY];
+  uint16_t entryCount;
+  bool insert(void *ptr, uint32_t size, HeapTag tag);
+  bool remove(void *ptr, Entry *removed);
+  void release(const Entry &e);
+  Task *findTask(void *task);
+  HeapTag currentTag();
+
+ public:
+  HeapTracker();
+  ~HeapTracker() = default;
+  HeapTracker(const HeapTracker &other) = delete;
+  HeapTracker &operator=(const HeapTracker &other) = delete;
+
+  void begin();
+  // whether the allocator calls are routed here in this build
+  bool isLinked() const;
+  // used by HeapScope; returns the tag to restore
+  HeapTag enter(HeapTag tag);
+  void leave(HeapTag previous);
+
+  HeapSnapshot snapshot() const;
+  // Tracked allocations made since the snapshot and still alive, largest
+  // first. Returns the number found, which can be more than max.
+  uint32_t findLeaks(const HeapSnapshot &since, HeapLeak *leaks,
+                     uint16_t max) const;
+
+  // called by the allocator wrappers
+  void onAlloc(void *ptr, size_t size);
+  void onFree(void *ptr);
+};
+
+// shared by the library and the application
+extern HeapTracker heapTracker;
+
+/**
+ * Counts the heap use of the rest of the enclosing block under a tag.
+ */
+class HeapScope {
+ private:
+  HeapTag previous;
+
+ public:
+  explicit HeapScope(HeapTag tag) : previous{heapTracker.enter(tag)} {}
+  ~HeapScope() { heapTracker.leave(previous); }
+  HeapScope(const HeapScope &other) = delete;
+  HeapScope &operator=(const HeapScope &other) = delete;
+};
+
+}  // namespace m5avatar
+
+#endif  // HEAPTRACKER_H_
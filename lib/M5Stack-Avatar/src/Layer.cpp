@@ -0,0 +1,122 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "Layer.h"
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+namespace m5avatar {
+
+Layer::Layer(Overlay *overlay, int zOrder)
+    : overlay{overlay},
+      rect{overlay->getBoundingRect()},
+      zOrder{zOrder},
+      dirty{true},
+      visible{false},
+      colorDepth{0},
+      primaryColor{0},
+      backgroundColor{0},
+      canvas{new M5Canvas()},
+      redrawCount{0} {}
+
+Layer::~Layer() {
+  delete canvas;
+  delete overlay;
+}
+
+Overlay *Layer::getOverlay() { return overlay; }
+
+BoundingRect *Layer::getBoundingRect() { return &rect; }
+
+int Layer::getZOrder() const { return zOrder; }
+
+void Layer::setZOrder(int zOrder) { this->zOrder = zOrder; }
+
+bool Layer::isVisible() const { return visible; }
+
+void Layer::invalidate() { dirty = true; }
+
+uint32_t Layer::getRedrawCount() const { return redrawCount; }
+
+bool Layer::update(DrawContext *ctx, bool animate) {
+  visible = overlay->isVisible(ctx);
+  if (!visible) {
+    return false;
+  }
+  ColorPalette *cp = ctx->getColorPalette();
+  uint16_t primary = cp->get(COLOR_PRIMARY);
+  uint16_t background = cp->get(COLOR_BACKGROUND);
+  if (ctx->getColorDepth() != colorDepth) {
+    canvas->deleteSprite();
+    colorDepth = ctx->getColorDepth();
+    dirty = true;
+  }
+  // NOTE: only direct color canvases bake the colors into their pixels
+  if (colorDepth != 1 && colorDepth != COLOR_DEPTH_INDEXED &&
+      (primary != primaryColor || background != backgroundColor)) {
+    dirty = true;
+  }
+  primaryColor = primary;
+  backgroundColor = background;
+
+  if (canvas->getBuffer() == nullptr) {
+    if (colorDepth == COLOR_DEPTH_INDEXED) {
+      canvas->setColorDepth(lgfx::palette_8bit);
+    } else {
+      canvas->setColorDepth(colorDepth);
+    }
+    if (canvas->createSprite(rect.getWidth(), rect.getHeight()) == nullptr) {
+      visible = false;
+      return false;
+    }
+    if (colorDepth == COLOR_DEPTH_INDEXED) {
+      canvas->createPalette();
+    }
+  }
+  if (colorDepth == 1) {
+    // NOTE: setting below for 1-bit color depth
+    canvas->setBitmapColor(primaryColor, backgroundColor);
+  } else if (colorDepth == COLOR_DEPTH_INDEXED) {
+    cp->applyTo(canvas);
+  }
+
+  // NOTE: update() has to run every frame to advance the overlay animation
+  bool changed = overlay->update(ctx, animate);
+  if (!changed && !dirty) {
+    return false;
+  }
+  canvas->fillSprite(ctx->getColor(COLOR_BACKGROUND));
+  overlay->draw(canvas, BoundingRect(0, 0, rect.getWidth(), rect.getHeight()),
+                ctx);
+  dirty = false;
+  redrawCount++;
+  return true;
+}
+
+void Layer::push(M5Canvas *strip, int16_t stripY, float pivotX, float pivotY,
+                 float rotation, float scale, uint16_t transparentColor) {
+  if (!visible || canvas->getBuffer() == nullptr) {
+    return;
+  }
+  // map the layer center the same way pushRotateZoom maps the face
+  float rad = rotation * PI / 180.0f;
+  float c = cosf(rad) * scale;
+  float s = sinf(rad) * scale;
+  float dx = rect.getLeft() + rect.getWidth() / 2.0f - pivotX;
+  float dy = rect.getTop() + rect.getHeight() / 2.0f - pivotY;
+  float x = pivotX + dx * c - dy * s;
+  float y = pivotY - stripY + dx * s + dy * c;
+
+  // skip strips the transformed layer cannot touch
+  float reach = (rect.getWidth() + rect.getHeight()) * 0.5f * scale + 1;
+  if (y + reach < 0 || y - reach > strip->height()) {
+    return;
+  }
+  canvas->pushRotateZoom(strip, x, y, rotation, scale, scale,
+                         transparentColor);
+}
+
+}  // namespace m5avatar
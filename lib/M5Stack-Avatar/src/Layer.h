@@ -0,0 +1,59 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef LAYER_H_
+#define LAYER_H_
+#define LGFX_USE_V1
+#include <M5GFX.h>
+#include "BoundingRect.h"
+#include "DrawContext.h"
+#include "Overlay.h"
+
+namespace m5avatar {
+/**
+ * Cached canvas of an overlay, composited onto the face per output strip
+ */
+class Layer {
+ private:
+  Overlay *overlay;
+  BoundingRect rect;
+  int zOrder;
+  bool dirty;
+  bool visible;
+  int colorDepth;
+  uint16_t primaryColor;
+  uint16_t backgroundColor;
+  M5Canvas *canvas;
+  uint32_t redrawCount;
+
+ public:
+  Layer() = delete;
+  // the layer takes the ownership of the overlay
+  Layer(Overlay *overlay, int zOrder);
+  ~Layer();
+  Layer(const Layer &other) = delete;
+  Layer &operator=(const Layer &other) = delete;
+  Overlay *getOverlay();
+  BoundingRect *getBoundingRect();
+  int getZOrder() const;
+  void setZOrder(int zOrder);
+  bool isVisible() const;
+  void invalidate();
+  uint32_t getRedrawCount() const;
+
+  // Redraws the cached canvas only when the overlay has changed. animate is
+  // passed to the overlay so that it can hold its animation while shed.
+  // Returns true when the layer was redrawn.
+  bool update(DrawContext *ctx, bool animate = true);
+
+  // Composites the layer onto a strip that starts at row stripY of the face
+  // whose rotation pivot is (pivotX, pivotY), using the same transform as
+  // the face itself.
+  void push(M5Canvas *strip, int16_t stripY, float pivotX, float pivotY,
+            float rotation, float scale, uint16_t transparentColor);
+};
+
+}  // namespace m5avatar
+
+#endif  // LAYER_H_
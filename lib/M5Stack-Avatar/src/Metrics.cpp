@@ -0,0 +1,186 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "Metrics.h"
+#include <string.h>
+#define LGFX_USE_V1
+#include <M5GFX.h>
+
+namespace m5avatar {
+
+const uint32_t HISTOGRAM_BOUNDS[HISTOGRAM_BUCKETS] = {
+    50,     100,    200,    500,     1000,    2000,    5000,    10000,
+    20000,  50000,  100000, 200000, 500000, 1000000, 2000000, UINT32_MAX};
+
+Metrics metrics;
+
+namespace {
+
+// NOTE: a critical section rather than a plain spin, since a task preempted
+// while registering would never let a spinning task on its core go on
+#ifndef SDL_h_
+portMUX_TYPE registryLock = portMUX_INITIALIZER_UNLOCKED;
+
+void lockRegistry() { portENTER_CRITICAL(&registryLock); }
+
+void unlockRegistry() { portEXIT_CRITICAL(&registryLock); }
+#else
+std::atomic_flag registryLock = ATOMIC_FLAG_INIT;
+
+void lockRegistry() {
+  while (registryLock.test_and_set(std::memory_order_acquire)) {
+  }
+}
+
+void unlockRegistry() { registryLock.clear(std::memory_order_release); }
+#endif
+
+uint8_t coreId() {
+#ifndef SDL_h_
+  return xPortGetCoreID() % METRICS_SHARDS;
+#else
+  return 0;
+#endif
+}
+
+}  // namespace
+
+Metrics::Metrics() : entries{}, shards{}, entryCount{0} {}
+
+uint8_t Metrics::add(const char *name, MetricType type) {
+  lockRegistry();
+  uint8_t count = entryCount.load(std::memory_order_relaxed);
+  uint8_t id = METRIC_INVALID;
+  for (uint8_t i = 0; i < count; i++) {
+    if (strcmp(entries[i].name, name) == 0) {
+      id = i;
+    }
+  }
+  if (id == METRIC_INVALID && count < METRICS_MAX) {
+    id = count;
+    entries[id].name = name;
+    entries[id].type = type;
+    // publish the entry only after it is filled in
+    entryCount.store(count + 1, std::memory_order_release);
+  }
+  unlockRegistry();
+  return id;
+}
+
+Metrics::Shard *Metrics::shard(uint8_t id) {
+  return id < METRICS_MAX ? &shards[coreId()][id] : nullptr;
+}
+
+uint8_t Metrics::counter(const char *name) {
+  return add(name, MetricType::Counter);
+}
+
+uint8_t Metrics::gauge(const char *name) {
+  return add(name, MetricType::Gauge);
+}
+
+uint8_t Metrics::histogram(const char *name) {
+  return add(name, MetricType::Histogram);
+}
+
+void Metrics::increment(uint8_t id, uint32_t n) {
+  Shard *s = shard(id);
+  if (s != nullptr) {
+    s->value.fetch_add(n, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::set(uint8_t id, int32_t value) {
+  if (id < METRICS_MAX) {
+    entries[id].gauge.store(value, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::record(uint8_t id, uint32_t micros) {
+  Shard *s = shard(id);
+  if (s == nullptr) {
+    return;
+  }
+  uint8_t bucket = 0;
+  while (micros > HISTOGRAM_BOUNDS[bucket]) {
+    bucket++;
+  }
+  s->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  s->value.fetch_add(1, std::memory_order_relaxed);
+  s->sum.fetch_add(micros, std::memory_order_relaxed);
+  uint32_t max = s->max.load(std::memory_order_relaxed);
+  while (micros > max &&
+         !s->max.compare_exchange_weak(max, micros, std::memory_order_relaxed)) {
+  }
+}
+
+uint8_t Metrics::size() const {
+  return entryCount.load(std::memory_order_acquire);
+}
+
+MetricSnapshot Metrics::read(uint8_t id) const {
+  MetricSnapshot snapshot{};
+  if (id >= size()) {
+    return snapshot;
+  }
+  const Entry &entry = entries[id];
+  snapshot.name = entry.name;
+  snapshot.type = entry.type;
+  if (entry.type == MetricType::Gauge) {
+    snapshot.value = entry.gauge.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+  for (uint8_t core = 0; core < METRICS_SHARDS; core++) {
+    const Shard &s = shards[core][id];
+    uint32_t value = s.value.load(std::memory_order_relaxed);
+    if (entry.type == MetricType::Counter) {
+      snapshot.value += value;
+      continue;
+    }
+    snapshot.count += value;
+    snapshot.sumMicros += s.sum.load(std::memory_order_relaxed);
+    uint32_t max = s.max.load(std::memory_order_relaxed);
+    if (max > snapshot.maxMicros) {
+      snapshot.maxMicros = max;
+    }
+    for (uint8_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+      snapshot.buckets[b] += s.buckets[b].load(std::memory_order_relaxed);
+    }
+  }
+  return snapshot;
+}
+
+uint32_t Metrics::percentile(const MetricSnapshot &snapshot, uint8_t percent) {
+  if (snapshot.count == 0) {
+    return 0;
+  }
+  // rank of the sample at the percentile, rounded up
+  uint32_t rank = (static_cast<uint64_t>(snapshot.count) * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+    seen += snapshot.buckets[b];
+    if (seen >= rank && seen > 0) {
+      // no sample is larger than the maximum, which also bounds the
+      // open-ended last bucket
+      return HISTOGRAM_BOUNDS[b] < snapshot.maxMicros ? HISTOGRAM_BOUNDS[b]
+                                                      : snapshot.maxMicros;
+    }
+  }
+  return snapshot.maxMicros;
+}
+
+void Metrics::reset() {
+  for (uint8_t core = 0; core < METRICS_SHARDS; core++) {
+    for (Shard &s : shards[core]) {
+      s.value.store(0, std::memory_order_relaxed);
+      s.sum.store(0, std::memory_order_relaxed);
+      s.max.store(0, std::memory_order_relaxed);
+      for (std::atomic<uint32_t> &b : s.buckets) {
+        b.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+}  // namespace m5avatar
@@ -0,0 +1,93 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef METRICS_H_
+#define METRICS_H_
+#include <stdint.h>
+#include <atomic>
+
+namespace m5avatar {
+
+// maximum number of registered metrics
+const uint8_t METRICS_MAX = 32;
+// number of cores updates are sharded over
+const uint8_t METRICS_SHARDS = 2;
+const uint8_t HISTOGRAM_BUCKETS = 16;
+// inclusive upper bounds of the histogram buckets in microseconds; the last
+// bucket takes everything above the previous bound
+extern const uint32_t HISTOGRAM_BOUNDS[HISTOGRAM_BUCKETS];
+// returned by the register functions when the registry is full; updates to
+// it are ignored
+const uint8_t METRIC_INVALID = 0xff;
+
+enum class MetricType : uint8_t { Counter, Gauge, Histogram };
+
+// merged view of one metric
+struct MetricSnapshot {
+  const char *name;
+  MetricType type;
+  // counter total or gauge value
+  int32_t value;
+  // histograms only; sumMicros wraps after about 71 minutes of samples
+  uint32_t count;
+  uint32_t sumMicros;
+  uint32_t maxMicros;
+  uint32_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Registry of counters, gauges and fixed-bucket latency histograms.
+ * Counters and histograms are updated with relaxed atomics in the shard of the
+ * calling core, so concurrent updates never contend for a lock and the core
+ * that reads merges the shards. Gauges hold the last value set.
+ * Register metrics once (e.g. into a function-local static) and keep the id.
+ */
+class Metrics {
+ private:
+  struct Shard {
+    std::atomic<uint32_t> value;
+    std::atomic<uint32_t> sum;
+    std::atomic<uint32_t> max;
+    std::atomic<uint32_t> buckets[HISTOGRAM_BUCKETS];
+  };
+  struct Entry {
+    const char *name;
+    MetricType type;
+    std::atomic<int32_t> gauge;
+  };
+  Entry entries[METRICS_MAX];
+  Shard shards[METRICS_SHARDS][METRICS_MAX];
+  std::atomic<uint8_t> entryCount;
+  uint8_t add(const char *name, MetricType type);
+  Shard *shard(uint8_t id);
+
+ public:
+  Metrics();
+  ~Metrics() = default;
+  Metrics(const Metrics &other) = delete;
+  Metrics &operator=(const Metrics &other) = delete;
+
+  // Registering a name again returns the existing id.
+  uint8_t counter(const char *name);
+  uint8_t gauge(const char *name);
+  uint8_t histogram(const char *name);
+  void increment(uint8_t id, uint32_t n = 1);
+  void set(uint8_t id, int32_t value);
+  void record(uint8_t id, uint32_t micros);
+
+  uint8_t size() const;
+  MetricSnapshot read(uint8_t id) const;
+  // estimated from the buckets: the upper bound of the bucket holding the
+  // given percentile (0-100)
+  static uint32_t percentile(const MetricSnapshot &snapshot, uint8_t percent);
+  // clears counters and histograms; gauges keep their value
+  void reset();
+};
+
+// shared by the library and the application
+extern Metrics metrics;
+
+}  // namespace m5avatar
+
+#endif  // METRICS_H_
@@ -0,0 +1,32 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef OVERLAY_H_
+#define OVERLAY_H_
+#define LGFX_USE_V1
+#include <M5GFX.h>
+#include "BoundingRect.h"
+#include "DrawContext.h"
+#include "Drawable.h"
+
+namespace m5avatar {
+/**
+ * Drawable that is rendered into its own cached layer on top of the face.
+ * draw() receives the area to draw into; overlays draw relative to its
+ * top-left corner so that the same code works for a layer and the face.
+ */
+class Overlay : public Drawable {
+ public:
+  virtual ~Overlay() = default;
+  // default area of the overlay on the face
+  virtual BoundingRect getBoundingRect() = 0;
+  virtual bool isVisible(DrawContext *drawContext) = 0;
+  // advances the overlay's own animation unless animate is false, and
+  // returns true when it looks different from the last draw
+  virtual bool update(DrawContext *drawContext, bool animate) = 0;
+};
+
+}  // namespace m5avatar
+
+#endif  // OVERLAY_H_
@@ -0,0 +1,116 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "SpanCache.h"
+
+namespace m5avatar {
+
+SpanCache spanCache;
+
+SpanCache::SpanCache() : entries{}, clock{0}, hits{0}, misses{0} {}
+
+SpanCache::~SpanCache() { clear(); }
+
+const SpanCache::Entry *SpanCache::find(int16_t rx, int16_t ry, bool circle) {
+  clock++;
+  Entry *victim = &entries[0];
+  for (Entry &e : entries) {
+    if (e.spans != nullptr && e.rx == rx && e.ry == ry && e.circle == circle) {
+      e.lastUsed = clock;
+      hits++;
+      return &e;
+    }
+    if (victim->spans != nullptr &&
+        (e.spans == nullptr || e.lastUsed < victim->lastUsed)) {
+      victim = &e;
+    }
+  }
+
+  misses++;
+  int16_t w = rx * 2 + 1;
+  int16_t h = ry * 2 + 1;
+  M5Canvas scratch;
+  scratch.setColorDepth(1);
+  if (scratch.createSprite(w, h) == nullptr) {
+    return nullptr;
+  }
+  int16_t *spans = new int16_t[h * 2];
+  scratch.fillSprite(0);
+  if (circle) {
+    scratch.fillCircle(rx, ry, rx, 1);
+  } else {
+    scratch.fillEllipse(rx, ry, rx, ry, 1);
+  }
+  // NOTE: each row of a filled circle or ellipse is a single span
+  for (int16_t row = 0; row < h; row++) {
+    int16_t first = -1;
+    int16_t last = -1;
+    for (int16_t col = 0; col < w; col++) {
+      if (scratch.readPixelValue(col, row)) {
+        if (first < 0) {
+          first = col;
+        }
+        last = col;
+      }
+    }
+    spans[row * 2] = first - rx;
+    spans[row * 2 + 1] = first < 0 ? 0 : last - first + 1;
+  }
+  scratch.deleteSprite();
+
+  delete[] victim->spans;
+  victim->rx = rx;
+  victim->ry = ry;
+  victim->circle = circle;
+  victim->lastUsed = clock;
+  victim->spans = spans;
+  return victim;
+}
+
+void SpanCache::fill(M5Canvas *spi, const Entry *entry, int32_t x, int32_t y,
+                     uint16_t color) {
+  int16_t h = entry->ry * 2 + 1;
+  int32_t top = y - entry->ry;
+  spi->startWrite();
+  for (int16_t row = 0; row < h; row++) {
+    int16_t width = entry->spans[row * 2 + 1];
+    if (width > 0) {
+      spi->drawFastHLine(x + entry->spans[row * 2], top + row, width, color);
+    }
+  }
+  spi->endWrite();
+}
+
+void SpanCache::fillCircle(M5Canvas *spi, int32_t x, int32_t y, int32_t r,
+                           uint16_t color) {
+  const Entry *entry = r > 0 ? find(r, r, true) : nullptr;
+  if (entry == nullptr) {
+    spi->fillCircle(x, y, r, color);
+    return;
+  }
+  fill(spi, entry, x, y, color);
+}
+
+void SpanCache::fillEllipse(M5Canvas *spi, int32_t x, int32_t y, int32_t rx,
+                            int32_t ry, uint16_t color) {
+  const Entry *entry = rx > 0 && ry > 0 ? find(rx, ry, false) : nullptr;
+  if (entry == nullptr) {
+    spi->fillEllipse(x, y, rx, ry, color);
+    return;
+  }
+  fill(spi, entry, x, y, color);
+}
+
+void SpanCache::clear() {
+  for (Entry &e : entries) {
+    delete[] e.spans;
+    e.spans = nullptr;
+  }
+}
+
+uint32_t SpanCache::getHits() const { return hits; }
+
+uint32_t SpanCache::getMisses() const { return misses; }
+
+}  // namespace m5avatar
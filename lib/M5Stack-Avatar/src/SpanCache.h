@@ -0,0 +1,58 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef SPANCACHE_H_
+#define SPANCACHE_H_
+#define LGFX_USE_V1
+#include <M5GFX.h>
+
+namespace m5avatar {
+
+// number of shapes kept by SpanCache
+const uint8_t SPAN_CACHE_SIZE = 24;
+
+/**
+ * Cache of horizontal span tables of filled circles and ellipses.
+ * A table is built once per (rx, ry) by rasterizing the shape with M5GFX
+ * itself, so filling from it is pixel-identical to fillCircle/fillEllipse
+ * while costing only one horizontal line fill per row.
+ */
+class SpanCache {
+ private:
+  struct Entry {
+    int16_t rx;
+    int16_t ry;
+    bool circle;
+    uint32_t lastUsed;
+    // per row: first column relative to the center and the span width
+    int16_t *spans;
+  };
+  Entry entries[SPAN_CACHE_SIZE];
+  uint32_t clock;
+  uint32_t hits;
+  uint32_t misses;
+  const Entry *find(int16_t rx, int16_t ry, bool circle);
+  void fill(M5Canvas *spi, const Entry *entry, int32_t x, int32_t y,
+            uint16_t color);
+
+ public:
+  SpanCache();
+  ~SpanCache();
+  SpanCache(const SpanCache &other) = delete;
+  SpanCache &operator=(const SpanCache &other) = delete;
+  void fillCircle(M5Canvas *spi, int32_t x, int32_t y, int32_t r,
+                  uint16_t color);
+  void fillEllipse(M5Canvas *spi, int32_t x, int32_t y, int32_t rx,
+                   int32_t ry, uint16_t color);
+  void clear();
+  uint32_t getHits() const;
+  uint32_t getMisses() const;
+};
+
+// shared by the parts, which are all drawn from the draw task
+extern SpanCache spanCache;
+
+}  // namespace m5avatar
+
+#endif  // SPANCACHE_H_
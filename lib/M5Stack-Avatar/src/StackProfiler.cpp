@@ -0,0 +1,215 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "StackProfiler.h"
+#include <string.h>
+#include <atomic>
+#define LGFX_USE_V1
+#include <M5GFX.h>
+
+namespace m5avatar {
+
+StackProfiler stackProfiler;
+
+namespace {
+
+// begin() and end() run on every profiled frame and command, so the lock
+// must not be held across a preemption (see Metrics.cpp)
+#ifndef SDL_h_
+portMUX_TYPE profilerLock = portMUX_INITIALIZER_UNLOCKED;
+
+void lock() { portENTER_CRITICAL(&profilerLock); }
+
+void unlock() { portEXIT_CRITICAL(&profilerLock); }
+#else
+std::atomic_flag profilerLock = ATOMIC_FLAG_INIT;
+
+void lock() {
+  while (profilerLock.test_and_set(std::memory_order_acquire)) {
+  }
+}
+
+void unlock() { profilerLock.clear(std::memory_order_release); }
+#endif
+
+uint8_t argBucket(uint32_t arg) {
+  uint8_t bucket = 0;
+  for (uint32_t bound = 16; bucket < STACK_ARG_BUCKETS - 1 && arg >= bound;
+       bound *= 2) {
+    bucket++;
+  }
+  return bucket;
+}
+
+#ifndef SDL_h_
+uint32_t *alignUp(uint8_t *p) {
+  return reinterpret_cast<uint32_t *>((reinterpret_cast<uintptr_t>(p) + 3) &
+                                      ~static_cast<uintptr_t>(3));
+}
+
+uint32_t *alignDown(uint8_t *p) {
+  return reinterpret_cast<uint32_t *>(reinterpret_cast<uintptr_t>(p) &
+                                      ~static_cast<uintptr_t>(3));
+}
+#endif
+
+}  // namespace
+
+StackProfiler::StackProfiler() : ops{}, opCount{0}, active{} {}
+
+uint8_t StackProfiler::operation(const char *name) {
+  lock();
+  uint8_t id = STACK_OP_INVALID;
+  for (uint8_t i = 0; i < opCount; i++) {
+    if (strcmp(ops[i].name, name) == 0) {
+      id = i;
+    }
+  }
+  if (id == STACK_OP_INVALID && opCount < STACK_PROFILER_OPS) {
+    id = opCount;
+    ops[id].name = name;
+    opCount++;
+  }
+  unlock();
+  return id;
+}
+
+StackProfiler::Active *StackProfiler::enter() {
+#ifndef SDL_h_
+  void *task = xTaskGetCurrentTaskHandle();
+  Active *slot = nullptr;
+  Active *free = nullptr;
+  lock();
+  for (Active &a : active) {
+    if (a.task == task) {
+      slot = &a;
+    } else if (a.task == nullptr && free == nullptr) {
+      free = &a;
+    }
+  }
+  if (slot == nullptr && free != nullptr) {
+    slot = free;
+    slot->task = task;
+    slot->depth = 0;
+  }
+  if (slot != nullptr) {
+    slot->depth++;
+  }
+  unlock();
+  return slot;
+#else
+  return nullptr;
+#endif
+}
+
+void StackProfiler::leave(Active *slot) {
+  lock();
+  if (slot != nullptr && --slot->depth == 0) {
+    slot->task = nullptr;
+  }
+  unlock();
+}
+
+StackProfiler::Scope StackProfiler::begin(uint8_t op, uint32_t arg) {
+  Scope scope{op, false, nullptr, nullptr, arg};
+#ifndef SDL_h_
+  if (op >= size()) {
+    return scope;
+  }
+  Active *slot = enter();
+  if (slot == nullptr) {
+    return scope;
+  }
+  // painting now would erase what the enclosing operation has used so far
+  if (slot->depth > 1) {
+    leave(slot);
+    return scope;
+  }
+  uint8_t marker = 0;
+  uint8_t *sp = &marker;
+  uint8_t *start = pxTaskGetStackStart(NULL);
+  if (start == nullptr ||
+      static_cast<uint32_t>(sp - start) <= STACK_PAINT_MARGIN + 4) {
+    leave(slot);
+    return scope;
+  }
+  uint32_t *end = alignDown(sp - STACK_PAINT_MARGIN);
+  for (uint32_t *p = alignUp(start); p < end; p++) {
+    *p = STACK_PAINT_PATTERN;
+  }
+  scope.measuring = true;
+  scope.stackStart = start;
+  scope.stackPointer = sp;
+#endif
+  return scope;
+}
+
+void StackProfiler::end(const Scope &scope) {
+#ifndef SDL_h_
+  if (!scope.measuring) {
+    return;
+  }
+  uint32_t *p = alignUp(scope.stackStart);
+  uint32_t *limit = alignDown(scope.stackPointer - STACK_PAINT_MARGIN);
+  while (p < limit && *p == STACK_PAINT_PATTERN) {
+    p++;
+  }
+  uint8_t *deepest = reinterpret_cast<uint8_t *>(p);
+  uint32_t bytes = scope.stackPointer - deepest;
+  uint32_t freeBytes = deepest - scope.stackStart;
+  uint8_t bucket = argBucket(scope.arg);
+
+  void *task = xTaskGetCurrentTaskHandle();
+  lock();
+  StackOpStats &s = ops[scope.op];
+  if (s.count == 0) {
+    strncpy(s.task, pcTaskGetName(NULL), STACK_TASK_NAME_SIZE - 1);
+    s.minFreeBytes = freeBytes;
+  }
+  s.count++;
+  s.lastBytes = bytes;
+  if (bytes > s.peakBytes) {
+    s.peakBytes = bytes;
+    s.peakArg = scope.arg;
+  }
+  if (freeBytes < s.minFreeBytes) {
+    s.minFreeBytes = freeBytes;
+  }
+  if (bytes > s.bucketPeakBytes[bucket]) {
+    s.bucketPeakBytes[bucket] = bytes;
+  }
+  Active *slot = nullptr;
+  for (Active &a : active) {
+    if (a.task == task) {
+      slot = &a;
+    }
+  }
+  unlock();
+  leave(slot);
+#endif
+}
+
+uint8_t StackProfiler::size() const { return opCount; }
+
+StackOpStats StackProfiler::read(uint8_t op) const {
+  StackOpStats s{};
+  if (op < size()) {
+    lock();
+    s = ops[op];
+    unlock();
+  }
+  return s;
+}
+
+void StackProfiler::reset() {
+  lock();
+  for (uint8_t i = 0; i < opCount; i++) {
+    const char *name = ops[i].name;
+    ops[i] = StackOpStats{};
+    ops[i].name = name;
+  }
+  unlock();
+}
+
+}  // namespace m5avatar
@@ -0,0 +1,107 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef STACKPROFILER_H_
+#define STACKPROFILER_H_
+#include <stdint.h>
+
+namespace m5avatar {
+
+// maximum number of profiled operations and of tasks running one at a time
+const uint8_t STACK_PROFILER_OPS = 24;
+const uint8_t STACK_PROFILER_TASKS = 8;
+// the stack right below the stack pointer is left unpainted, since
+// interrupts save their frame there while painting runs
+const uint32_t STACK_PAINT_MARGIN = 1024;
+// same fill byte as FreeRTOS uses for new stacks
+const uint32_t STACK_PAINT_PATTERN = 0xa5a5a5a5;
+// peaks are also kept per argument size: [0, 16), [16, 32), ... [256, inf)
+const uint8_t STACK_ARG_BUCKETS = 6;
+const uint8_t STACK_TASK_NAME_SIZE = 12;
+// returned by StackProfiler::operation when the table is full
+const uint8_t STACK_OP_INVALID = 0xff;
+
+struct StackOpStats {
+  const char *name;
+  char task[STACK_TASK_NAME_SIZE];
+  uint32_t count;
+  // deepest use below the stack pointer at the start of the operation; the
+  // unpainted margin makes STACK_PAINT_MARGIN the smallest value measured
+  uint32_t peakBytes;
+  uint32_t peakArg;
+  uint32_t lastBytes;
+  // smallest distance from the deepest use to the end of the stack
+  uint32_t minFreeBytes;
+  uint32_t bucketPeakBytes[STACK_ARG_BUCKETS];
+};
+
+/**
+ * Peak stack use per operation by watermark painting.
+ * begin() fills the unused part of the calling task's stack with
+ * STACK_PAINT_PATTERN and end() scans for the deepest word overwritten, so
+ * the peak of each operation is measured on its own rather than as the
+ * lifetime high-water mark of the task. An operation started while another
+ * one is measured on the same task is not measured.
+ * Does nothing on SDL.
+ */
+class StackProfiler {
+ private:
+  struct Active {
+    void *task;
+    uint8_t depth;
+  };
+  StackOpStats ops[STACK_PROFILER_OPS];
+  uint8_t opCount;
+  Active active[STACK_PROFILER_TASKS];
+  Active *enter();
+  void leave(Active *slot);
+
+ public:
+  // state of a measurement in progress
+  struct Scope {
+    uint8_t op;
+    bool measuring;
+    uint8_t *stackStart;
+    uint8_t *stackPointer;
+    uint32_t arg;
+  };
+
+  StackProfiler();
+  ~StackProfiler() = default;
+  StackProfiler(const StackProfiler &other) = delete;
+  StackProfiler &operator=(const StackProfiler &other) = delete;
+
+  // Registering a name again returns the existing id. The name must outlive
+  // the profiler (e.g. a string literal).
+  uint8_t operation(const char *name);
+  // arg is a size the stack use may depend on, such as a text length
+  Scope begin(uint8_t op, uint32_t arg = 0);
+  void end(const Scope &scope);
+
+  uint8_t size() const;
+  StackOpStats read(uint8_t op) const;
+  void reset();
+};
+
+// shared by the library and the application
+extern StackProfiler stackProfiler;
+
+/**
+ * Measures the peak stack use of the rest of the enclosing block.
+ */
+class StackScope {
+ private:
+  StackProfiler::Scope scope;
+
+ public:
+  explicit StackScope(uint8_t op, uint32_t arg = 0)
+      : scope{stackProfiler.begin(op, arg)} {}
+  ~StackScope() { stackProfiler.end(scope); }
+  StackScope(const StackScope &other) = delete;
+  StackScope &operator=(const StackScope &other) = delete;
+};
+
+}  // namespace m5avatar
+
+#endif  // STACKPROFILER_H_
@@ -0,0 +1,221 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#include "Trace.h"
+#include <stdio.h>
+#include <string.h>
+#define LGFX_USE_V1
+#include <M5GFX.h>
+#ifndef SDL_h_
+#include <esp_heap_caps.h>
+#ifdef __XTENSA__
+#include <xtensa/hal.h>
+#endif
+#endif
+
+namespace m5avatar {
+
+Trace trace;
+
+namespace {
+
+// locked the same way as the metrics registry (see Metrics.cpp)
+#ifndef SDL_h_
+portMUX_TYPE registryLock = portMUX_INITIALIZER_UNLOCKED;
+
+void lockRegistry() { portENTER_CRITICAL(&registryLock); }
+
+void unlockRegistry() { portEXIT_CRITICAL(&registryLock); }
+#else
+std::atomic_flag registryLock = ATOMIC_FLAG_INIT;
+
+void lockRegistry() {
+  while (registryLock.test_and_set(std::memory_order_acquire)) {
+  }
+}
+
+void unlockRegistry() { registryLock.clear(std::memory_order_release); }
+#endif
+
+uint32_t cycleCount() {
+#if !defined(SDL_h_) && defined(__XTENSA__)
+  return xthal_get_ccount();
+#else
+  // NOTE: one "cycle" per microsecond where there is no cycle counter
+  return lgfx::micros();
+#endif
+}
+
+uint8_t coreId() {
+#ifndef SDL_h_
+  return xPortGetCoreID();
+#else
+  return 0;
+#endif
+}
+
+}  // namespace
+
+Trace::Trace()
+    : events{nullptr},
+      capacity{0},
+      head{0},
+      recording{false},
+      names{},
+      nameCount{0},
+      tasks{},
+      taskCount{0} {}
+
+Trace::~Trace() { free(events); }
+
+bool Trace::begin(uint32_t capacity) {
+  if (events != nullptr) {
+    return true;
+  }
+  size_t bytes = capacity * sizeof(TraceEvent);
+  void *p = nullptr;
+#ifndef SDL_h_
+  // NOTE: events are only touched by the CPU, so PSRAM is good enough
+  p = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#endif
+  if (p == nullptr) {
+    p = malloc(bytes);
+  }
+  if (p == nullptr) {
+    return false;
+  }
+  events = static_cast<TraceEvent *>(p);
+  for (uint32_t i = 0; i < capacity; i++) {
+    events[i].sequence.store(0, std::memory_order_relaxed);
+  }
+  this->capacity = capacity;
+  return true;
+}
+
+void Trace::start() {
+  if (events == nullptr) {
+    return;
+  }
+  recording.store(false);
+  for (uint32_t i = 0; i < capacity; i++) {
+    events[i].sequence.store(0, std::memory_order_relaxed);
+  }
+  head.store(0);
+  recording.store(true);
+}
+
+void Trace::stop() { recording.store(false); }
+
+bool Trace::isRecording() const { return recording.load(); }
+
+uint8_t Trace::name(const char *name) {
+  lockRegistry();
+  uint8_t count = nameCount.load(std::memory_order_relaxed);
+  uint8_t id = TRACE_INVALID;
+  for (uint8_t i = 0; i < count; i++) {
+    if (strcmp(names[i], name) == 0) {
+      id = i;
+    }
+  }
+  if (id == TRACE_INVALID && count < TRACE_NAMES) {
+    id = count;
+    names[id] = name;
+    nameCount.store(count + 1, std::memory_order_release);
+  }
+  unlockRegistry();
+  return id;
+}
+
+uint8_t Trace::currentTask() {
+#ifndef SDL_h_
+  uint32_t key = reinterpret_cast<uint32_t>(xTaskGetCurrentTaskHandle());
+#else
+  uint32_t key = SDL_ThreadID();
+#endif
+  uint8_t count = taskCount.load(std::memory_order_acquire);
+  for (uint8_t i = 0; i < count; i++) {
+    if (tasks[i].key == key) {
+      return i;
+    }
+  }
+  // first event of this task
+  lockRegistry();
+  count = taskCount.load(std::memory_order_relaxed);
+  uint8_t id = TRACE_INVALID;
+  if (count < TRACE_TASKS) {
+    id = count;
+    tasks[id].key = key;
+#ifndef SDL_h_
+    strncpy(tasks[id].name, pcTaskGetName(NULL), TRACE_TASK_NAME_SIZE - 1);
+#else
+    snprintf(tasks[id].name, TRACE_TASK_NAME_SIZE, "thread%u", key);
+#endif
+    taskCount.store(count + 1, std::memory_order_release);
+  }
+  unlockRegistry();
+  return id;
+}
+
+void Trace::record(TracePhase phase, uint8_t name) {
+  if (!recording.load(std::memory_order_relaxed) || name == TRACE_INVALID) {
+    return;
+  }
+  uint32_t cycles = cycleCount();
+  uint32_t index = head.fetch_add(1, std::memory_order_relaxed);
+  TraceEvent &event = events[index % capacity];
+  event.sequence.store(0, std::memory_order_relaxed);
+  event.cycles = cycles;
+  event.micros = lgfx::micros();
+  event.name = name;
+  event.task = currentTask();
+  event.core = coreId();
+  event.phase = static_cast<char>(phase);
+  event.sequence.store(index + 1, std::memory_order_release);
+}
+
+uint32_t Trace::size() const {
+  uint32_t count = head.load();
+  return count < capacity ? count : capacity;
+}
+
+uint32_t Trace::getDropped() const {
+  uint32_t count = head.load();
+  return count > capacity ? count - capacity : 0;
+}
+
+uint32_t Trace::getCapacity() const { return capacity; }
+
+bool Trace::read(uint32_t index, TraceEvent *event) const {
+  uint32_t count = head.load();
+  if (index >= size()) {
+    return false;
+  }
+  uint32_t absolute = count - size() + index;
+  const TraceEvent &e = events[absolute % capacity];
+  if (e.sequence.load(std::memory_order_acquire) != absolute + 1) {
+    return false;
+  }
+  event->sequence.store(absolute + 1, std::memory_order_relaxed);
+  event->cycles = e.cycles;
+  event->micros = e.micros;
+  event->name = e.name;
+  event->task = e.task;
+  event->core = e.core;
+  event->phase = e.phase;
+  return true;
+}
+
+uint8_t Trace::getNameCount() const { return nameCount.load(); }
+
+const char *Trace::getName(uint8_t id) const {
+  return id < getNameCount() ? names[id] : "";
+}
+
+uint8_t Trace::getTaskCount() const { return taskCount.load(); }
+
+const char *Trace::getTaskName(uint8_t id) const {
+  return id < getTaskCount() ? tasks[id].name : "";
+}
+
+}  // namespace m5avatar
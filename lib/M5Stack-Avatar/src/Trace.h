@@ -0,0 +1,135 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+#ifndef TRACE_H_
+#define TRACE_H_
+#include <stdint.h>
+#include <atomic>
+
+namespace m5avatar {
+
+// default number of events kept by the trace ring (16 bytes each)
+const uint32_t TRACE_CAPACITY = 8192;
+// maximum number of distinct event names and traced tasks
+const uint8_t TRACE_NAMES = 64;
+const uint8_t TRACE_TASKS = 16;
+const uint8_t TRACE_TASK_NAME_SIZE = 12;
+// returned by Trace::name when the name table is full; events with it are
+// dropped
+const uint8_t TRACE_INVALID = 0xff;
+
+// same letters as the "ph" field of the Chrome trace event format
+enum class TracePhase : char { Begin = 'B', End = 'E', Instant = 'i' };
+
+struct TraceEvent {
+  // index + 1 of the event once it is completely written
+  std::atomic<uint32_t> sequence;
+  // cycle counter of the recording core
+  uint32_t cycles;
+  // microseconds since boot, shared by both cores
+  uint32_t micros;
+  uint8_t name;
+  uint8_t task;
+  uint8_t core;
+  char phase;
+};
+
+/**
+ * Ring of begin/end/instant events stamped with the cycle counter, the
+ * microsecond clock, the core and the task.
+ * Recording claims a slot with one atomic increment and never blocks, so it
+ * can be used from any task; when the ring is full the oldest events are
+ * overwritten. Names are registered once (see the TRACE_* macros) and
+ * referred to by id.
+ */
+class Trace {
+ private:
+  struct Task {
+    uint32_t key;
+    char name[TRACE_TASK_NAME_SIZE];
+  };
+  TraceEvent *events;
+  uint32_t capacity;
+  std::atomic<uint32_t> head;
+  std::atomic<bool> recording;
+  const char *names[TRACE_NAMES];
+  std::atomic<uint8_t> nameCount;
+  Task tasks[TRACE_TASKS];
+  std::atomic<uint8_t> taskCount;
+  uint8_t currentTask();
+
+ public:
+  Trace();
+  ~Trace();
+  Trace(const Trace &other) = delete;
+  Trace &operator=(const Trace &other) = delete;
+
+  // Allocates the ring (in PSRAM when available). Returns false when out of
+  // memory.
+  bool begin(uint32_t capacity = TRACE_CAPACITY);
+  // starting clears the events recorded so far
+  void start();
+  void stop();
+  bool isRecording() const;
+
+  // Registering a name again returns the existing id. The name must outlive
+  // the trace (e.g. a string literal).
+  uint8_t name(const char *name);
+  void record(TracePhase phase, uint8_t name);
+
+  // events that can be read, oldest first
+  uint32_t size() const;
+  // events overwritten because the ring was full
+  uint32_t getDropped() const;
+  uint32_t getCapacity() const;
+  // Copies an event. Returns false for a slot still being written; read
+  // after stop() so that no slot is overwritten meanwhile.
+  bool read(uint32_t index, TraceEvent *event) const;
+  uint8_t getNameCount() const;
+  const char *getName(uint8_t id) const;
+  uint8_t getTaskCount() const;
+  const char *getTaskName(uint8_t id) const;
+};
+
+// shared by the library and the application
+extern Trace trace;
+
+/**
+ * Records a begin event now and the matching end event when it goes out of
+ * scope.
+ */
+class TraceScope {
+ private:
+  uint8_t name;
+
+ public:
+  explicit TraceScope(uint8_t name) : name{name} {
+    trace.record(TracePhase::Begin, name);
+  }
+  ~TraceScope() { trace.record(TracePhase::End, name); }
+  TraceScope(const TraceScope &other) = delete;
+  TraceScope &operator=(const TraceScope &other) = delete;
+};
+
+}  // namespace m5avatar
+
+// the name is registered on first use at each call site
+#define TRACE_EVENT_(phase, label)                                         \
+  do {                                                                     \
+    static const uint8_t traceName_ = m5avatar::trace.name(label);         \
+    m5avatar::trace.record(m5avatar::TracePhase::phase, traceName_);      \
+  } while (0)
+#define TRACE_BEGIN(label) TRACE_EVENT_(Begin, label)
+#define TRACE_END(label) TRACE_EVENT_(End, label)
+#define TRACE_INSTANT(label) TRACE_EVENT_(Instant, label)
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_SCOPE_(label, line)                                          \
+  static const uint8_t TRACE_CONCAT_(traceName_, line) =                   \
+      m5avatar::trace.name(label);                                         \
+  m5avatar::TraceScope TRACE_CONCAT_(traceScope_, line)(                   \
+      TRACE_CONCAT_(traceName_, line))
+// traces the rest of the enclosing block
+#define TRACE_SCOPE(label) TRACE_SCOPE_(label, __LINE__)
+
+#endif  // TRACE_H_
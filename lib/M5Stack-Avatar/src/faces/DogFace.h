@@ -9,6 +9,7 @@
 #include "../BoundingRect.h"
 #include "../DrawContext.h"
 #include "../Drawable.h"
+#include "../SpanCache.h"
 
 namespace m5avatar {
 class DogEye : public Drawable {
@@ -16,9 +17,8 @@ class DogEye : public Drawable {
     uint32_t cx = rect.getCenterX();
     uint32_t cy = rect.getCenterY();
     Gaze g = ctx->getGaze();
-    ColorPalette *cp = ctx->getColorPalette();
-    uint16_t primaryColor = ctx->getColorDepth() == 1 ? 1 : cp->get(COLOR_PRIMARY);
-    uint16_t backgroundColor = ctx->getColorDepth() == 1 ? ERACER_COLOR : cp->get(COLOR_BACKGROUND);
+    uint16_t primaryColor = ctx->getColor(COLOR_PRIMARY);
+    uint16_t backgroundColor = ctx->getColor(COLOR_BACKGROUND);
     uint32_t offsetX = g.getHorizontal() * 8;
     uint32_t offsetY = g.getVertical() * 5;
     float eor = ctx->getEyeOpenRatio();
@@ -28,13 +28,13 @@ class DogEye : public Drawable {
       spi->fillRect(cx - 15, cy - 2, 30, 4, primaryColor);
       return;
     }
-    spi->fillEllipse(cx, cy, 30, 25, primaryColor);
-    spi->fillEllipse(cx, cy, 28, 23, backgroundColor);
+    spanCache.fillEllipse(spi, cx, cy, 30, 25, primaryColor);
+    spanCache.fillEllipse(spi, cx, cy, 28, 23, backgroundColor);
 
-    spi->fillEllipse(cx + offsetX, cy + offsetY, 18, 18,
-                     primaryColor);
-    spi->fillEllipse(cx + offsetX - 3, cy + offsetY - 3, 3, 3,
-                     backgroundColor);
+    spanCache.fillEllipse(spi, cx + offsetX, cy + offsetY, 18, 18,
+                          primaryColor);
+    spanCache.fillEllipse(spi, cx + offsetX - 3, cy + offsetY - 3, 3, 3,
+                          backgroundColor);
   }
 };
 
@@ -54,8 +54,10 @@ class DogMouth : public Drawable {
         minHeight{minHeight},
         maxHeight{maxHeight} {}
   void draw(M5Canvas *spi, BoundingRect rect, DrawContext *ctx) {
-    uint16_t primaryColor = ctx->getColorDepth() == 1 ? 1 : ctx->getColorPalette()->get(COLOR_PRIMARY);
-    uint16_t backgroundColor = ctx->getColorDepth() == 1 ? ERACER_COLOR : ctx->getColorPalette()->get(COLOR_BACKGROUND);
+    uint16_t primaryColor = ctx->getColor(COLOR_PRIMARY);
+    uint16_t backgroundColor = ctx->getColor(COLOR_BACKGROUND);
+    // NOTE: the tongue is left blank on 1-bit canvases
+    uint16_t tongueColor = ctx->getColorDepth() == 1 ? ERACER_COLOR : ctx->getColor(COLOR_TONGUE);
     uint32_t cx = rect.getCenterX();
     uint32_t cy = rect.getCenterY();
     float openRatio = ctx->getMouthOpenRatio();
@@ -63,14 +65,14 @@ class DogMouth : public Drawable {
     uint32_t w = minWidth + (maxWidth - minWidth) * (1 - openRatio);
     if (h > minHeight) {
       spi->fillEllipse(cx, cy, w / 2, h / 2, primaryColor);
-      spi->fillEllipse(cx, cy, w / 2 - 4, h / 2 - 4, TFT_RED);
+      spi->fillEllipse(cx, cy, w / 2 - 4, h / 2 - 4, tongueColor);
       spi->fillRect(cx - w / 2, cy - h / 2, w, h / 2, backgroundColor);
     }
-    spi->fillEllipse(cx, cy - 15, 10, 6, primaryColor);
-    spi->fillEllipse(cx - 28, cy, 30, 15, primaryColor);
-    spi->fillEllipse(cx + 28, cy, 30, 15, primaryColor);
-    spi->fillEllipse(cx - 29, cy - 4, 27, 15, backgroundColor);
-    spi->fillEllipse(cx + 29, cy - 4, 27, 15, backgroundColor);
+    spanCache.fillEllipse(spi, cx, cy - 15, 10, 6, primaryColor);
+    spanCache.fillEllipse(spi, cx - 28, cy, 30, 15, primaryColor);
+    spanCache.fillEllipse(spi, cx + 28, cy, 30, 15, primaryColor);
+    spanCache.fillEllipse(spi, cx - 29, cy - 4, 27, 15, backgroundColor);
+    spanCache.fillEllipse(spi, cx + 29, cy - 4, 27, 15, backgroundColor);
   }
 };
 
@@ -0,0 +1,247 @@
+// 非同期ログ（src/main.cpp の LOG_*）のリングと、引数の符号化・整形。
+// Arduinoに依存しないので、ホスト上のテストからもそのまま使える。
+#ifndef LOG_RING_H_
+#define LOG_RING_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+
+namespace AsyncLog {
+    enum Level : uint8_t {
+        LEVEL_INFO = 0,
+        LEVEL_WARN = 1,
+        LEVEL_ERROR = 2,
+        LEVEL_NONE = 3,
+    };
+
+    // 引数の種類（スロット内で値の前に1バイト置く）
+    enum ArgType : uint8_t {
+        ARG_INT = 'i',      // 32bit以下の整数
+        ARG_LONG = 'l',     // 64bit整数
+        ARG_DOUBLE = 'f',
+        ARG_STRING = 's',   // [長さ (u8)][文字列] 入りきらない分は切り捨て
+        ARG_POINTER = 'p',
+    };
+
+    struct TagLevel {
+        const char* tag;
+        volatile Level level;
+    };
+
+    struct ArgWriter {
+        uint8_t* p;
+        uint8_t* end;
+
+        void put(ArgType type, const void* value, size_t len) {
+            if (p + 1 + len > end) {
+                end = p;  // 以降の引数も捨てる（整形時は?になる）
+                return;
+            }
+            *p++ = type;
+            memcpy(p, value, len);
+            p += len;
+        }
+    };
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    encodeArg(ArgWriter& w, T value) {
+        if (sizeof(T) > sizeof(int32_t)) {
+            int64_t v = (int64_t)value;
+            w.put(ARG_LONG, &v, sizeof(v));
+        } else {
+            int32_t v = (int32_t)value;
+            w.put(ARG_INT, &v, sizeof(v));
+        }
+    }
+
+    inline void encodeArg(ArgWriter& w, double value) {
+        w.put(ARG_DOUBLE, &value, sizeof(value));
+    }
+
+    inline void encodeArg(ArgWriter& w, const char* value) {
+        if (value == nullptr) value = "(null)";
+        size_t room = w.end - w.p;
+        if (room < 2) {
+            w.end = w.p;
+            return;
+        }
+        size_t len = std::min(strlen(value), std::min(room - 2, (size_t)UINT8_MAX));
+        *w.p++ = ARG_STRING;
+        *w.p++ = len;
+        memcpy(w.p, value, len);
+        w.p += len;
+    }
+
+    template <typename T>
+    inline void encodeArg(ArgWriter& w, const T* value) {
+        uint32_t v = (uint32_t)(uintptr_t)value;
+        w.put(ARG_POINTER, &v, sizeof(v));
+    }
+
+    inline void encodeArgs(ArgWriter& w) {}
+
+    template <typename T, typename... Rest>
+    inline void encodeArgs(ArgWriter& w, T value, Rest... rest) {
+        encodeArg(w, value);
+        encodeArgs(w, rest...);
+    }
+
+    // 書式指定子1つ分を次の引数で整形する。型が合わなければ変換し、引数が無ければ?を出す
+    inline int formatArg(char* out, size_t size, const char* spec, size_t specLen, char conversion,
+                         const uint8_t*& arg, const uint8_t* end) {
+        // 長さ修飾子(h, l, ll, z, j, t)を除いた指定子に、引数の型に合わせて付け直す
+        char base[16];
+        size_t n = 0;
+        for (size_t i = 0; i < specLen - 1 && n < sizeof(base) - 4; i++) {
+            if (!strchr("hlzjtL", spec[i])) base[n++] = spec[i];
+        }
+        if (arg >= end) {
+            return snprintf(out, size, "?");
+        }
+        uint8_t type = *arg++;
+        int32_t i32 = 0;
+        int64_t i64 = 0;
+        double d = 0;
+        const char* str = nullptr;
+        uint8_t strLen = 0;
+        switch (type) {
+            case ARG_INT: case ARG_POINTER: memcpy(&i32, arg, 4); arg += 4; i64 = i32; d = i32; break;
+            case ARG_LONG: memcpy(&i64, arg, 8); arg += 8; i32 = i64; d = i64; break;
+            case ARG_DOUBLE: memcpy(&d, arg, 8); arg += 8; i32 = d; i64 = d; break;
+            case ARG_STRING: strLen = *arg++; str = (const char*)arg; arg += strLen; break;
+            default: arg = end; return snprintf(out, size, "?");
+        }
+        if (conversion == 's') {
+            if (str == nullptr) return snprintf(out, size, "?");
+            base[n++] = '.';
+            base[n++] = '*';
+            base[n++] = 's';
+            base[n] = '\0';
+            return snprintf(out, size, base, (int)strLen, str);
+        }
+        if (str != nullptr) return snprintf(out, size, "?");
+        if (strchr("fFeEgGaA", conversion)) {
+            base[n++] = conversion;
+            base[n] = '\0';
+            return snprintf(out, size, base, d);
+        }
+        if (type == ARG_LONG && conversion != 'p' && conversion != 'c') {
+            base[n++] = 'l';
+            base[n++] = 'l';
+            base[n++] = conversion;
+            base[n] = '\0';
+            return snprintf(out, size, base, (long long)i64);
+        }
+        if (conversion == 'p') {
+            return snprintf(out, size, "0x%08x", (unsigned)i32);
+        }
+        base[n++] = conversion;
+        base[n] = '\0';
+        return snprintf(out, size, base, (int)i32);
+    }
+
+    // 1行分（"[I][TAG] ...\n"）を整形する。書式と引数はスロットに積まれたもの
+    inline size_t format(char* out, size_t size, Level level, const char* tag, const char* format,
+                         const uint8_t* args, size_t argBytes) {
+        static const char LEVEL_NAMES[] = "IWE";
+        int len = snprintf(out, size, "[%c][%s] ", LEVEL_NAMES[level], tag);
+        const uint8_t* arg = args;
+        const uint8_t* end = args + argBytes;
+        for (const char* f = format; *f != '\0' && len < (int)size - 2; f++) {
+            if (*f != '%') {
+                out[len++] = *f;
+                continue;
+            }
+            const char* spec = f;
+            f++;
+            if (*f == '%') {
+                out[len++] = '%';
+                continue;
+            }
+            while (*f != '\0' && strchr("-+ #0123456789.*hlzjtL", *f)) f++;
+            if (*f == '\0') break;
+            int written = formatArg(out + len, size - 2 - len, spec, f - spec + 1, *f, arg, end);
+            len = std::min(len + std::max(written, 0), (int)size - 2);
+        }
+        out[len++] = '\n';
+        out[len] = '\0';
+        return len;
+    }
+
+    // 固定長スロットの多生産者・単一消費者キュー。各スロットのシーケンス番号で同期するので
+    // 書き込み側はロックもFreeRTOSの呼び出しもしない
+    template <uint32_t SLOTS, size_t SLOT_SIZE>
+    class Ring {
+    public:
+        static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two");
+
+        struct Slot {
+            std::atomic<uint32_t> sequence;
+            Level level;
+            uint8_t argBytes;
+            const TagLevel* tag;
+            const char* format;
+            uint8_t args[SLOT_SIZE - 16];  // ESP32ではスロット全体がSLOT_SIZEになる
+        };
+
+        // スロットiは位置iへの書き込みを待つ状態から始める
+        Ring() : enqueuePos(0), dequeuePos(0) {
+            for (uint32_t i = 0; i < SLOTS; i++) {
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        // 満杯なら何も書かずにfalse
+        template <typename... Args>
+        bool push(Level level, const TagLevel* tag, const char* format, Args... args) {
+            uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+            Slot* slot;
+            for (;;) {
+                slot = &slots[pos & (SLOTS - 1)];
+                int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - pos);
+                if (diff == 0) {
+                    if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+            slot->level = level;
+            slot->tag = tag;
+            slot->format = format;
+            ArgWriter w = {slot->args, slot->args + sizeof(slot->args)};
+            encodeArgs(w, args...);
+            slot->argBytes = w.p - slot->args;
+            slot->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // 書き終わった最古のスロット。無ければnullptr（消費者だけが呼ぶ）
+        const Slot* front() const {
+            const Slot& slot = slots[dequeuePos & (SLOTS - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1) {
+                return nullptr;
+            }
+            return &slot;
+        }
+
+        // front()のスロットを書き込み側に返す
+        void pop() {
+            slots[dequeuePos & (SLOTS - 1)].sequence.store(dequeuePos + SLOTS, std::memory_order_release);
+            dequeuePos++;
+        }
+
+    private:
+        Slot slots[SLOTS];
+        std::atomic<uint32_t> enqueuePos;
+        uint32_t dequeuePos;
+    };
+}
+
+#endif  // LOG_RING_H_
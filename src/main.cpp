@@ -12,8 +12,12 @@
 
 #include <M5Unified.h>
 #include <Avatar.h>
+#include <atomic>
+#include <type_traits>
 #include <esp_task_wdt.h>
 #include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <ArduinoJson.h>
 
 // Fix macro conflicts BEFORE other includes
 #ifdef B110
@@ -30,22 +34,190 @@
 #define ESPEAK_STACK_HACK 1
 #include "espeak.h"
 #include "espeak-ng-data.h"
+#include "LogRing.h"
 
 // ===== Configuration =====
 #define AUDIO_SAMPLE_RATE 22050
 #define MAX_AUDIO_BUFFER_SIZE 160000  // 約7.5秒分のオーディオ（さらに増量）
 #define MAX_TEXT_LENGTH 300
-#define SERIAL_BUFFER_SIZE 350
+#define SERIAL_BUFFER_SIZE 512  // JSONコマンドでtextと設定を1行に収めるため
 #define SPEECH_TIMEOUT_MS 15000
+#define BINARY_FRAME_SIZE 600  // COBSエンコード後の最大フレーム長
+#define RX_RING_SIZE 1024       // 受信タスクのリングバッファ
+#define RX_POLL_MS 20           // 受信イベントが来ない環境向けのポーリング周期
+#define SPEECH_QUEUE_LENGTH 8
+#define PCM_BUFFER_SAMPLES 48000    // PCM入力のジッタバッファ (22050Hzで約2.2秒)
+#define PCM_PREFILL_MS 200          // 再生開始(と途切れ後の再開)前に溜める量
+#define PCM_PLAYBACK_BUFFERS 3      // playRawのキュー2段 + 書き込み中1つ
+#define PCM_IDLE_TIMEOUT_MS 3000    // 溜まりが足りないままこれだけ受信がなければ、PCM_ENDなしでも終える
+#define STREAM_MIN_CLAUSE_CHARS 24  // これより短い節は読点(,;:)で区切らない
+#define STREAM_BUFFER_SIZE 1024     // 最大長のチャンクを丸ごと受け、キュー待ちの節も保持できる大きさ
+#define RECORD_BUFFER_SIZE (256 * 1024)  // 入力記録のリングバッファ (PSRAM)
+#define BOOT_HISTORY 8                   // RTCメモリに残す起動の記録数
+
+// ===== Task Priorities =====
+// 優先度モデル: 音声出力 > 音声合成 > 描画 > 制御
+// 音声が途切れるのが最も目立つため、I2Sへの供給タスクを最優先にする。
+// 合成(loop)は描画より優先し、描画は空き時間で行う。
+namespace TaskPriority {
+    constexpr UBaseType_t AUDIO_PLAYOUT = 4;  // M5.Speaker のI2S供給タスク
+    constexpr UBaseType_t SYNTHESIS = 3;      // Arduino loop (eSpeak合成とplayRaw供給)
+    constexpr UBaseType_t RENDER = 2;         // Avatar drawLoop
+    constexpr UBaseType_t CONTROL = 1;        // Avatar facialLoop (視線・まばたき・呼吸)
+}
+
+// ===== Deadlines =====
+#define PLAYBACK_CHUNK_SAMPLES 512
+// playRawのキューは2チャンク分なので、2チャンク分の時間を超えて補充が遅れると音が途切れる
+#define AUDIO_REFILL_DEADLINE_US (2 * PLAYBACK_CHUNK_SAMPLES * 1000000ULL / AUDIO_SAMPLE_RATE)
+#define CONTROL_DEADLINE_US 100000
 
 // ===== Debug Logging =====
-#define LOG_I(tag, format, ...) Serial.printf("[I][%s] " format "\n", tag, ##__VA_ARGS__)
-#define LOG_E(tag, format, ...) Serial.printf("[E][%s] " format "\n", tag, ##__VA_ARGS__)
-#define LOG_W(tag, format, ...) Serial.printf("[W][%s] " format "\n", tag, ##__VA_ARGS__)
+#define LOG_RING_SLOTS 64   // 2のべき乗
+#define LOG_SLOT_SIZE 128
+#define LOG_FLUSH_MS 20     // 整形タスクがリングを空にする周期
+#define LOG_MAX_TAGS 24
+
+// シリアル出力はバイナリフレームとログ行が混ざらないよう、このミューテックスを持って書く
+static StaticSemaphore_t g_serialTxMutexBuffer;
+static SemaphoreHandle_t g_serialTxMutex = xSemaphoreCreateMutexStatic(&g_serialTxMutexBuffer);
+
+// ホストが読む1行の応答（JSON応答や[BUSY]など）は組み立ててから一度に書く。
+// JSON応答はidに受信行をそのまま返すことがあるので、受信バッファより少し大きくする
+#define SERIAL_REPLY_SIZE (SERIAL_BUFFER_SIZE + 64)
+static char g_replyLine[SERIAL_REPLY_SIZE];  // g_serialTxMutexを持って使う
+
+// g_replyLineのlen文字に改行を足して書く。g_serialTxMutexを持って呼ぶこと
+static void writeReplyLine(size_t len) {
+    len = min(len, (size_t)SERIAL_REPLY_SIZE - 3);
+    g_replyLine[len++] = '\r';
+    g_replyLine[len++] = '\n';
+    Serial.write((const uint8_t*)g_replyLine, len);
+}
+
+static void serialReply(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void serialReply(const char* format, ...) {
+    xSemaphoreTake(g_serialTxMutex, portMAX_DELAY);
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(g_replyLine, SERIAL_REPLY_SIZE - 2, format, args);
+    va_end(args);
+    if (len >= 0) {
+        writeReplyLine(len);
+    }
+    xSemaphoreGive(g_serialTxMutex);
+}
+
+// 非同期ログ: 呼び出し側は書式文字列のポインタと引数の生の値をロックフリーのリングに積むだけで、
+// 整形とSerialへの出力は優先度の低いタスクが後でまとめて行う（音声の補充や合成を待たせない）。
+// リングは固定長スロットの多生産者・単一消費者キュー（各スロットのシーケンス番号で同期）。
+// 満杯のときは書かずに捨てて数える。タグごとの出力レベルは実行中に変えられる。
+namespace AsyncLog {
+    // 他のグローバルの初期化（中でログを書くことがある）より前に構築される
+    static Ring<LOG_RING_SLOTS, LOG_SLOT_SIZE> g_ring;
+    static std::atomic<uint32_t> g_dropped(0);
+    static std::atomic<uint32_t> g_written(0);
+    static TaskHandle_t g_task = nullptr;
+
+    static TagLevel g_tags[LOG_MAX_TAGS];
+    static size_t g_tagCount = 0;
+    static TagLevel g_otherTags = {"*", LEVEL_INFO};
+    static portMUX_TYPE g_tagLock = portMUX_INITIALIZER_UNLOCKED;
+
+    // 呼び出し箇所ごとに一度だけ呼ばれる（LOG_*マクロの静的変数の初期化）
+    static TagLevel* tagLevel(const char* tag) {
+        portENTER_CRITICAL(&g_tagLock);
+        TagLevel* found = &g_otherTags;
+        for (size_t i = 0; i < g_tagCount; i++) {
+            if (strcmp(g_tags[i].tag, tag) == 0) found = &g_tags[i];
+        }
+        if (found == &g_otherTags && g_tagCount < LOG_MAX_TAGS) {
+            found = &g_tags[g_tagCount++];
+            found->tag = tag;
+            found->level = g_otherTags.level;
+        }
+        portEXIT_CRITICAL(&g_tagLock);
+        return found;
+    }
+
+    template <typename... Args>
+    void write(Level level, const TagLevel* tag, const char* format, Args... args) {
+        if (!g_ring.push(level, tag, format, args...)) {
+            g_dropped++;
+        }
+    }
+
+    // リングに溜まったログを整形して出力する
+    static void flush() {
+        static char line[LOG_SLOT_SIZE * 4];
+        for (;;) {
+            const auto* slot = g_ring.front();
+            if (slot == nullptr) {
+                return;
+            }
+            size_t len = format(line, sizeof(line), slot->level, slot->tag->tag, slot->format,
+                                slot->args, slot->argBytes);
+            g_ring.pop();
+            g_written++;
+            xSemaphoreTake(g_serialTxMutex, portMAX_DELAY);
+            Serial.write((const uint8_t*)line, len);
+            xSemaphoreGive(g_serialTxMutex);
+        }
+    }
+
+    static void logTask(void* param) {
+        for (;;) {
+            flush();
+            vTaskDelay(pdMS_TO_TICKS(LOG_FLUSH_MS));
+        }
+    }
+
+    // "*"は登録済みの全タグと、これから登録されるタグに適用する
+    static bool setLevel(const char* tag, Level level) {
+        if (strcmp(tag, "*") == 0) {
+            portENTER_CRITICAL(&g_tagLock);
+            g_otherTags.level = level;
+            for (size_t i = 0; i < g_tagCount; i++) g_tags[i].level = level;
+            portEXIT_CRITICAL(&g_tagLock);
+            return true;
+        }
+        for (size_t i = 0; i < g_tagCount; i++) {
+            if (strcmp(g_tags[i].tag, tag) == 0) {
+                g_tags[i].level = level;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void printStatus() {
+        static const char* const LEVEL_NAMES[] = {"info", "warn", "error", "none"};
+        Serial.printf("\n[LOG] Written: %u, dropped: %u (ring %d x %d bytes)\n",
+                     g_written.load(), g_dropped.load(), LOG_RING_SLOTS, LOG_SLOT_SIZE);
+        for (size_t i = 0; i < g_tagCount; i++) {
+            Serial.printf("  %-10s %s\n", g_tags[i].tag, LEVEL_NAMES[g_tags[i].level]);
+        }
+        Serial.printf("  %-10s %s\n", "(others)", LEVEL_NAMES[g_otherTags.level]);
+        Serial.println("==========================\n");
+    }
+
+    static void begin() {
+        xTaskCreatePinnedToCore(logTask, "log", 3072, NULL, TaskPriority::CONTROL, &g_task, PRO_CPU_NUM);
+    }
+}
+
+#define LOG_AT(severity, tag, format, ...) do { \
+        static AsyncLog::TagLevel* const logTag_ = AsyncLog::tagLevel(tag); \
+        if ((severity) >= logTag_->level) AsyncLog::write((severity), logTag_, format, ##__VA_ARGS__); \
+    } while (0)
+#define LOG_I(tag, format, ...) LOG_AT(AsyncLog::LEVEL_INFO, tag, format, ##__VA_ARGS__)
+#define LOG_E(tag, format, ...) LOG_AT(AsyncLog::LEVEL_ERROR, tag, format, ##__VA_ARGS__)
+#define LOG_W(tag, format, ...) LOG_AT(AsyncLog::LEVEL_WARN, tag, format, ##__VA_ARGS__)
 
 // ===== Global Variables =====
 static bool g_systemReady = false;
-static bool g_isSpeaking = false;
+// スピーカーの所有フラグ。loop()(speak/dispatchSpeech)とPCM受信がcompare_exchangeで取り合う
+static std::atomic<bool> g_isSpeaking(false);
 static volatile int g_currentLevel = 0;
 static uint8_t g_volume = 50;
 static bool g_displayEnabled = false; // Display制御フラグ
@@ -64,11 +236,419 @@ static int g_rate = 150;
 static int g_pitch = 70;
 static int g_volume_internal = 100;
 static int g_pitchRange = 100;
+// 受信タスクで変更された音声パラメータは合成タスク側で反映する
+static volatile bool g_voiceDirty = false;
+// JSONコマンドで複数のパラメータを同時に変えるとき、途中の組み合わせで合成されないようにする
+static portMUX_TYPE g_voiceLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Theme (preloaded color palettes)
+static int g_themeCount = 0;
 
 // M5 avatar
 using namespace m5avatar;
+// 発話していないときの表情（JSONコマンドのexpressionで変更）
+static Expression g_restExpression = Expression::Neutral;
+
+// ===== Metrics =====
+// アプリ側の計測点（ライブラリ側はFace::drawを計測している）。
+// 値はm5avatar::metricsにコアごとに積まれ、metricsコマンドとテレメトリで読み出す。
+// setup()で登録するまでのIDはMETRIC_INVALIDなので、それまでの更新は無視される。
+namespace AppMetrics {
+    static uint8_t synthesisMicros = METRIC_INVALID;
+    static uint8_t utterances = METRIC_INVALID;
+    static uint8_t speechFailures = METRIC_INVALID;
+    static uint8_t refillMicros = METRIC_INVALID;
+    static uint8_t underruns = METRIC_INVALID;
+    static uint8_t synthesizedSamples = METRIC_INVALID;
+    static uint8_t truncatedSamples = METRIC_INVALID;
+    static uint8_t rxBytes = METRIC_INVALID;
+    static uint8_t commands = METRIC_INVALID;
+    static uint8_t frames = METRIC_INVALID;
+    static uint8_t dispatchMicros = METRIC_INVALID;
+    static uint8_t speechWaitMicros = METRIC_INVALID;
+    static uint8_t speechQueue = METRIC_INVALID;
+    static uint8_t heapFree = METRIC_INVALID;
+    static uint8_t heapLargest = METRIC_INVALID;
+    static uint8_t psramFree = METRIC_INVALID;
+
+    static void setup() {
+        synthesisMicros = metrics.histogram("speak.synth_us");
+        utterances = metrics.counter("speak.utterances");
+        speechFailures = metrics.counter("speak.failures");
+        refillMicros = metrics.histogram("audio.refill_us");
+        underruns = metrics.counter("audio.underruns");
+        synthesizedSamples = metrics.counter("synth.samples");
+        truncatedSamples = metrics.counter("synth.truncated_samples");
+        rxBytes = metrics.counter("serial.rx_bytes");
+        commands = metrics.counter("serial.commands");
+        frames = metrics.counter("serial.frames");
+        dispatchMicros = metrics.histogram("serial.dispatch_us");
+        speechWaitMicros = metrics.histogram("serial.speech_wait_us");
+        speechQueue = metrics.gauge("serial.speech_queue");
+        heapFree = metrics.gauge("heap.free");
+        heapLargest = metrics.gauge("heap.largest_block");
+        psramFree = metrics.gauge("psram.free");
+    }
+
+    // メモリのゲージは読み出す直前に更新する
+    static void updateGauges() {
+        metrics.set(heapFree, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+        metrics.set(heapLargest, heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+        metrics.set(psramFree, heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    }
+
+    static void print() {
+        updateGauges();
+        Serial.printf("\n[METRICS] %d metrics:\n", metrics.size());
+        for (uint8_t id = 0; id < metrics.size(); id++) {
+            MetricSnapshot m = metrics.read(id);
+            if (m.type != MetricType::Histogram) {
+                Serial.printf("  %-24s %d\n", m.name, m.value);
+                continue;
+            }
+            Serial.printf("  %-24s n=%u mean=%u p50<=%u p99<=%u max=%u us\n", m.name, m.count,
+                         m.count ? m.sumMicros / m.count : 0, Metrics::percentile(m, 50),
+                         Metrics::percentile(m, 99), m.maxMicros);
+        }
+        Serial.println("==========================\n");
+    }
+}
+// ===== Boot Profiler =====
+// 起動の各段階が終わった時刻(esp_timerの起動からのマイクロ秒)を記録する。最初の記録はsetup()より前の
+// グローバルコンストラクタで取る。記録はRTCメモリ(リセットで消えない)に直接書くので、
+// 起動途中で落ちた場合もどの段階まで進んだかが次の起動で分かる。電源投入時は中身が不定なのでmagicで判定する。
+namespace BootProfiler {
+    enum Phase : uint8_t {
+        PHASE_STARTUP,       // ROM・ランタイムの初期化からグローバルコンストラクタまで
+        PHASE_ARDUINO_INIT,  // setup()が呼ばれるまで
+        PHASE_SERIAL,        // Serial・ログ・メトリクス
+        PHASE_DELAY_1,       // setup()先頭のdelay(1000)
+        PHASE_PSRAM_ALLOC,   // オーディオバッファ確保・WDT
+        PHASE_M5_BEGIN,
+        PHASE_SPEAKER,
+        PHASE_AVATAR_INIT,
+        PHASE_ESPEAK_ADD,
+        PHASE_ESPEAK_BEGIN,
+        PHASE_ESPEAK_VOICE,  // setVoiceと音声パラメータ
+        PHASE_SUBSYSTEMS,    // メモリ報告・PCM・テレメトリ・記録・トレース・受信タスク
+        PHASE_DELAY_2,       // 起動メッセージ前のdelay(1000)
+        PHASE_GREETING,      // 起動メッセージの合成と再生
+        PHASE_COUNT
+    };
+    static const char* const PHASE_NAMES[PHASE_COUNT] = {
+        "startup", "arduino_init", "serial", "delay_1", "psram_alloc", "m5_begin", "speaker",
+        "avatar_init", "espeak_add", "espeak_begin", "espeak_voice", "subsystems", "delay_2",
+        "greeting",
+    };
+    static const char* const RESET_REASONS[] = {
+        "unknown", "power-on", "external", "software", "panic", "int-wdt", "task-wdt", "wdt",
+        "deep-sleep", "brownout", "sdio",
+    };
+    constexpr uint32_t MAGIC = 0xB0075EED;
+    constexpr uint8_t BAR_WIDTH = 40;
+
+    struct Boot {
+        uint32_t number;
+        uint8_t resetReason;
+        uint8_t reached;                    // 終わった段階の数（PHASE_COUNT未満なら途中で止まった）
+        uint32_t endMicros[PHASE_COUNT];
+    };
+    struct History {
+        uint32_t magic;
+        uint32_t boots;  // これまでの起動回数
+        Boot slots[BOOT_HISTORY];
+    };
+    RTC_NOINIT_ATTR static History g_history;
+    static Boot* g_current = nullptr;
+
+    static void begin() {
+        if (g_history.magic != MAGIC) {
+            memset(&g_history, 0, sizeof(g_history));
+            g_history.magic = MAGIC;
+        }
+        g_current = &g_history.slots[g_history.boots % BOOT_HISTORY];
+        memset(g_current, 0, sizeof(Boot));
+        g_current->number = ++g_history.boots;
+    }
+
+    // 段階phaseが終わった
+    static void mark(Phase phase) {
+        if (g_current == nullptr) {
+            return;
+        }
+        g_current->endMicros[phase] = esp_timer_get_time();
+        g_current->reached = phase + 1;
+        // begin()はグローバルコンストラクタから呼ばれ、その時点ではリセット要因が
+        // まだ読めない（ESP_RST_UNKNOWNになる）ことがあるので、setup()の最初の記録で取る
+        if (phase == PHASE_ARDUINO_INIT) {
+            g_current->resetReason = esp_reset_reason();
+        }
+    }
+
+    // ago回前の起動（0が今回）
+    static const Boot* find(uint32_t ago) {
+        uint32_t stored = min(g_history.boots, (uint32_t)BOOT_HISTORY);
+        if (g_history.magic != MAGIC || ago >= stored) {
+            return nullptr;
+        }
+        return &g_history.slots[(g_history.boots - 1 - ago) % BOOT_HISTORY];
+    }
+
+    static uint32_t totalMicros(const Boot& boot) {
+        return boot.reached > 0 ? boot.endMicros[boot.reached - 1] : 0;
+    }
+
+    static const char* resetReason(const Boot& boot) {
+        size_t count = sizeof(RESET_REASONS) / sizeof(RESET_REASONS[0]);
+        return boot.resetReason < count ? RESET_REASONS[boot.resetReason] : "?";
+    }
+
+    static void printWaterfall(const Boot& boot) {
+        uint32_t total = totalMicros(boot);
+        Serial.printf("\n[BOOT] Boot #%u (reset: %s), %s after %.1f ms\n", boot.number,
+                     resetReason(boot), boot.reached == PHASE_COUNT ? "ready" : "stopped",
+                     total / 1000.0f);
+        Serial.println("  phase          start ms     ms");
+        uint32_t start = 0;
+        for (uint8_t i = 0; i < boot.reached; i++) {
+            uint32_t end = boot.endMicros[i];
+            char bar[BAR_WIDTH + 1];
+            uint8_t from = total ? (uint64_t)start * BAR_WIDTH / total : 0;
+            uint8_t to = total ? (uint64_t)end * BAR_WIDTH / total : 0;
+            if (to == from && end > start && to < BAR_WIDTH) to++;
+            for (uint8_t c = 0; c < BAR_WIDTH; c++) {
+                bar[c] = c < from ? ' ' : c < to ? '#' : '\0';
+            }
+            bar[BAR_WIDTH] = '\0';
+            Serial.printf("  %-13s %8.1f %7.1f |%s\n", PHASE_NAMES[i], start / 1000.0f,
+                         (end - start) / 1000.0f, bar);
+            start = end;
+        }
+        if (boot.reached < PHASE_COUNT) {
+            Serial.printf("  (did not finish %s)\n", PHASE_NAMES[boot.reached]);
+        }
+    }
+
+    static void printHistory() {
+        Serial.println("\n[BOOT] History (newest first):");
+        for (uint32_t ago = 0; ago < BOOT_HISTORY; ago++) {
+            const Boot* boot = find(ago);
+            if (boot == nullptr) {
+                break;
+            }
+            uint8_t slowest = 0;
+            uint32_t slowestMicros = 0;
+            uint32_t start = 0;
+            for (uint8_t i = 0; i < boot->reached; i++) {
+                if (boot->endMicros[i] - start > slowestMicros) {
+                    slowestMicros = boot->endMicros[i] - start;
+                    slowest = i;
+                }
+                start = boot->endMicros[i];
+            }
+            Serial.printf("  #%-4u %-10s %8.1f ms %-8s slowest %s (%.1f ms)\n", boot->number,
+                         resetReason(*boot), totalMicros(*boot) / 1000.0f,
+                         boot->reached == PHASE_COUNT ? "ready" : PHASE_NAMES[boot->reached],
+                         PHASE_NAMES[slowest], slowestMicros / 1000.0f);
+        }
+        Serial.println("==========================\n");
+    }
+
+    // 今回の起動だけを残す（番号は1から振り直す）
+    static void clear() {
+        if (g_current == nullptr) {
+            return;
+        }
+        Boot current = *g_current;
+        memset(g_history.slots, 0, sizeof(g_history.slots));
+        g_history.boots = 1;
+        g_current = &g_history.slots[0];
+        *g_current = current;
+        g_current->number = 1;
+    }
+}
+
+// setup()より前の最初の時刻を取る（時刻だけ。リセット要因はsetup()で記録する）
+__attribute__((constructor)) static void startBootProfiler() {
+    BootProfiler::begin();
+    BootProfiler::mark(BootProfiler::PHASE_STARTUP);
+}
+
 Avatar avatar;
 
+// Deadline monitors
+static DeadlineMonitor g_audioRefillDeadline(AUDIO_REFILL_DEADLINE_US);
+static DeadlineMonitor g_controlDeadline(CONTROL_DEADLINE_US);
+static uint32_t g_audioUnderruns = 0;  // 補充前に再生キューが空になった回数
+
+// Latency statistics
+struct LatencyStats {
+    uint32_t count;
+    uint64_t totalMicros;
+    uint32_t maxMicros;
+    void add(uint32_t micros) {
+        count++;
+        totalMicros += micros;
+        if (micros > maxMicros) maxMicros = micros;
+    }
+};
+// ストリーミングの最初のトークン到着時刻（最初の音声を出したら0に戻す）
+static volatile uint32_t g_streamFirstTokenMicros = 0;
+static LatencyStats g_firstAudioLatency = {};  // 最初のトークンから最初の音声出力まで
+
+// ===== Speaker Monitor =====
+// playRawの直前にM5.Speakerのキュー(isPlaying: 0=空 1=再生中 2=再生中+待ちあり)を記録し、
+// 発話ごとに途切れの回数と時刻を残す。DMAの中までは見えないので、キューが空になったことを途切れとみなす。
+// 途切れた発話の後はDMAバッファを増やし、途切れない発話が続いたら減らして遅延を詰める。
+// 再設定はM5.Speakerを止め直すので、発話の合間（再生したタスクの終了処理）でだけ行う。
+namespace SpeakerMonitor {
+    constexpr uint8_t QUEUE_STATES = 3;
+    constexpr uint8_t MAX_UNDERRUN_TIMES = 8;
+    constexpr uint8_t DMA_BUF_COUNT_MIN = 4;
+    constexpr uint8_t DMA_BUF_COUNT_MAX = 16;
+    constexpr uint8_t DMA_BUF_COUNT_STEP = 2;
+    constexpr uint8_t CLEAN_UTTERANCES_TO_SHRINK = 5;
+
+    struct UtteranceStats {
+        uint32_t startMillis;
+        uint32_t durationMillis;
+        uint32_t refills;
+        uint32_t queueStates[QUEUE_STATES];           // 補充直前のキューの状態ごとの回数
+        uint32_t underruns;
+        uint32_t underrunMillis[MAX_UNDERRUN_TIMES];  // 発話開始からの時刻（最初のN回）
+        uint8_t dmaBufCount;
+    };
+    struct Totals {
+        uint32_t utterances;
+        uint32_t underruns;
+        uint32_t utterancesWithUnderruns;
+        uint32_t lastUnderrunMillis;  // 起動からの時刻
+        uint32_t grows;
+        uint32_t shrinks;
+    };
+    static UtteranceStats g_current = {};
+    static UtteranceStats g_last = {};
+    static Totals g_totals = {};
+    static bool g_adaptive = true;
+    static uint8_t g_dmaBufCount = 0;
+    static uint8_t g_cleanUtterances = 0;  // 途切れなかった発話の連続数
+    static std::atomic<uint8_t> g_requestedCount(0);  // speaker_dmaの指定（次の発話の前に反映）
+    static uint8_t g_dmaBuffersMetric = METRIC_INVALID;
+
+    static float bufferedMs(uint8_t count) {
+        const auto& cfg = M5.Speaker.config();
+        return count * cfg.dma_buf_len * 1000.0f / cfg.sample_rate;
+    }
+
+    // playRawの直前に呼び、キューの状態を返す
+    static uint8_t sample() {
+        uint8_t state = min((size_t)M5.Speaker.isPlaying(0), (size_t)QUEUE_STATES - 1);
+        g_current.refills++;
+        g_current.queueStates[state]++;
+        return state;
+    }
+
+    // まだ供給するデータがあるのにキューが空になっていた
+    static void underrun() {
+        uint32_t now = millis();
+        if (g_current.underruns < MAX_UNDERRUN_TIMES) {
+            g_current.underrunMillis[g_current.underruns] = now - g_current.startMillis;
+        }
+        g_current.underruns++;
+        g_totals.underruns++;
+        g_totals.lastUnderrunMillis = now;
+        metrics.increment(AppMetrics::underruns);
+        TRACE_INSTANT("audio.underrun");
+    }
+
+    // M5.Speakerを止めてDMAバッファ数を変える。再生中に呼ばないこと
+    static bool resize(uint8_t count) {
+        count = constrain(count, DMA_BUF_COUNT_MIN, DMA_BUF_COUNT_MAX);
+        if (count == g_dmaBufCount) {
+            return true;
+        }
+        M5.Speaker.end();
+        auto cfg = M5.Speaker.config();
+        cfg.dma_buf_count = count;
+        M5.Speaker.config(cfg);
+        if (!M5.Speaker.begin()) {
+            LOG_E("SPEAKER", "Failed to restart with %u DMA buffers", count);
+            return false;
+        }
+        LOG_I("SPEAKER", "DMA buffers %u -> %u (%.1f ms)", g_dmaBufCount, count, bufferedMs(count));
+        g_dmaBufCount = count;
+        metrics.set(g_dmaBuffersMetric, count);
+        return true;
+    }
+
+    // 再生を始める前に呼ぶ
+    static void begin() {
+        uint8_t requested = g_requestedCount.exchange(0);
+        if (requested != 0) {
+            resize(requested);
+        }
+        g_current = {};
+        g_current.startMillis = millis();
+        g_current.dmaBufCount = g_dmaBufCount;
+    }
+
+    // 再生が終わってM5.Speakerが止まってから呼ぶ
+    static void end() {
+        g_current.durationMillis = millis() - g_current.startMillis;
+        g_last = g_current;
+        g_totals.utterances++;
+        if (g_current.underruns > 0) {
+            g_totals.utterancesWithUnderruns++;
+            LOG_W("SPEAKER", "%u underruns in %u ms (first at %u ms)", g_current.underruns,
+                  g_current.durationMillis, g_current.underrunMillis[0]);
+        }
+        if (!g_adaptive) {
+            return;
+        }
+        if (g_current.underruns > 0) {
+            g_cleanUtterances = 0;
+            if (g_dmaBufCount < DMA_BUF_COUNT_MAX && resize(g_dmaBufCount + DMA_BUF_COUNT_STEP)) {
+                g_totals.grows++;
+            }
+        } else if (++g_cleanUtterances >= CLEAN_UTTERANCES_TO_SHRINK) {
+            g_cleanUtterances = 0;
+            if (g_dmaBufCount > DMA_BUF_COUNT_MIN && resize(g_dmaBufCount - DMA_BUF_COUNT_STEP)) {
+                g_totals.shrinks++;
+            }
+        }
+    }
+
+    static void printStatus() {
+        Serial.printf("\n[SPEAKER] DMA buffers: %u x %u samples (%.1f ms), adaptive %s\n",
+                     g_dmaBufCount, M5.Speaker.config().dma_buf_len, bufferedMs(g_dmaBufCount),
+                     g_adaptive ? "on" : "off");
+        Serial.printf("  Utterances: %u, with underruns: %u, underruns: %u\n",
+                     g_totals.utterances, g_totals.utterancesWithUnderruns, g_totals.underruns);
+        if (g_totals.underruns > 0) {
+            Serial.printf("  Last underrun: %.1f s ago\n", (millis() - g_totals.lastUnderrunMillis) / 1000.0f);
+        }
+        Serial.printf("  Resized: %u grows, %u shrinks\n", g_totals.grows, g_totals.shrinks);
+        const UtteranceStats& u = g_last;
+        if (u.refills > 0) {
+            Serial.printf("  Last utterance: %u ms, %u refills, queue empty/playing/waiting %u/%u/%u\n",
+                         u.durationMillis, u.refills, u.queueStates[0], u.queueStates[1], u.queueStates[2]);
+            Serial.printf("  Underruns: %u", u.underruns);
+            for (uint32_t i = 0; i < min(u.underruns, (uint32_t)MAX_UNDERRUN_TIMES); i++) {
+                Serial.printf("%s%u", i == 0 ? " at " : ", ", u.underrunMillis[i]);
+            }
+            Serial.println(u.underruns > 0 ? " ms" : "");
+        }
+        Serial.println("==========================\n");
+    }
+
+    // M5.Speaker.begin()の後に呼ぶ
+    static void setup() {
+        g_dmaBufCount = M5.Speaker.config().dma_buf_count;
+        g_dmaBuffersMetric = metrics.gauge("speaker.dma_buffers");
+        metrics.set(g_dmaBuffersMetric, g_dmaBufCount);
+    }
+}
+
 // ===== Memory Buffer Stream =====
 class MemoryBufferStream : public AudioStream {
 public:
@@ -90,8 +670,10 @@ public:
             samplesWritten++;
         }
         
+        metrics.increment(AppMetrics::synthesizedSamples, samplesWritten);
         // バッファ満杯の警告
         if (g_audioBufferPos >= MAX_AUDIO_BUFFER_SIZE && samplesWritten < samples) {
+            metrics.increment(AppMetrics::truncatedSamples, samples - samplesWritten);
             LOG_W("BUFFER", "Audio buffer full! Truncated %d samples", samples - samplesWritten);
         }
         
@@ -125,11 +707,26 @@ public:
 MemoryBufferStream memoryStream;
 ESpeak espeak(memoryStream);
 
+// 合成中のeSpeakに別タスクから触らないよう、次の合成前にまとめて反映する
+void applyVoiceParameters() {
+    if (!g_voiceDirty) return;
+    portENTER_CRITICAL(&g_voiceLock);
+    g_voiceDirty = false;
+    int rate = g_rate;
+    int pitch = g_pitch;
+    int volume = g_volume_internal;
+    int pitchRange = g_pitchRange;
+    portEXIT_CRITICAL(&g_voiceLock);
+    espeak.setRate(rate);
+    espeak.setPitch(pitch);
+    espeak.setVolume(volume);
+    espeak.setPitchRange(pitchRange);
+}
+
 // ===== Level Calculation =====
-void updateLevel(const int16_t* samples, size_t count) {
+int chunkLevel(const int16_t* samples, size_t count) {
     if (count == 0) {
-        g_currentLevel = 0;
-        return;
+        return 0;
     }
     
     long sum = 0;
@@ -140,7 +737,17 @@ void updateLevel(const int16_t* samples, size_t count) {
     }
     
     int avgLevel = sum / checkSamples;
-    g_currentLevel = constrain((avgLevel * 100) / 32767, 0, 100);
+    return constrain((avgLevel * 100) / 32767, 0, 100);
+}
+
+void updateLevel(const int16_t* samples, size_t count) {
+    g_currentLevel = chunkLevel(samples, count);
+}
+
+void updateMouth(const int16_t* samples, size_t count) {
+    updateLevel(samples, count);
+    float mouthOpen = (g_currentLevel > 3) ? constrain(g_currentLevel / 30.0f, 0.0f, 1.0f) : 0.0f;
+    avatar.setMouthOpenRatio(mouthOpen);
 }
 
 // ===== Memory Monitor =====
@@ -161,8 +768,12 @@ namespace MemoryMonitor {
         Serial.printf("  Audio Buffer: %.1f KB (in PSRAM)\n", 
                      (MAX_AUDIO_BUFFER_SIZE * sizeof(int16_t)) / 1024.0f);
         
+        // 呼び出したタスク（起動時はloop、コマンドではserialRx）の最小空き容量。
+        // ESP-IDFではバイト単位で返る
         UBaseType_t stackRemaining = uxTaskGetStackHighWaterMark(NULL);
-        Serial.printf("  Stack remaining: %.1f KB\n", stackRemaining * 4 / 1024.0f);
+        Serial.printf("  Stack remaining (%s task): %.1f KB\n",
+                     pcTaskGetTaskName(NULL), stackRemaining / 1024.0f);
+        Serial.println("  (see 'stack' for per-operation peaks)");
         
         if (stackRemaining < 1024) {
             Serial.println("  [WARNING] Stack usage high");
@@ -173,10 +784,337 @@ namespace MemoryMonitor {
     }
 }
 
+// ===== Stack Profiler =====
+// 操作ごとのスタック最大使用量（m5avatar::stackProfilerが開始時に空き領域を塗り、終了時に走査する）
+namespace StackReport {
+    static const char* const ARG_BUCKETS[STACK_ARG_BUCKETS] = {
+        "<16", "<32", "<64", "<128", "<256", ">=256",
+    };
+
+    static void print() {
+        Serial.printf("\n[STACK] Peak use per operation (below the caller, %u B resolution):\n",
+                     STACK_PAINT_MARGIN);
+        for (uint8_t op = 0; op < stackProfiler.size(); op++) {
+            StackOpStats s = stackProfiler.read(op);
+            if (s.count == 0) {
+                Serial.printf("  %-18s not run yet\n", s.name);
+                continue;
+            }
+            Serial.printf("  %-18s %-10s n=%u peak %u B (arg %u), last %u B, min free %u B\n",
+                         s.name, s.task, s.count, s.peakBytes, s.peakArg, s.lastBytes, s.minFreeBytes);
+            Serial.print("    peak by arg:");
+            for (uint8_t b = 0; b < STACK_ARG_BUCKETS; b++) {
+                if (s.bucketPeakBytes[b] > 0) {
+                    Serial.printf(" %s %u B", ARG_BUCKETS[b], s.bucketPeakBytes[b]);
+                }
+            }
+            Serial.println();
+        }
+        // 塗っていない余白より手前は測れないので、縮めるときは最小空き容量からさらに余裕を残すこと
+        Serial.println("  (a task's stack can shrink by about its smallest min free, minus a margin)");
+        Serial.println("==========================\n");
+    }
+}
+
+// ===== Heap Tracker =====
+// サブシステム（audio/render/tts/serial）ごとのヒープ使用量とリーク検出。
+// m5avatar::heapTrackerはmalloc/free系のリンカラッパー（platformio.iniの-Wl,--wrap）から
+// 全確保を受け取り、呼び出したタスクのHeapScopeのタグで記録する。
+// heap_caps_malloc()で直接取った領域（スプライト・DMAバッファ）は対象外
+namespace HeapReport {
+    struct Baseline {
+        HeapSnapshot snapshot;
+        uint32_t freeInternal;
+        uint32_t freePsram;
+    };
+    static Baseline g_baseline = {};
+    static constexpr uint16_t MAX_LEAKS = 16;
+
+    static Baseline take() {
+        Baseline b;
+        b.snapshot = heapTracker.snapshot();
+        b.freeInternal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+        b.freePsram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+        return b;
+    }
+
+    static void setup() {
+        heapTracker.begin();
+        g_baseline = take();
+    }
+
+    static void snapshot() {
+        g_baseline = take();
+        Serial.println("[HEAP] Snapshot taken; run 'heap_leaks' later to compare");
+    }
+
+    // ラッパーなしのビルドでは何も記録されないので、0を「リークなし」と見せない
+    static bool requireTracking() {
+        if (heapTracker.isLinked()) {
+            return true;
+        }
+        Serial.println("  [WARN] Allocation tracking is not linked in this build");
+        Serial.println("  (needs -DHEAP_TRACKER_WRAP and -Wl,--wrap=malloc,... as in platformio.ini)");
+        return false;
+    }
+
+    static void print() {
+        HeapSnapshot now = heapTracker.snapshot();
+        float seconds = now.millis / 1000.0f;
+        Serial.println("\n[HEAP] Allocations per subsystem (malloc/free, not heap_caps_malloc):");
+        if (requireTracking()) {
+            Serial.println("  tag      live B    peak B  live n    allocs     frees  alloc/s      B/s");
+            for (uint8_t i = 0; i < HEAP_TAGS; i++) {
+                const HeapTagStats& t = now.tags[i];
+                Serial.printf("  %-6s %8u  %8u  %6u  %8u  %8u  %7.1f  %7.0f\n",
+                             heapTagName(static_cast<HeapTag>(i)), t.liveBytes, t.peakLiveBytes,
+                             t.liveAllocations, t.allocations, t.frees,
+                             t.allocations / seconds, t.allocatedBytes / seconds);
+            }
+            Serial.printf("  untracked: %u allocs (table of %u entries full), %u frees (made before tracking or by heap_caps_malloc)\n",
+                         now.untrackedAllocations, HEAP_TRACK_CAPACITY, now.untrackedFrees);
+        }
+        Serial.printf("  free: internal %u B, PSRAM %u B\n",
+                     heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                     heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+        Serial.println("==========================\n");
+    }
+
+    static void printLeaks() {
+        HeapSnapshot now = heapTracker.snapshot();
+        const HeapSnapshot& then = g_baseline.snapshot;
+        float seconds = (now.millis - then.millis) / 1000.0f;
+        if (seconds <= 0.0f) {
+            seconds = 0.001f;
+        }
+        Serial.printf("\n[HEAP] Change since the snapshot %.1f s ago:\n", seconds);
+        Serial.printf("  free: internal %+d B, PSRAM %+d B\n",
+                     (int)(heap_caps_get_free_size(MALLOC_CAP_INTERNAL) - g_baseline.freeInternal),
+                     (int)(heap_caps_get_free_size(MALLOC_CAP_SPIRAM) - g_baseline.freePsram));
+        if (!requireTracking()) {
+            Serial.println("==========================\n");
+            return;
+        }
+
+        Serial.println("  tag      live B  live n  alloc/s      B/s  free/s");
+        bool growing = false;
+        for (uint8_t i = 0; i < HEAP_TAGS; i++) {
+            const HeapTagStats& a = then.tags[i];
+            const HeapTagStats& b = now.tags[i];
+            int32_t bytes = static_cast<int32_t>(b.liveBytes - a.liveBytes);
+            int32_t count = static_cast<int32_t>(b.liveAllocations - a.liveAllocations);
+            Serial.printf("  %-6s %+8d  %+6d  %7.1f  %7.0f  %6.1f%s\n",
+                         heapTagName(static_cast<HeapTag>(i)), (int)bytes, (int)count,
+                         (b.allocations - a.allocations) / seconds,
+                         (b.allocatedBytes - a.allocatedBytes) / seconds,
+                         (b.frees - a.frees) / seconds,
+                         bytes > 0 ? "  <- grew" : "");
+            growing |= bytes > 0;
+        }
+
+        static HeapLeak leaks[MAX_LEAKS];
+        uint32_t found = heapTracker.findLeaks(then, leaks, MAX_LEAKS);
+        uint16_t shown = found < MAX_LEAKS ? found : MAX_LEAKS;
+        Serial.printf("  Allocations made since the snapshot and still live: %u (largest %u)\n",
+                     found, shown);
+        for (uint16_t i = 0; i < shown; i++) {
+            Serial.printf("    %p %7u B  %-6s  %.1f s old\n", leaks[i].ptr, leaks[i].size,
+                         heapTagName(leaks[i].tag), leaks[i].ageMillis / 1000.0f);
+        }
+        // 表が埋まって追えなかった確保があると、上の一覧と件数は下限になる
+        uint32_t untracked = now.untrackedAllocations - then.untrackedAllocations;
+        if (untracked > 0) {
+            Serial.printf("  [WARN] %u allocations were not tracked (table full); the list is incomplete\n",
+                         untracked);
+        }
+        // 一度きりの初期化でも増えるので、同じ操作を繰り返した後の差分で判断する
+        if (growing) {
+            Serial.println("  Growth that persists across repeated runs of the same work is a leak");
+        }
+        Serial.println("==========================\n");
+    }
+}
+
+// ===== Binary Protocol =====
+// 0x00で始まり0x00で終わるフレームはバイナリモードとして扱う（ASCII行には0x00が現れない）。
+// フレーム内はCOBSエンコードされたペイロード:
+//   [magic 0xA5][type][request id (u16 LE)][body...][CRC16-CCITT (u16 LE)]
+// ホスト側の実装は tools/stackchan_serial.py を参照。
+namespace BinaryProtocol {
+    constexpr uint8_t MAGIC = 0xA5;
+    constexpr size_t HEADER_SIZE = 4;
+    constexpr size_t CRC_SIZE = 2;
+    constexpr size_t MAX_PAYLOAD = BINARY_FRAME_SIZE - BINARY_FRAME_SIZE / 254 - 1;
+
+    // host -> device
+    enum Command : uint8_t {
+        CMD_PING = 0x01,
+        CMD_SPEAK = 0x02,        // body: UTF-8 text
+        CMD_SET_PARAMS = 0x03,   // body: N x [param id][value (i16 LE)]
+        CMD_GET_STATUS = 0x04,
+        CMD_STREAM_BEGIN = 0x05,
+        CMD_STREAM_CHUNK = 0x06,  // body: UTF-8 text
+        CMD_STREAM_END = 0x07,
+        CMD_PCM_BEGIN = 0x08,     // body: [sample rate (u32 LE)]
+        CMD_PCM_DATA = 0x09,      // body: 16-bit mono samples (LE); BUSY when the buffer is full
+        CMD_PCM_END = 0x0A,
+        CMD_DUMP = 0x0B,          // body: text to synthesize, or empty for the last utterance
+        CMD_TELEMETRY = 0x0C,     // body: [interval ms (u16 LE)], 0 stops
+    };
+
+    // device -> host
+    enum Reply : uint8_t {
+        REPLY_ACK = 0x80,        // body: [status][detail]
+        REPLY_STATUS = 0x81,     // body: [speaking] + N x [param id][value (i16 LE)]
+        REPLY_EVENT = 0x82,      // body: [event id]
+        REPLY_DUMP_INFO = 0x83,  // body: "key=value" lines
+        REPLY_DUMP_LEVELS = 0x84,  // body: lip-sync level (0-100) per playback chunk
+        REPLY_DUMP_DATA = 0x85,  // body: [offset (u32 LE)][WAV bytes]
+        REPLY_DUMP_END = 0x86,   // body: [total bytes (u32 LE)][CRC16 of the WAV (u16 LE)]
+        REPLY_TELEMETRY = 0x87,  // body: Telemetry::Record + N x Telemetry::TaskRecord
+        REPLY_RECORD_DATA = 0x88,  // body: [offset (u32 LE)][recording bytes]
+        REPLY_RECORD_END = 0x89,   // body: [total bytes (u32 LE)][entries (u32 LE)][CRC16 (u16 LE)]
+        REPLY_METRICS = 0x8A,      // body: [telemetry sequence (u32 LE)] + N x metric (Telemetry::sendMetrics)
+        REPLY_TRACE_INFO = 0x8B,   // body: "key=value" lines (names and tasks of the events)
+        REPLY_TRACE_DATA = 0x8C,   // body: [index of the first event (u32 LE)] + N x event (Tracing::send)
+        REPLY_TRACE_END = 0x8D,    // body: [events (u32 LE)][CRC16 of the event bytes (u16 LE)]
+    };
+
+    enum Status : uint8_t {
+        STATUS_OK = 0,
+        STATUS_BAD_CRC = 1,
+        STATUS_UNKNOWN_COMMAND = 2,
+        STATUS_BAD_LENGTH = 3,
+        STATUS_BUSY = 4,
+        STATUS_INVALID_PARAM = 5,  // detail: index of the rejected parameter
+        STATUS_FAILED = 6,
+    };
+
+    enum Event : uint8_t {
+        EVENT_SPEECH_STARTED = 1,
+        EVENT_SPEECH_FINISHED = 2,
+    };
+
+    enum Param : uint8_t {
+        PARAM_VOLUME = 1,
+        PARAM_RATE = 2,
+        PARAM_PITCH = 3,
+        PARAM_INTERNAL_VOLUME = 4,
+        PARAM_PITCH_RANGE = 5,
+        PARAM_THEME = 6,
+    };
+
+    // バイナリフレームを受信したホストにだけイベントを送る
+    static bool g_hostActive = false;
+
+    // crcを渡すと続きから計算する（分割したデータのCRC用）
+    static uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF) {
+        for (size_t i = 0; i < len; i++) {
+            crc ^= (uint16_t)data[i] << 8;
+            for (int b = 0; b < 8; b++) {
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+            }
+        }
+        return crc;
+    }
+
+    static size_t cobsEncode(const uint8_t* src, size_t len, uint8_t* dst) {
+        size_t out = 1;
+        size_t codePos = 0;
+        uint8_t code = 1;
+        for (size_t i = 0; i < len; i++) {
+            if (src[i] == 0) {
+                dst[codePos] = code;
+                codePos = out++;
+                code = 1;
+                continue;
+            }
+            dst[out++] = src[i];
+            if (++code == 0xFF) {
+                dst[codePos] = code;
+                codePos = out++;
+                code = 1;
+            }
+        }
+        dst[codePos] = code;
+        return out;
+    }
+
+    // returns 0 for a malformed frame
+    static size_t cobsDecode(const uint8_t* src, size_t len, uint8_t* dst) {
+        size_t in = 0;
+        size_t out = 0;
+        while (in < len) {
+            uint8_t code = src[in++];
+            if (code == 0 || in + code - 1 > len) {
+                return 0;
+            }
+            for (uint8_t i = 1; i < code; i++) {
+                dst[out++] = src[in++];
+            }
+            if (code != 0xFF && in < len) {
+                dst[out++] = 0;
+            }
+        }
+        return out;
+    }
+
+    static void send(uint8_t type, uint16_t requestId, const uint8_t* body, size_t len) {
+        static uint8_t payload[MAX_PAYLOAD];
+        static uint8_t frame[BINARY_FRAME_SIZE];
+        if (HEADER_SIZE + len + CRC_SIZE > MAX_PAYLOAD) {
+            LOG_E("PROTO", "Reply too long: %d bytes", len);
+            return;
+        }
+        // 受信タスク(ack)とloop(イベント・dump)の両方から送るので送信バッファも一緒に保護する
+        xSemaphoreTake(g_serialTxMutex, portMAX_DELAY);
+        payload[0] = MAGIC;
+        payload[1] = type;
+        payload[2] = requestId & 0xFF;
+        payload[3] = requestId >> 8;
+        memcpy(payload + HEADER_SIZE, body, len);
+        uint16_t crc = crc16(payload, HEADER_SIZE + len);
+        payload[HEADER_SIZE + len] = crc & 0xFF;
+        payload[HEADER_SIZE + len + 1] = crc >> 8;
+        size_t frameLen = cobsEncode(payload, HEADER_SIZE + len + CRC_SIZE, frame);
+        Serial.write((uint8_t)0);
+        Serial.write(frame, frameLen);
+        Serial.write((uint8_t)0);
+        xSemaphoreGive(g_serialTxMutex);
+    }
+
+    static void sendAck(uint16_t requestId, Status status, uint8_t detail = 0) {
+        uint8_t body[2] = {status, detail};
+        send(REPLY_ACK, requestId, body, sizeof(body));
+    }
+
+    static void sendEvent(Event event) {
+        if (!g_hostActive) return;
+        uint8_t body[1] = {event};
+        send(REPLY_EVENT, 0, body, sizeof(body));
+    }
+}
+
 // ===== Speech Function =====
-bool speak(const char* text) {
-    if (g_isSpeaking || !g_systemReady) {
-        LOG_W("SPEAK", "Cannot speak: speaking=%d, ready=%d", g_isSpeaking, g_systemReady);
+// 直前に合成した音声の情報（dumpコマンドで出力する）
+struct UtteranceInfo {
+    char text[MAX_TEXT_LENGTH + 1];
+    uint32_t samples;
+    uint32_t synthMicros;
+    uint32_t playbackMillis;  // 再生していなければ0
+    int rate;
+    int pitch;
+    int internalVolume;
+    int pitchRange;
+    int peak;
+    uint16_t rms;
+};
+static UtteranceInfo g_lastUtterance = {};
+
+// textをg_audioBufferに合成する（再生はしない）。呼び出し側でclaimSpeaker()しておくこと
+static bool synthesize(const char* text) {
+    if (!g_systemReady) {
+        LOG_W("SPEAK", "Cannot synthesize: system not ready");
         return false;
     }
     
@@ -196,9 +1134,14 @@ bool speak(const char* text) {
         return false;
     }
     
+    // eSpeakの合成はスタックを大きく使うので、テキスト長ごとの最大使用量を測る
+    static const uint8_t synthesisStack = stackProfiler.operation("speak.synthesize");
+    StackScope stackScope(synthesisStack, len);
+    HeapScope heapScope(HeapTag::Tts);
+    applyVoiceParameters();
     LOG_I("SPEAK", "Starting speech synthesis: '%s' (length: %d)", text, len);
-    g_isSpeaking = true;
     g_currentLevel = 0;
+    g_lastUtterance.samples = 0;
     
     // Step 1: Clear buffer
     g_audioBufferPos = 0;
@@ -211,7 +1154,12 @@ bool speak(const char* text) {
     // eSpeakの内部タイムアウトを避けるため、少し待機
     delay(10);
     
+    uint32_t synthStart = micros();
+    TRACE_BEGIN("speak.synthesize");
     bool synthSuccess = espeak.say(text);
+    TRACE_END("speak.synthesize");
+    uint32_t synthMicros = micros() - synthStart;
+    metrics.record(AppMetrics::synthesisMicros, synthMicros);
     
     // 合成完了まで少し待機（長文の場合）
     delay(50);
@@ -219,13 +1167,11 @@ bool speak(const char* text) {
     
     if (!synthSuccess) {
         LOG_E("SPEAK", "eSpeak.say() returned false");
-        g_isSpeaking = false;
         return false;
     }
     
     if (g_audioBufferPos == 0) {
         LOG_E("SPEAK", "No audio data generated (buffer empty)");
-        g_isSpeaking = false;
         return false;
     }
     
@@ -245,16 +1191,46 @@ bool speak(const char* text) {
               duration, expectedDuration);
     }
     
+    // メタデータを記録
+    int peak = 0;
+    uint64_t sumSquares = 0;
+    for (size_t i = 0; i < g_audioBufferPos; i++) {
+        int v = abs(g_audioBuffer[i]);
+        if (v > peak) peak = v;
+        sumSquares += (int32_t)g_audioBuffer[i] * g_audioBuffer[i];
+    }
+    strncpy(g_lastUtterance.text, text, MAX_TEXT_LENGTH);
+    g_lastUtterance.text[MAX_TEXT_LENGTH] = '\0';
+    g_lastUtterance.samples = g_audioBufferPos;
+    g_lastUtterance.synthMicros = synthMicros;
+    g_lastUtterance.playbackMillis = 0;
+    g_lastUtterance.rate = g_rate;
+    g_lastUtterance.pitch = g_pitch;
+    g_lastUtterance.internalVolume = g_volume_internal;
+    g_lastUtterance.pitchRange = g_pitchRange;
+    g_lastUtterance.peak = peak;
+    g_lastUtterance.rms = sqrtf((float)sumSquares / g_audioBufferPos);
+    return true;
+}
+
+// g_audioBufferの内容をリップシンク付きで再生する
+static void play(const char* text) {
+    TRACE_SCOPE("speak.play");
+    HeapScope heapScope(HeapTag::Audio);
     // Step 3: Real-time playback with lip sync
     LOG_I("SPEAK", "Playing audio with M5.Speaker...");
 
 
     avatar.setExpression(Expression::Happy);    // M5Avatar
     avatar.setSpeechText(text);                 // M5Avatar
+    BinaryProtocol::sendEvent(BinaryProtocol::EVENT_SPEECH_STARTED);
     
-    const size_t chunkSize = 512;
+    const size_t chunkSize = PLAYBACK_CHUNK_SAMPLES;
     g_playbackPos = 0;
     uint32_t startTime = millis();
+    uint32_t lastRefill = 0;
+    g_audioRefillDeadline.restart();
+    SpeakerMonitor::begin();
     
     while (g_playbackPos < g_audioBufferPos && g_isSpeaking && 
            (millis() - startTime < SPEECH_TIMEOUT_MS)) {
@@ -262,26 +1238,41 @@ bool speak(const char* text) {
         size_t remainingSamples = g_audioBufferPos - g_playbackPos;
         size_t currentChunk = min(remainingSamples, chunkSize);
         
-        // Level calculation for lip sync
-        updateLevel(&g_audioBuffer[g_playbackPos], currentChunk);
-        
-        // Update mouth movement
-        float mouthOpen = (g_currentLevel > 3) ? constrain(g_currentLevel / 30.0f, 0.0f, 1.0f) : 0.0f;
-        avatar.setMouthOpenRatio(mouthOpen);
+        // Level calculation and mouth movement for lip sync
+        updateMouth(&g_audioBuffer[g_playbackPos], currentChunk);
         
         // Audio playback
         esp_task_wdt_reset();
+        uint32_t now = micros();
+        g_audioRefillDeadline.tick(now);
+        uint8_t queueState = SpeakerMonitor::sample();
+        if (g_playbackPos > 0) {
+            metrics.record(AppMetrics::refillMicros, now - lastRefill);
+            if (queueState == 0) {
+                g_audioUnderruns++;
+                SpeakerMonitor::underrun();
+            }
+        }
+        lastRefill = now;
+        TRACE_BEGIN("audio.play_raw");
         bool playResult = M5.Speaker.playRaw(
             &g_audioBuffer[g_playbackPos], 
             currentChunk, 
             AUDIO_SAMPLE_RATE, 
             false, 1, 0
         );
+        TRACE_END("audio.play_raw");
         
         if (!playResult) {
             LOG_W("SPEAK", "playRaw failed at position %d", g_playbackPos);
             break;
         }
+        if (g_playbackPos == 0 && g_streamFirstTokenMicros != 0) {
+            uint32_t firstAudio = micros() - g_streamFirstTokenMicros;
+            g_streamFirstTokenMicros = 0;
+            g_firstAudioLatency.add(firstAudio);
+            LOG_I("STREAM", "First token to first audio: %.1f ms", firstAudio / 1000.0f);
+        }
         
         g_playbackPos += currentChunk;
         vTaskDelay(pdMS_TO_TICKS(8));
@@ -289,83 +1280,1680 @@ bool speak(const char* text) {
     
     // Completion
     avatar.setMouthOpenRatio(0.0f);
-    avatar.setExpression(Expression::Neutral);
+    avatar.setExpression(g_restExpression);
     avatar.setSpeechText("");
     M5.Speaker.stop();
     g_currentLevel = 0;
-    g_isSpeaking = false;
+    g_lastUtterance.playbackMillis = millis() - startTime;
+    SpeakerMonitor::end();
     
     LOG_I("SPEAK", "Speech playback completed. Played %d/%d samples", g_playbackPos, g_audioBufferPos);
-    return true;
 }
 
-// ===== Serial Command Processor =====
-namespace SerialProcessor {
-    static void processCommand() {
-        if (g_isSpeaking) {
-            Serial.println("[BLOCKED] Speech in progress");
-            return;
+// 空いていればスピーカーを確保する。確保できたらreleaseSpeaker()で返すこと
+static bool claimSpeaker() {
+    bool expected = false;
+    return g_isSpeaking.compare_exchange_strong(expected, true);
+}
+
+static void releaseSpeaker() {
+    g_isSpeaking = false;
+}
+
+// スピーカーを確保済みの状態で呼ぶ。終わったら解放する
+static bool speakClaimed(const char* text) {
+    bool synthesized = synthesize(text);
+    if (synthesized) {
+        metrics.increment(AppMetrics::utterances);
+        play(text);
+    } else {
+        metrics.increment(AppMetrics::speechFailures);
+    }
+    releaseSpeaker();
+    // 発話中はloopが止まるのが仕様なので、制御ループの周期計測をやり直す
+    g_controlDeadline.restart();
+    if (synthesized) {
+        BinaryProtocol::sendEvent(BinaryProtocol::EVENT_SPEECH_FINISHED);
+    }
+    return synthesized;
+}
+
+bool speak(const char* text) {
+    if (!g_systemReady || !claimSpeaker()) {
+        LOG_W("SPEAK", "Cannot speak: speaking=%d, ready=%d", g_isSpeaking.load(), g_systemReady);
+        return false;
+    }
+    return speakClaimed(text);
+}
+
+// ===== Audio Dump =====
+// 直前の発話をWAVファイルとしてバイナリフレームで送る。
+// INFO(メタデータ) → LEVELS(リップシンクのレベル) → DATA(WAV本体) × N → END の順。
+namespace AudioDump {
+    constexpr size_t DATA_BYTES_PER_FRAME = 512;
+    constexpr size_t WAV_HEADER_SIZE = 44;
+
+    static void writeLE(uint8_t* p, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            p[i] = (value >> (8 * i)) & 0xFF;
         }
+    }
+
+    static void makeWavHeader(uint8_t* h, uint32_t samples) {
+        uint32_t dataBytes = samples * sizeof(int16_t);
+        memcpy(h, "RIFF", 4);
+        writeLE(h + 4, 36 + dataBytes, 4);
+        memcpy(h + 8, "WAVEfmt ", 8);
+        writeLE(h + 16, 16, 4);                       // fmt chunk size
+        writeLE(h + 20, 1, 2);                        // PCM
+        writeLE(h + 22, 1, 2);                        // mono
+        writeLE(h + 24, AUDIO_SAMPLE_RATE, 4);
+        writeLE(h + 28, AUDIO_SAMPLE_RATE * 2, 4);    // byte rate
+        writeLE(h + 32, 2, 2);                        // block align
+        writeLE(h + 34, 16, 2);                       // bits per sample
+        memcpy(h + 36, "data", 4);
+        writeLE(h + 40, dataBytes, 4);
+    }
+
+    // g_audioBufferを読むので合成タスク(loop)から呼ぶこと
+    static bool send(uint16_t requestId) {
+        using namespace BinaryProtocol;
+        const UtteranceInfo& u = g_lastUtterance;
+        if (u.samples == 0 || g_audioBuffer == nullptr) {
+            LOG_W("DUMP", "No synthesized utterance to dump");
+            return false;
+        }
+        
+        char info[MAX_PAYLOAD - HEADER_SIZE - CRC_SIZE];
+        int n = snprintf(info, sizeof(info),
+            "sample_rate=%d\nsamples=%u\nduration_ms=%u\nsynth_ms=%.1f\nplayback_ms=%u\n"
+            "rate=%d\npitch=%d\ninternal_volume=%d\npitch_range=%d\npeak=%d\nrms=%u\n"
+            "level_chunk_samples=%d\ntext=%s",
+            AUDIO_SAMPLE_RATE, u.samples, (uint32_t)(u.samples * 1000ULL / AUDIO_SAMPLE_RATE),
+            u.synthMicros / 1000.0f, u.playbackMillis, u.rate, u.pitch, u.internalVolume,
+            u.pitchRange, u.peak, u.rms, PLAYBACK_CHUNK_SAMPLES, u.text);
+        BinaryProtocol::send(REPLY_DUMP_INFO, requestId, (const uint8_t*)info,
+                             min((size_t)n, sizeof(info) - 1));
         
-        if (strncmp(g_serialBuffer, "text:", 5) == 0) {
-            speak(g_serialBuffer + 5);
+        // 再生時と同じ計算でチャンクごとの口のレベルを出す
+        static uint8_t levels[MAX_AUDIO_BUFFER_SIZE / PLAYBACK_CHUNK_SAMPLES + 1];
+        size_t levelCount = 0;
+        for (size_t pos = 0; pos < u.samples; pos += PLAYBACK_CHUNK_SAMPLES) {
+            levels[levelCount++] = chunkLevel(&g_audioBuffer[pos], min((size_t)PLAYBACK_CHUNK_SAMPLES, (size_t)u.samples - pos));
         }
-        else if (strncmp(g_serialBuffer, "volume:", 7) == 0) {
-            int vol = atoi(g_serialBuffer + 7);
-            if (vol >= 0 && vol <= 100) {
-                g_volume = vol;
-                M5.Speaker.setVolume(vol);
-                Serial.printf("[VOLUME] Set to %d\n", vol);
-            }
+        for (size_t i = 0; i < levelCount; i += DATA_BYTES_PER_FRAME) {
+            BinaryProtocol::send(REPLY_DUMP_LEVELS, requestId, levels + i, min(DATA_BYTES_PER_FRAME, levelCount - i));
         }
-        else if (strncmp(g_serialBuffer, "rate:", 5) == 0) {
-            int rate = atoi(g_serialBuffer + 5);
-            if (rate >= 80 && rate <= 450) {
-                g_rate = rate;
-                espeak.setRate(rate);
-                Serial.printf("[RATE] Set to %d wpm\n", rate);
+        
+        uint8_t header[WAV_HEADER_SIZE];
+        makeWavHeader(header, u.samples);
+        const uint8_t* pcm = (const uint8_t*)g_audioBuffer;
+        uint32_t total = WAV_HEADER_SIZE + u.samples * sizeof(int16_t);
+        uint8_t frame[4 + DATA_BYTES_PER_FRAME];
+        uint16_t crc = 0xFFFF;
+        uint32_t start = millis();
+        for (uint32_t offset = 0; offset < total; offset += DATA_BYTES_PER_FRAME) {
+            size_t len = min((size_t)DATA_BYTES_PER_FRAME, (size_t)(total - offset));
+            writeLE(frame, offset, 4);
+            for (size_t i = 0; i < len; i++) {
+                uint32_t at = offset + i;
+                frame[4 + i] = at < WAV_HEADER_SIZE ? header[at] : pcm[at - WAV_HEADER_SIZE];
             }
+            crc = crc16(frame + 4, len, crc);
+            BinaryProtocol::send(REPLY_DUMP_DATA, requestId, frame, 4 + len);
+            esp_task_wdt_reset();
         }
-        else if (strncmp(g_serialBuffer, "pitch:", 6) == 0) {
-            int pitch = atoi(g_serialBuffer + 6);
-            if (pitch >= 0 && pitch <= 99) {
-                g_pitch = pitch;
-                espeak.setPitch(pitch);
-                Serial.printf("[PITCH] Set to %d\n", pitch);
-            }
+        uint8_t endBody[6];
+        writeLE(endBody, total, 4);
+        writeLE(endBody + 4, crc, 2);
+        BinaryProtocol::send(REPLY_DUMP_END, requestId, endBody, sizeof(endBody));
+        LOG_I("DUMP", "Sent %u bytes in %u ms", total, millis() - start);
+        return true;
+    }
+}
+
+// ===== PCM Stream =====
+// ホストから届く16bitモノラルPCMをジッタバッファ経由でM5.Speakerに流す。
+// 受信タスクが書き込み、再生タスクが読み出す（単一生産者・単一消費者）。
+namespace PcmStream {
+    static int16_t* g_ring = nullptr;  // PSRAM
+    static std::atomic<size_t> g_head(0);
+    static std::atomic<size_t> g_tail(0);
+    static int16_t g_playback[PCM_PLAYBACK_BUFFERS][PLAYBACK_CHUNK_SAMPLES];
+    static TaskHandle_t g_playoutTask = nullptr;
+    static volatile bool g_active = false;
+    static volatile bool g_ending = false;
+    static uint32_t g_sampleRate = AUDIO_SAMPLE_RATE;
+
+    struct Stats {
+        uint32_t receivedSamples;
+        uint32_t playedSamples;
+        uint32_t startMillis;
+        uint32_t lastMillis;
+        uint32_t underruns;
+        uint32_t rejectedFrames;  // バッファ満杯でBUSYを返した回数
+        size_t maxDepth;
+        size_t minDepth;          // 再生開始後の最小値
+    };
+    static Stats g_stats = {};
+
+    static size_t depth() {
+        return (g_head.load() + PCM_BUFFER_SAMPLES - g_tail.load()) % PCM_BUFFER_SAMPLES;
+    }
+
+    static float depthMs(size_t samples) {
+        return samples * 1000.0f / g_sampleRate;
+    }
+
+    static bool begin(uint32_t sampleRate) {
+        if (g_ring == nullptr || g_playoutTask == nullptr || g_active || sampleRate < 8000 || sampleRate > 48000) {
+            return false;
         }
-        else if (strncmp(g_serialBuffer, "internal_volume:", 16) == 0) {
-            int vol = atoi(g_serialBuffer + 16);
-            if (vol >= 0 && vol <= 200) {
-                g_volume_internal = vol;
-                espeak.setVolume(vol);
-                Serial.printf("[INTERNAL_VOLUME] Set to %d\n", vol);
-            }
+        // speak()と同時に鳴らさない
+        if (!claimSpeaker()) {
+            return false;
         }
-        else if (strncmp(g_serialBuffer, "pitch_range:", 12) == 0) {
-            int range = atoi(g_serialBuffer + 12);
-            if (range >= 0 && range <= 100) {
-                g_pitchRange = range;
-                espeak.setPitchRange(range);
-                Serial.printf("[PITCH_RANGE] Set to %d\n", range);
-            }
+        g_sampleRate = sampleRate;
+        g_head = 0;
+        g_tail = 0;
+        g_stats = {};
+        g_stats.startMillis = millis();
+        g_stats.lastMillis = g_stats.startMillis;
+        g_stats.minDepth = PCM_BUFFER_SAMPLES;
+        g_ending = false;
+        g_active = true;
+        xTaskNotifyGive(g_playoutTask);
+        LOG_I("PCM", "Stream started at %u Hz", sampleRate);
+        return true;
+    }
+
+    // little-endianのサンプル列を書き込む。入りきらない場合は何も書かずにfalse
+    static bool write(const uint8_t* data, size_t len) {
+        if (!g_active || g_ending) {
+            return false;
         }
-        else if (strcmp(g_serialBuffer, "display_on") == 0) {
-            g_displayEnabled = true;
-            Serial.println("[DISPLAY] Enabled");
+        size_t samples = len / sizeof(int16_t);
+        if (samples > PCM_BUFFER_SAMPLES - 1 - depth()) {
+            g_stats.rejectedFrames++;
+            return false;
         }
-        else if (strcmp(g_serialBuffer, "display_off") == 0) {
+        size_t head = g_head.load();
+        for (size_t i = 0; i < samples; i++) {
+            g_ring[head] = data[i * 2] | (data[i * 2 + 1] << 8);
+            head = (head + 1) % PCM_BUFFER_SAMPLES;
+        }
+        g_head.store(head);
+        g_stats.receivedSamples += samples;
+        g_stats.lastMillis = millis();
+        size_t d = depth();
+        if (d > g_stats.maxDepth) g_stats.maxDepth = d;
+        return true;
+    }
+
+    static void end() {
+        if (g_active) {
+            g_ending = true;
+        }
+    }
+
+    // 供給待ちの間に呼ぶ。ホストが切断してPCM_ENDが来なくても、
+    // end()と同じく残りを再生して終わり、スピーカーを解放する
+    static bool checkIdle() {
+        if (g_ending || millis() - g_stats.lastMillis <= PCM_IDLE_TIMEOUT_MS) {
+            return false;
+        }
+        LOG_W("PCM", "No data for %u ms, ending the stream", PCM_IDLE_TIMEOUT_MS);
+        g_ending = true;
+        return true;
+    }
+
+    static void printStats() {
+        uint32_t elapsed = (g_stats.lastMillis > g_stats.startMillis) ? g_stats.lastMillis - g_stats.startMillis : 0;
+        Serial.printf("\n[PCM] Stream Statistics (%s):\n", g_active ? "active" : "idle");
+        Serial.printf("  Sample rate: %u Hz\n", g_sampleRate);
+        Serial.printf("  Received: %u samples, played: %u samples\n",
+                     g_stats.receivedSamples, g_stats.playedSamples);
+        Serial.printf("  Sustained input: %.1f KB/s (%.2fx realtime)\n",
+                     elapsed ? g_stats.receivedSamples * 2.0f / elapsed : 0.0f,
+                     elapsed ? g_stats.receivedSamples * 1000.0f / elapsed / g_sampleRate : 0.0f);
+        Serial.printf("  Buffer depth: now %.0f ms, min %.0f ms, max %.0f ms (capacity %.0f ms)\n",
+                     depthMs(depth()),
+                     depthMs(g_stats.minDepth == PCM_BUFFER_SAMPLES ? 0 : g_stats.minDepth),
+                     depthMs(g_stats.maxDepth), depthMs(PCM_BUFFER_SAMPLES - 1));
+        Serial.printf("  Underruns: %u, rejected frames: %u\n", g_stats.underruns, g_stats.rejectedFrames);
+        Serial.println("==========================\n");
+    }
+
+    static void playoutTask(void* args) {
+        for (;;) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            HeapScope heapScope(HeapTag::Audio);
+            
+            avatar.setExpression(Expression::Happy);
+            BinaryProtocol::sendEvent(BinaryProtocol::EVENT_SPEECH_STARTED);
+            SpeakerMonitor::begin();
+            size_t prefill = g_sampleRate * PCM_PREFILL_MS / 1000;
+            bool playing = false;
+            int slot = 0;
+            
+            while (true) {
+                size_t available = depth();
+                if (!playing) {
+                    // 規定量溜まるまで（または終端まで）待ってから再生を始める
+                    if (available < prefill && !g_ending) {
+                        checkIdle();
+                        vTaskDelay(pdMS_TO_TICKS(5));
+                        continue;
+                    }
+                    playing = true;
+                }
+                if (available == 0 && g_ending) {
+                    break;
+                }
+                if (available < PLAYBACK_CHUNK_SAMPLES && !g_ending) {
+                    if (checkIdle()) {
+                        continue;
+                    }
+                    if (M5.Speaker.isPlaying(0) == 0) {
+                        // 供給が追いつかず再生が止まった: 溜め直す
+                        g_stats.underruns++;
+                        SpeakerMonitor::underrun();
+                        playing = false;
+                        avatar.setMouthOpenRatio(0.0f);
+                    } else {
+                        vTaskDelay(pdMS_TO_TICKS(2));
+                    }
+                    continue;
+                }
+                if (available < g_stats.minDepth) g_stats.minDepth = available;
+                
+                size_t count = min(available, (size_t)PLAYBACK_CHUNK_SAMPLES);
+                size_t tail = g_tail.load();
+                int16_t* chunk = g_playback[slot];
+                for (size_t i = 0; i < count; i++) {
+                    chunk[i] = g_ring[tail];
+                    tail = (tail + 1) % PCM_BUFFER_SAMPLES;
+                }
+                g_tail.store(tail);
+                
+                updateMouth(chunk, count);
+                // キューが埋まっている間はここで待たされるので、これが再生ペースになる
+                SpeakerMonitor::sample();
+                TRACE_BEGIN("audio.play_raw");
+                M5.Speaker.playRaw(chunk, count, g_sampleRate, false, 1, 0);
+                TRACE_END("audio.play_raw");
+                g_stats.playedSamples += count;
+                slot = (slot + 1) % PCM_PLAYBACK_BUFFERS;
+            }
+            
+            while (M5.Speaker.isPlaying(0)) {
+                vTaskDelay(pdMS_TO_TICKS(5));
+            }
+            SpeakerMonitor::end();
+            avatar.setMouthOpenRatio(0.0f);
+            avatar.setExpression(g_restExpression);
+            g_currentLevel = 0;
+            g_active = false;
+            releaseSpeaker();
+            BinaryProtocol::sendEvent(BinaryProtocol::EVENT_SPEECH_FINISHED);
+            LOG_I("PCM", "Stream finished: %u samples, %u underruns",
+                  g_stats.playedSamples, g_stats.underruns);
+        }
+    }
+
+    static bool setup() {
+        g_ring = (int16_t*)ps_malloc(PCM_BUFFER_SAMPLES * sizeof(int16_t));
+        if (!g_ring) {
+            LOG_E("PCM", "Failed to allocate PCM buffer in PSRAM");
+            return false;
+        }
+        xTaskCreatePinnedToCore(playoutTask, "pcmPlayout", 4096, NULL,
+                                TaskPriority::SYNTHESIS, &g_playoutTask, PRO_CPU_NUM);
+        return true;
+    }
+}
+
+// ===== Telemetry =====
+// 一定間隔で実行時の統計をREPLY_TELEMETRYフレームとして送る（0で停止）。
+// テキストの整形をしないので、負荷をかけたままホスト側で長時間記録できる。
+// レコードはリトルエンディアンで Record + taskCount x TaskRecord。
+// デコーダは tools/stackchan_serial.py telemetry (CSV出力)。
+namespace Telemetry {
+    constexpr uint8_t RECORD_VERSION = 1;
+    constexpr uint32_t MIN_INTERVAL_MS = 20;
+    constexpr size_t MAX_TASKS = 24;
+    constexpr size_t TASK_NAME_LENGTH = 8;
+    constexpr uint16_t CPU_UNAVAILABLE = 0xFFFF;
+
+    struct __attribute__((packed)) Record {
+        uint8_t version;
+        uint32_t sequence;
+        uint32_t millis;
+        uint32_t heapFree;
+        uint32_t heapMinFree;
+        uint32_t heapLargest;
+        uint32_t psramFree;
+        uint32_t psramLargest;
+        uint16_t fpsX10;
+        uint32_t frameMicros;
+        uint32_t maxFrameMicros;
+        uint8_t speaking;
+        uint8_t shedLevel;
+        uint16_t synthRealtimeX1000;  // 直前の発話の合成時間 / 音声長
+        uint32_t pcmBufferedSamples;
+        uint8_t speakerQueued;        // M5.Speakerのチャンネル0に積まれているバッファ数
+        uint32_t audioUnderruns;
+        uint8_t taskCount;
+    };
+
+    struct __attribute__((packed)) TaskRecord {
+        char name[TASK_NAME_LENGTH];
+        uint16_t cpuPermille;         // 両コア合計に対する割合。実行時間統計が無効ならCPU_UNAVAILABLE
+        uint32_t stackFreeBytes;      // スタックの最小空き
+    };
+
+    static volatile uint32_t g_intervalMs = 0;
+    static TaskHandle_t g_task = nullptr;
+
+#if configUSE_TRACE_FACILITY
+    static TaskStatus_t g_taskStatus[MAX_TASKS];
+#if configGENERATE_RUN_TIME_STATS
+    // 前回のレコード時点のタスク別実行時間（差分でCPU使用率を出す）
+    static TaskHandle_t g_lastHandles[MAX_TASKS];
+    static uint32_t g_lastRunTime[MAX_TASKS];
+    static size_t g_lastCount = 0;
+
+    static uint32_t previousRunTime(TaskHandle_t handle) {
+        for (size_t i = 0; i < g_lastCount; i++) {
+            if (g_lastHandles[i] == handle) return g_lastRunTime[i];
+        }
+        return 0;
+    }
+#endif
+
+    static size_t appendTasks(uint8_t* out, size_t capacity) {
+        UBaseType_t count = uxTaskGetSystemState(g_taskStatus, MAX_TASKS, nullptr);
+        count = min((size_t)count, capacity / sizeof(TaskRecord));
+#if configGENERATE_RUN_TIME_STATS
+        uint32_t elapsed[MAX_TASKS];
+        uint64_t total = 0;
+        for (UBaseType_t i = 0; i < count; i++) {
+            elapsed[i] = g_taskStatus[i].ulRunTimeCounter - previousRunTime(g_taskStatus[i].xHandle);
+            total += elapsed[i];
+        }
+#endif
+        for (UBaseType_t i = 0; i < count; i++) {
+            TaskRecord task = {};
+            strncpy(task.name, g_taskStatus[i].pcTaskName, TASK_NAME_LENGTH);
+#if configGENERATE_RUN_TIME_STATS
+            task.cpuPermille = total ? elapsed[i] * 1000ULL / total : 0;
+            g_lastHandles[i] = g_taskStatus[i].xHandle;
+            g_lastRunTime[i] = g_taskStatus[i].ulRunTimeCounter;
+#else
+            task.cpuPermille = CPU_UNAVAILABLE;
+#endif
+            task.stackFreeBytes = g_taskStatus[i].usStackHighWaterMark;  // ESP-IDFではバイト単位
+            memcpy(out + i * sizeof(TaskRecord), &task, sizeof(task));
+        }
+#if configGENERATE_RUN_TIME_STATS
+        g_lastCount = count;
+#endif
+        return count;
+    }
+#else
+    static size_t appendTasks(uint8_t* out, size_t capacity) {
+        return 0;
+    }
+#endif
+
+    static void sendRecord(uint32_t sequence, uint32_t elapsedMs) {
+        static uint8_t body[BinaryProtocol::MAX_PAYLOAD - BinaryProtocol::HEADER_SIZE - BinaryProtocol::CRC_SIZE];
+        static uint32_t lastFrames = 0;
+        
+        FrameStats frames = avatar.getFrameStats();
+        // renderコマンドで統計がリセットされた場合はその後のフレーム数を使う
+        uint32_t newFrames = frames.frames >= lastFrames ? frames.frames - lastFrames : frames.frames;
+        lastFrames = frames.frames;
+        
+        Record record = {};
+        record.version = RECORD_VERSION;
+        record.sequence = sequence;
+        record.millis = millis();
+        record.heapFree = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+        record.heapMinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+        record.heapLargest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+        record.psramFree = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+        record.psramLargest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+        record.fpsX10 = elapsedMs ? newFrames * 10000 / elapsedMs : 0;
+        record.frameMicros = frames.lastFrameMicros;
+        record.maxFrameMicros = frames.maxFrameMicros;
+        record.speaking = g_isSpeaking;
+        record.shedLevel = frames.shedLevel;
+        if (g_lastUtterance.samples > 0) {
+            record.synthRealtimeX1000 = min(g_lastUtterance.synthMicros / 1000ULL * AUDIO_SAMPLE_RATE / g_lastUtterance.samples,
+                                            (unsigned long long)UINT16_MAX);
+        }
+        record.pcmBufferedSamples = PcmStream::depth();
+        record.speakerQueued = M5.Speaker.isPlaying(0);
+        record.audioUnderruns = g_audioUnderruns + PcmStream::g_stats.underruns;
+        
+        record.taskCount = appendTasks(body + sizeof(record), sizeof(body) - sizeof(record));
+        memcpy(body, &record, sizeof(record));
+        BinaryProtocol::send(BinaryProtocol::REPLY_TELEMETRY, 0, body,
+                             sizeof(record) + record.taskCount * sizeof(TaskRecord));
+    }
+
+    // テレメトリレコードに続けて全メトリクスを送る（入りきらなければ複数フレームに分ける）。
+    // 各メトリクス: [種類 (u8)][名前の長さ (u8)][名前]
+    //   カウンタ・ゲージ: [値 (i32)]
+    //   ヒストグラム: [件数 (u32)][合計us (u32)][最大us (u32)][HISTOGRAM_BUCKETS x 件数 (u32)]
+    static void sendMetrics(uint32_t sequence) {
+        static uint8_t body[BinaryProtocol::MAX_PAYLOAD - BinaryProtocol::HEADER_SIZE - BinaryProtocol::CRC_SIZE];
+        AppMetrics::updateGauges();
+        memcpy(body, &sequence, sizeof(sequence));
+        size_t len = sizeof(sequence);
+        for (uint8_t id = 0; id < metrics.size(); id++) {
+            MetricSnapshot m = metrics.read(id);
+            size_t nameLen = min(strlen(m.name), (size_t)UINT8_MAX);
+            size_t valueLen = m.type == MetricType::Histogram ? (3 + HISTOGRAM_BUCKETS) * sizeof(uint32_t) : sizeof(int32_t);
+            size_t size = 2 + nameLen + valueLen;
+            if (len + size > sizeof(body)) {
+                BinaryProtocol::send(BinaryProtocol::REPLY_METRICS, 0, body, len);
+                len = sizeof(sequence);
+            }
+            body[len++] = (uint8_t)m.type;
+            body[len++] = nameLen;
+            memcpy(body + len, m.name, nameLen);
+            len += nameLen;
+            if (m.type == MetricType::Histogram) {
+                uint32_t values[3] = {m.count, m.sumMicros, m.maxMicros};
+                memcpy(body + len, values, sizeof(values));
+                memcpy(body + len + sizeof(values), m.buckets, sizeof(m.buckets));
+            } else {
+                memcpy(body + len, &m.value, sizeof(m.value));
+            }
+            len += valueLen;
+        }
+        BinaryProtocol::send(BinaryProtocol::REPLY_METRICS, 0, body, len);
+    }
+
+    static void telemetryTask(void* param) {
+        uint32_t sequence = 0;
+        for (;;) {
+            if (g_intervalMs == 0) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                continue;
+            }
+            TickType_t wake = xTaskGetTickCount();
+            uint32_t last = millis();
+            while (g_intervalMs != 0) {
+                // 間隔が変わったら通知で起こされる
+                if (ulTaskNotifyTake(pdTRUE, 0) == 0) {
+                    vTaskDelayUntil(&wake, pdMS_TO_TICKS(g_intervalMs));
+                }
+                if (g_intervalMs == 0) break;
+                uint32_t now = millis();
+                sendRecord(sequence, now - last);
+                sendMetrics(sequence++);
+                last = now;
+            }
+        }
+    }
+
+    static bool setInterval(uint32_t intervalMs) {
+        if (g_task == nullptr || (intervalMs != 0 && intervalMs < MIN_INTERVAL_MS)) {
+            return false;
+        }
+        g_intervalMs = intervalMs;
+        xTaskNotifyGive(g_task);
+        LOG_I("TELEMETRY", "Interval %u ms (0: stopped)", intervalMs);
+        return true;
+    }
+
+    static void setup() {
+        xTaskCreatePinnedToCore(telemetryTask, "telemetry", 4096, NULL,
+                                TaskPriority::CONTROL, &g_task, PRO_CPU_NUM);
+    }
+}
+
+// ===== Input Recorder =====
+// 受信したコマンド行・バイナリフレームとボタン入力を時刻付きでPSRAMのリングに記録し、
+// 同じ間隔で再注入する（現場で起きた性能問題を再現可能なベンチマークにするため）。
+// エントリ: [前のエントリからの経過 (u32 LE, us)][種類 (u8)][長さ (u16 LE)][データ]
+// 満杯になると古いエントリから捨てる。record_dumpでエントリ列をそのまま送る。
+// ホスト側からの再生は tools/stackchan_serial.py replay を参照。
+namespace Recorder {
+    enum EntryType : uint8_t {
+        ENTRY_LINE = 1,    // ASCIIコマンド行（改行なし）
+        ENTRY_FRAME = 2,   // COBSエンコードされたままのバイナリフレーム（区切りの0x00なし）
+        ENTRY_BUTTON = 3,  // ボタンA
+    };
+
+    struct Entry {
+        uint32_t deltaMicros;
+        uint8_t type;
+        uint16_t length;
+    };
+    constexpr size_t ENTRY_HEADER_SIZE = 7;
+    constexpr size_t MAX_ENTRY_LENGTH = BINARY_FRAME_SIZE;
+
+    static uint8_t* g_ring = nullptr;  // PSRAM
+    static size_t g_head = 0;
+    static size_t g_tail = 0;
+    static size_t g_used = 0;
+    static uint32_t g_entries = 0;
+    static uint32_t g_evicted = 0;     // 満杯で捨てた古いエントリ数
+    static uint32_t g_startMillis = 0;
+    static uint32_t g_lastMicros = 0;
+    static volatile bool g_recording = false;
+    // 受信タスクとloop(ボタン)の両方から書き込む
+    static StaticSemaphore_t g_lockBuffer;
+    static SemaphoreHandle_t g_lock = xSemaphoreCreateMutexStatic(&g_lockBuffer);
+
+    // 再生（受信タスクで進める）
+    static volatile bool g_replaying = false;
+    static size_t g_replayPos = 0;        // g_tailからのオフセット
+    static uint32_t g_replayIndex = 0;
+    static uint32_t g_replayDueMicros = 0;  // 次のエントリを注入する時刻
+    static std::atomic<uint32_t> g_pendingButtonPresses(0);
+
+    static void copyIn(const uint8_t* data, size_t len) {
+        if (len == 0) return;
+        size_t first = min(len, (size_t)RECORD_BUFFER_SIZE - g_head);
+        memcpy(g_ring + g_head, data, first);
+        memcpy(g_ring, data + first, len - first);
+        g_head = (g_head + len) % RECORD_BUFFER_SIZE;
+        g_used += len;
+    }
+
+    static void copyOut(size_t offset, uint8_t* out, size_t len) {
+        size_t pos = (g_tail + offset) % RECORD_BUFFER_SIZE;
+        size_t first = min(len, (size_t)RECORD_BUFFER_SIZE - pos);
+        memcpy(out, g_ring + pos, first);
+        memcpy(out + first, g_ring, len - first);
+    }
+
+    static Entry readEntry(size_t offset) {
+        uint8_t header[ENTRY_HEADER_SIZE];
+        copyOut(offset, header, sizeof(header));
+        Entry entry;
+        entry.deltaMicros = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+        entry.type = header[4];
+        entry.length = header[5] | (header[6] << 8);
+        return entry;
+    }
+
+    static void dropOldest() {
+        size_t size = ENTRY_HEADER_SIZE + readEntry(0).length;
+        g_tail = (g_tail + size) % RECORD_BUFFER_SIZE;
+        g_used -= size;
+        g_entries--;
+        g_evicted++;
+    }
+
+    static void record(EntryType type, uint32_t arrivalMicros, const uint8_t* data, size_t len) {
+        if (!g_recording || g_ring == nullptr || len > MAX_ENTRY_LENGTH) {
+            return;
+        }
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        if (g_recording) {
+            while (g_used + ENTRY_HEADER_SIZE + len > RECORD_BUFFER_SIZE) {
+                dropOldest();
+            }
+            uint8_t header[ENTRY_HEADER_SIZE];
+            AudioDump::writeLE(header, arrivalMicros - g_lastMicros, 4);
+            header[4] = type;
+            AudioDump::writeLE(header + 5, len, 2);
+            g_lastMicros = arrivalMicros;
+            copyIn(header, sizeof(header));
+            copyIn(data, len);
+            g_entries++;
+        }
+        xSemaphoreGive(g_lock);
+    }
+
+    // 記録・再生の操作自体は記録しない（再生すると再帰するため）
+    static void recordLine(const char* line, size_t len, uint32_t arrivalMicros) {
+        if (strncmp(line, "record", 6) == 0 || strncmp(line, "replay", 6) == 0) {
+            return;
+        }
+        record(ENTRY_LINE, arrivalMicros, (const uint8_t*)line, len);
+    }
+
+    static void recordButton() {
+        record(ENTRY_BUTTON, micros(), nullptr, 0);
+    }
+
+    // 再生されたボタン入力（loopで実際の押下と同じように処理する）
+    static bool takeButtonPress() {
+        uint32_t pending = g_pendingButtonPresses.load();
+        while (pending > 0 && !g_pendingButtonPresses.compare_exchange_weak(pending, pending - 1)) {
+        }
+        return pending > 0;
+    }
+
+    static bool start() {
+        if (g_ring == nullptr || g_replaying) {
+            return false;
+        }
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        g_head = 0;
+        g_tail = 0;
+        g_used = 0;
+        g_entries = 0;
+        g_evicted = 0;
+        g_startMillis = millis();
+        g_lastMicros = micros();
+        g_recording = true;
+        xSemaphoreGive(g_lock);
+        return true;
+    }
+
+    static void stop() {
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        g_recording = false;
+        xSemaphoreGive(g_lock);
+    }
+
+    static bool startReplay() {
+        if (g_recording || g_replaying || g_entries == 0) {
+            return false;
+        }
+        g_replayPos = 0;
+        g_replayIndex = 0;
+        g_replayDueMicros = micros();  // 最初のエントリはすぐに注入する
+        g_replaying = true;
+        LOG_I("REPLAY", "Replaying %u entries", g_entries);
+        return true;
+    }
+
+    static void stopReplay() {
+        g_replaying = false;
+    }
+
+    // 受信タスクから呼ぶ。注入時刻になったエントリを1つ取り出す。
+    // 取り出せなければfalseを返し、*waitを次のエントリまでの時間に縮める。
+    static bool nextReplayEntry(Entry* entry, uint8_t* data, TickType_t* wait) {
+        if (!g_replaying) {
+            return false;
+        }
+        if (g_replayIndex >= g_entries) {
+            g_replaying = false;
+            LOG_I("REPLAY", "Replay finished");
+            return false;
+        }
+        uint32_t now = micros();
+        int32_t remaining = (int32_t)(g_replayDueMicros - now);
+        if (remaining > 0) {
+            *wait = min(*wait, pdMS_TO_TICKS((remaining + 999) / 1000));
+            return false;
+        }
+        *entry = readEntry(g_replayPos);
+        copyOut(g_replayPos + ENTRY_HEADER_SIZE, data, entry->length);
+        g_replayPos += ENTRY_HEADER_SIZE + entry->length;
+        g_replayIndex++;
+        if (g_replayIndex < g_entries) {
+            // 次のエントリの時刻は、記録時と同じ間隔を注入予定時刻に足して決める（遅れが累積しない）
+            g_replayDueMicros += readEntry(g_replayPos).deltaMicros;
+        }
+        return true;
+    }
+
+    // 記録を止めてから、エントリ列をREPLY_RECORD_DATA/ENDフレームで送る
+    static bool send(uint16_t requestId) {
+        if (g_ring == nullptr || g_replaying) {
+            return false;
+        }
+        stop();
+        constexpr size_t DATA_BYTES_PER_FRAME = 512;
+        uint8_t frame[4 + DATA_BYTES_PER_FRAME];
+        uint16_t crc = 0xFFFF;
+        for (size_t offset = 0; offset < g_used; offset += DATA_BYTES_PER_FRAME) {
+            size_t len = min(DATA_BYTES_PER_FRAME, g_used - offset);
+            AudioDump::writeLE(frame, offset, 4);
+            copyOut(offset, frame + 4, len);
+            crc = BinaryProtocol::crc16(frame + 4, len, crc);
+            BinaryProtocol::send(BinaryProtocol::REPLY_RECORD_DATA, requestId, frame, 4 + len);
+        }
+        uint8_t end[10];
+        AudioDump::writeLE(end, g_used, 4);
+        AudioDump::writeLE(end + 4, g_entries, 4);
+        AudioDump::writeLE(end + 8, crc, 2);
+        BinaryProtocol::send(BinaryProtocol::REPLY_RECORD_END, requestId, end, sizeof(end));
+        return true;
+    }
+
+    static void printStatus() {
+        Serial.printf("\n[RECORD] %s%s\n", g_recording ? "Recording" : "Stopped",
+                     g_replaying ? ", replaying" : "");
+        Serial.printf("  Entries: %u (%u oldest dropped), %u / %u bytes\n",
+                     g_entries, g_evicted, g_used, RECORD_BUFFER_SIZE);
+        if (g_recording) {
+            Serial.printf("  Recording for %.1f s\n", (millis() - g_startMillis) / 1000.0f);
+        }
+        if (g_replaying) {
+            Serial.printf("  Replayed %u / %u entries\n", g_replayIndex, g_entries);
+        }
+        Serial.println("==========================\n");
+    }
+
+    static bool setup() {
+        g_ring = (uint8_t*)ps_malloc(RECORD_BUFFER_SIZE);
+        if (!g_ring) {
+            LOG_E("RECORD", "Failed to allocate record buffer in PSRAM");
+            return false;
+        }
+        return true;
+    }
+}
+
+// ===== Trace =====
+// 合成・再生・描画・シリアル処理の開始/終了/瞬間イベントを、サイクルカウンタ・コア・タスク付きで
+// PSRAMのリング(m5avatar::trace)に記録する。trace_dumpで止めてから送り、
+// tools/stackchan_serial.py trace がChrome/Perfettoのトレース形式(JSON)に変換する。
+// INFO("key=value"行: 名前とタスクの表) × N → DATA(イベント) × N → END の順。
+namespace Tracing {
+    // DATAのイベント: [cycles u32][micros u32][name][task][core][phase]
+    constexpr size_t EVENT_SIZE = 12;
+    constexpr size_t EVENTS_PER_FRAME = 40;
+
+    // 行を溜め、フレームに収まらなくなったら先に送る
+    static void appendInfo(char* info, size_t& len, size_t capacity, const char* line, uint16_t requestId) {
+        size_t lineLen = strlen(line);
+        if (len > 0 && len + 1 + lineLen > capacity) {
+            BinaryProtocol::send(BinaryProtocol::REPLY_TRACE_INFO, requestId, (const uint8_t*)info, len);
+            len = 0;
+        }
+        if (len > 0) {
+            info[len++] = '\n';
+        }
+        lineLen = min(lineLen, capacity - len);
+        memcpy(info + len, line, lineLen);
+        len += lineLen;
+    }
+
+    // 記録を止めてから送る（送信中にリングが上書きされないように）
+    static bool send(uint16_t requestId) {
+        using namespace BinaryProtocol;
+        if (trace.getCapacity() == 0) {
+            return false;
+        }
+        trace.stop();
+        // 書き込み途中だったスロットが書き終わるのを待つ
+        delay(1);
+        
+        char info[MAX_PAYLOAD - HEADER_SIZE - CRC_SIZE];
+        size_t infoLen = 0;
+        char line[64];
+        snprintf(line, sizeof(line), "cpu_mhz=%u", getCpuFrequencyMhz());
+        appendInfo(info, infoLen, sizeof(info), line, requestId);
+        snprintf(line, sizeof(line), "dropped=%u", trace.getDropped());
+        appendInfo(info, infoLen, sizeof(info), line, requestId);
+        for (uint8_t i = 0; i < trace.getNameCount(); i++) {
+            snprintf(line, sizeof(line), "name.%u=%s", i, trace.getName(i));
+            appendInfo(info, infoLen, sizeof(info), line, requestId);
+        }
+        for (uint8_t i = 0; i < trace.getTaskCount(); i++) {
+            snprintf(line, sizeof(line), "task.%u=%s", i, trace.getTaskName(i));
+            appendInfo(info, infoLen, sizeof(info), line, requestId);
+        }
+        BinaryProtocol::send(REPLY_TRACE_INFO, requestId, (const uint8_t*)info, infoLen);
+        
+        uint8_t frame[4 + EVENTS_PER_FRAME * EVENT_SIZE];
+        uint16_t crc = 0xFFFF;
+        uint32_t sent = 0;
+        size_t count = 0;
+        TraceEvent event;
+        for (uint32_t i = 0; i < trace.size(); i++) {
+            if (!trace.read(i, &event)) {
+                continue;
+            }
+            if (count == 0) {
+                AudioDump::writeLE(frame, sent, 4);
+            }
+            uint8_t* e = frame + 4 + count * EVENT_SIZE;
+            AudioDump::writeLE(e, event.cycles, 4);
+            AudioDump::writeLE(e + 4, event.micros, 4);
+            e[8] = event.name;
+            e[9] = event.task;
+            e[10] = event.core;
+            e[11] = event.phase;
+            crc = crc16(e, EVENT_SIZE, crc);
+            sent++;
+            if (++count == EVENTS_PER_FRAME) {
+                BinaryProtocol::send(REPLY_TRACE_DATA, requestId, frame, 4 + count * EVENT_SIZE);
+                count = 0;
+            }
+        }
+        if (count > 0) {
+            BinaryProtocol::send(REPLY_TRACE_DATA, requestId, frame, 4 + count * EVENT_SIZE);
+        }
+        uint8_t end[6];
+        AudioDump::writeLE(end, sent, 4);
+        AudioDump::writeLE(end + 4, crc, 2);
+        BinaryProtocol::send(REPLY_TRACE_END, requestId, end, sizeof(end));
+        return true;
+    }
+
+    static void printStatus() {
+        Serial.printf("\n[TRACE] %s\n", trace.isRecording() ? "Recording" : "Stopped");
+        Serial.printf("  Events: %u / %u (%u oldest overwritten)\n",
+                     trace.size(), trace.getCapacity(), trace.getDropped());
+        Serial.printf("  Names: %u / %u, tasks: %u / %u\n",
+                     trace.getNameCount(), TRACE_NAMES, trace.getTaskCount(), TRACE_TASKS);
+        Serial.println("==========================\n");
+    }
+
+    static bool setup() {
+        if (!trace.begin()) {
+            LOG_E("TRACE", "Failed to allocate trace buffer");
+            return false;
+        }
+        return true;
+    }
+}
+
+// ===== Serial Command Processor =====
+namespace SerialProcessor {
+    static uint8_t g_frameBuffer[BINARY_FRAME_SIZE];
+    static size_t g_framePos = 0;
+    static bool g_inFrame = false;
+    static bool g_frameOverflow = false;
+
+    // 受信タスク: USB CDCの受信イベントで起床し、リングバッファに取り込んでから組み立てる
+    static TaskHandle_t g_rxTask = nullptr;
+    static uint8_t g_rxRing[RX_RING_SIZE];
+    static uint32_t g_rxArrival[RX_RING_SIZE];  // 各バイトをドライバから取り出した時刻
+    static size_t g_rxHead = 0;
+    static size_t g_rxTail = 0;
+    static uint32_t g_messageArrivalMicros = 0;  // 組み立て中の行/フレームの先頭バイトの到着時刻
+
+    // 発話は受信タスクを止めないようキュー経由で合成タスク(loop)に渡す
+    struct SpeechRequest {
+        char text[MAX_TEXT_LENGTH + 1];
+        uint32_t arrivalMicros;
+        uint32_t firstTokenMicros;  // ストリームの最初の節のみ0以外
+        bool dump;                  // 再生せずにWAVで出力する（textが空なら直前の発話）
+        uint16_t requestId;
+    };
+    static QueueHandle_t g_speechQueue = nullptr;
+
+    static LatencyStats g_commandLatency = {};  // 到着から即時コマンドの処理開始まで
+    static LatencyStats g_speechLatency = {};   // 到着から発話の合成開始まで
+    static uint32_t g_rxBytes = 0;
+    static uint32_t g_rxOverflows = 0;
+    static uint32_t g_speechDropped = 0;
+
+    // retryLater: 呼び出し側がテキストを保持して後で送り直すので、満杯でも破棄として数えない
+    static bool queueSpeech(const char* text, size_t len,
+                            uint32_t firstTokenMicros = 0, bool retryLater = false) {
+        SpeechRequest request;
+        len = min(len, (size_t)MAX_TEXT_LENGTH);
+        memcpy(request.text, text, len);
+        request.text[len] = '\0';
+        request.arrivalMicros = g_messageArrivalMicros;
+        request.firstTokenMicros = firstTokenMicros;
+        request.dump = false;
+        request.requestId = 0;
+        if (g_speechQueue == nullptr || xQueueSend(g_speechQueue, &request, 0) != pdTRUE) {
+            if (!retryLater) {
+                g_speechDropped++;
+                serialReply("[BUSY] Speech queue full");
+            }
+            return false;
+        }
+        metrics.set(AppMetrics::speechQueue, uxQueueMessagesWaiting(g_speechQueue));
+        TRACE_INSTANT("speech.queued");
+        return true;
+    }
+
+    // g_audioBufferに触るので、dumpも合成タスクで順番に処理する
+    static bool queueDump(const char* text, size_t len, uint16_t requestId) {
+        SpeechRequest request = {};
+        len = min(len, (size_t)MAX_TEXT_LENGTH);
+        memcpy(request.text, text, len);
+        request.text[len] = '\0';
+        request.arrivalMicros = g_messageArrivalMicros;
+        request.dump = true;
+        request.requestId = requestId;
+        return g_speechQueue != nullptr && xQueueSend(g_speechQueue, &request, 0) == pdTRUE;
+    }
+
+    // loop()から呼ばれ、キューに発話があれば合成・再生する。
+    // PCMストリームがスピーカーを使っている間は取り出さず、キューに残して待たせる
+    static void dispatchSpeech(uint32_t waitMs) {
+        static SpeechRequest request;
+        if (g_speechQueue == nullptr) {
+            delay(waitMs);
+            return;
+        }
+        if (xQueuePeek(g_speechQueue, &request, pdMS_TO_TICKS(waitMs)) != pdTRUE) {
+            return;
+        }
+        if (!g_systemReady || !claimSpeaker()) {
+            delay(waitMs);
+            return;
+        }
+        // 取り出すのはloop()だけなので、先頭はPeekしたものと同じ
+        if (xQueueReceive(g_speechQueue, &request, 0) == pdTRUE) {
+            if (request.dump) {
+                bool ok = true;
+                if (request.text[0] != '\0') {
+                    ok = synthesize(request.text);
+                }
+                releaseSpeaker();
+                if (!ok || !AudioDump::send(request.requestId)) {
+                    BinaryProtocol::sendAck(request.requestId, BinaryProtocol::STATUS_FAILED);
+                }
+                g_controlDeadline.restart();
+                return;
+            }
+            uint32_t waited = micros() - request.arrivalMicros;
+            g_speechLatency.add(waited);
+            metrics.record(AppMetrics::speechWaitMicros, waited);
+            metrics.set(AppMetrics::speechQueue, uxQueueMessagesWaiting(g_speechQueue));
+            if (request.firstTokenMicros != 0) {
+                g_streamFirstTokenMicros = request.firstTokenMicros;
+            }
+            speakClaimed(request.text);
+        } else {
+            releaseSpeaker();
+        }
+    }
+
+    // ===== Text Streaming =====
+    // LLMのトークン出力を受け取り、節が完成するたびに合成キューへ送る。
+    // 受信タスクで動くので待たない: キューが満杯なら節をバッファに残し、
+    // 次のチャンク・ストリーム終端・受信タスクの周期処理(retryStream)で送り直す
+    static char g_streamText[STREAM_BUFFER_SIZE];
+    static size_t g_streamLen = 0;
+    static bool g_streaming = false;         // falseでg_streamLen > 0なら終端済みで送信待ち
+    static uint32_t g_streamFirstToken = 0;  // 最初の節を送るまで保持する
+    static uint32_t g_streamClauses = 0;
+
+    // 句点の直前の語が略語か（e.g. / i.e. / U.S. のように語中に'.'がある、または敬称）
+    static bool isAbbreviation(size_t dot) {
+        static const char* const TITLES[] = {"Mr", "Mrs", "Ms", "Dr", "Prof", "St", "vs"};
+        size_t start = dot;
+        while (start > 0 && !isspace((uint8_t)g_streamText[start - 1])) {
+            start--;
+        }
+        size_t len = dot - start;
+        if (memchr(g_streamText + start, '.', len) != nullptr) {
+            return true;
+        }
+        for (const char* title : TITLES) {
+            if (strlen(title) == len && strncmp(g_streamText + start, title, len) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 先頭から完成している節の長さを返す（無ければ0）。節はMAX_TEXT_LENGTH以下
+    static size_t findClauseEnd(bool final) {
+        size_t limit = min(g_streamLen, (size_t)MAX_TEXT_LENGTH);
+        for (size_t i = 0; i < limit; i++) {
+            char c = g_streamText[i];
+            if (c == '\n') {
+                return i + 1;
+            }
+            // 3.14 のような小数で切らないよう、後ろに空白が来てから確定する
+            bool followedBySpace = i + 1 < g_streamLen && isspace((uint8_t)g_streamText[i + 1]);
+            bool atEnd = final && i + 1 == g_streamLen;
+            if (!followedBySpace && !atEnd) {
+                continue;
+            }
+            if (c == '.' && !atEnd && isAbbreviation(i)) {
+                continue;
+            }
+            if (c == '.' || c == '!' || c == '?') {
+                return i + 1;
+            }
+            if ((c == ',' || c == ';' || c == ':') && i + 1 >= STREAM_MIN_CLAUSE_CHARS) {
+                return i + 1;
+            }
+        }
+        // 区切りが来ないまま1節の上限を超えたら、上限内の最後の空白で切る。
+        // 空白がなければUTF-8の文字の途中で切らないよう、次の文字の先頭バイトまで戻す
+        if (g_streamLen > MAX_TEXT_LENGTH) {
+            for (size_t i = MAX_TEXT_LENGTH; i > 0; i--) {
+                if (isspace((uint8_t)g_streamText[i - 1])) {
+                    return i;
+                }
+            }
+            size_t cut = MAX_TEXT_LENGTH;
+            while (cut > 0 && ((uint8_t)g_streamText[cut] & 0xC0) == 0x80) {
+                cut--;
+            }
+            return cut > 0 ? cut : MAX_TEXT_LENGTH;
+        }
+        if (final) {
+            return g_streamLen;
+        }
+        return 0;
+    }
+
+    // 送れた節をバッファから除く。キューが満杯になったら残りを保持して戻る
+    static void flushClauses(bool final) {
+        size_t end;
+        while (g_streamLen > 0 && (end = findClauseEnd(final)) > 0) {
+            size_t start = 0;
+            while (start < end && isspace((uint8_t)g_streamText[start])) {
+                start++;
+            }
+            size_t stop = end;
+            while (stop > start && isspace((uint8_t)g_streamText[stop - 1])) {
+                stop--;
+            }
+            if (stop > start) {
+                if (!queueSpeech(g_streamText + start, stop - start, g_streamFirstToken, true)) {
+                    return;
+                }
+                g_streamFirstToken = 0;
+                g_streamClauses++;
+            }
+            memmove(g_streamText, g_streamText + end, g_streamLen - end);
+            g_streamLen -= end;
+        }
+    }
+
+    // 受信タスクの周期処理: 合成が進んでキューが空いたら保持している節を送る
+    static void retryStream() {
+        if (g_streamLen > 0) {
+            flushClauses(!g_streaming);
+        }
+    }
+
+    // 前のストリームの節がまだ送れていなければfalse（BUSY）
+    static bool streamBegin() {
+        retryStream();
+        if (!g_streaming && g_streamLen > 0) {
+            return false;
+        }
+        g_streaming = true;
+        g_streamLen = 0;
+        g_streamFirstToken = 0;
+        g_streamClauses = 0;
+        return true;
+    }
+
+    // 入りきらなければ何も取り込まずにfalse（BUSY）を返すので、送り手は同じチャンクを再送する
+    static bool streamChunk(const char* text, size_t len) {
+        if (!g_streaming && !streamBegin()) {
+            return false;
+        }
+        flushClauses(false);
+        if (len > STREAM_BUFFER_SIZE - g_streamLen) {
+            return false;
+        }
+        if (g_streamFirstToken == 0 && g_streamClauses == 0) {
+            g_streamFirstToken = g_messageArrivalMicros;
+        }
+        memcpy(g_streamText + g_streamLen, text, len);
+        g_streamLen += len;
+        flushClauses(false);
+        return true;
+    }
+
+    static void streamEnd() {
+        g_streaming = false;
+        flushClauses(true);
+        if (g_streamLen > 0) {
+            LOG_I("STREAM", "Stream ended: %u clauses, %u chars waiting for the speech queue",
+                  g_streamClauses, (unsigned)g_streamLen);
+        } else {
+            LOG_I("STREAM", "Stream ended: %u clauses", g_streamClauses);
+        }
+    }
+
+    static void printLatency(const char* name, const LatencyStats& stats) {
+        Serial.printf("  %s: %u, avg %.2f ms, max %.2f ms\n", name, stats.count,
+                     stats.count ? stats.totalMicros / 1000.0f / stats.count : 0.0f,
+                     stats.maxMicros / 1000.0f);
+    }
+
+    static bool isValidParameter(uint8_t id, int value) {
+        switch (id) {
+            case BinaryProtocol::PARAM_VOLUME:          return value >= 0 && value <= 100;
+            case BinaryProtocol::PARAM_RATE:            return value >= 80 && value <= 450;
+            case BinaryProtocol::PARAM_PITCH:           return value >= 0 && value <= 99;
+            case BinaryProtocol::PARAM_INTERNAL_VOLUME: return value >= 0 && value <= 200;
+            case BinaryProtocol::PARAM_PITCH_RANGE:     return value >= 0 && value <= 100;
+            case BinaryProtocol::PARAM_THEME:           return value >= 0 && value < g_themeCount;
+            default:                                    return false;
+        }
+    }
+
+    // eSpeakのパラメータ（合成タスクがapplyVoiceParametersで読む）を書く。
+    // g_voiceLockを持って呼ぶこと。音声パラメータでなければ何もせずfalse
+    static bool storeVoiceParameter(uint8_t id, int value) {
+        switch (id) {
+            case BinaryProtocol::PARAM_RATE:            g_rate = value; break;
+            case BinaryProtocol::PARAM_PITCH:           g_pitch = value; break;
+            case BinaryProtocol::PARAM_INTERNAL_VOLUME: g_volume_internal = value; break;
+            case BinaryProtocol::PARAM_PITCH_RANGE:     g_pitchRange = value; break;
+            default: return false;
+        }
+        g_voiceDirty = true;
+        return true;
+    }
+
+    // ASCIIコマンドとバイナリのSET_PARAMSで共通の設定処理
+    static bool setParameter(uint8_t id, int value) {
+        if (!isValidParameter(id, value)) {
+            return false;
+        }
+        portENTER_CRITICAL(&g_voiceLock);
+        bool voice = storeVoiceParameter(id, value);
+        portEXIT_CRITICAL(&g_voiceLock);
+        if (voice) {
+            return true;
+        }
+        // クリティカルセクションの外で（スピーカーと描画タスクに触る）
+        switch (id) {
+            case BinaryProtocol::PARAM_VOLUME:
+                g_volume = value;
+                M5.Speaker.setVolume(value);
+                break;
+            case BinaryProtocol::PARAM_THEME:
+                return avatar.switchColorPalette(value);
+        }
+        return true;
+    }
+
+    // ===== JSON Commands =====
+    // '{'で始まる行はJSONコマンド。1つのオブジェクトで設定・表情・発話をまとめて指定でき、
+    // 全ての値を検証してから一度に反映する（1つでも不正なら何も変えない）。
+    //   {"id":1,"rate":180,"pitch":60,"volume":70,"expression":"happy","text":"Hello"}
+    // 応答は1行のJSON:
+    //   {"id":1,"ok":true,"parse_us":85} / {"id":1,"ok":false,"error":"rate","parse_us":60}
+    // 受信した行をそのまま解析し文字列はコピーしないので（zero-copy）ヒープを使わず、
+    // ドキュメントの大きさとネストの深さで解析時間の上限が決まる。
+    constexpr size_t JSON_MAX_MEMBERS = 12;
+    static StaticJsonDocument<JSON_OBJECT_SIZE(JSON_MAX_MEMBERS)> g_jsonDocument;
+    static LatencyStats g_jsonParseTime;
+
+    struct JsonParameter {
+        const char* key;
+        uint8_t id;
+    };
+    static const JsonParameter JSON_PARAMETERS[] = {
+        {"volume", BinaryProtocol::PARAM_VOLUME},
+        {"rate", BinaryProtocol::PARAM_RATE},
+        {"pitch", BinaryProtocol::PARAM_PITCH},
+        {"internal_volume", BinaryProtocol::PARAM_INTERNAL_VOLUME},
+        {"pitch_range", BinaryProtocol::PARAM_PITCH_RANGE},
+        {"theme", BinaryProtocol::PARAM_THEME},
+    };
+    constexpr size_t JSON_PARAMETER_COUNT = sizeof(JSON_PARAMETERS) / sizeof(JSON_PARAMETERS[0]);
+
+    static const char* const EXPRESSION_NAMES[] = {"happy", "angry", "sad", "doubt", "sleepy", "neutral"};
+
+    static void replyJson(JsonVariantConst id, const char* error, uint32_t parseMicros) {
+        StaticJsonDocument<JSON_OBJECT_SIZE(4)> reply;
+        reply["id"] = id;
+        reply["ok"] = error == nullptr;
+        if (error != nullptr) {
+            reply["error"] = error;
+        }
+        reply["parse_us"] = parseMicros;
+        xSemaphoreTake(g_serialTxMutex, portMAX_DELAY);
+        writeReplyLine(serializeJson(reply, g_replyLine, SERIAL_REPLY_SIZE - 2));
+        xSemaphoreGive(g_serialTxMutex);
+    }
+
+    static void processJson(char* line) {
+        uint32_t start = micros();
+        DeserializationError parseError = deserializeJson(g_jsonDocument, line,
+                                                          DeserializationOption::NestingLimit(1));
+        uint32_t parseMicros = micros() - start;
+        g_jsonParseTime.add(parseMicros);
+        JsonObjectConst command = g_jsonDocument.as<JsonObjectConst>();
+        JsonVariantConst id = command["id"];
+        if (parseError) {
+            replyJson(id, parseError.c_str(), parseMicros);
+            return;
+        }
+        if (command.isNull()) {
+            replyJson(id, "not an object", parseMicros);
+            return;
+        }
+        
+        // 検証（ここでは何も変更しない）
+        int values[JSON_PARAMETER_COUNT];
+        bool present[JSON_PARAMETER_COUNT] = {};
+        for (size_t i = 0; i < JSON_PARAMETER_COUNT; i++) {
+            JsonVariantConst value = command[JSON_PARAMETERS[i].key];
+            if (value.isNull()) continue;
+            if (!value.is<int>() || !isValidParameter(JSON_PARAMETERS[i].id, value.as<int>())) {
+                replyJson(id, JSON_PARAMETERS[i].key, parseMicros);
+                return;
+            }
+            values[i] = value.as<int>();
+            present[i] = true;
+        }
+        int expression = -1;
+        if (command.containsKey("expression")) {
+            const char* name = command["expression"];
+            for (int i = 0; name != nullptr && i < (int)(sizeof(EXPRESSION_NAMES) / sizeof(EXPRESSION_NAMES[0])); i++) {
+                if (strcmp(name, EXPRESSION_NAMES[i]) == 0) expression = i;
+            }
+            if (expression < 0) {
+                replyJson(id, "expression", parseMicros);
+                return;
+            }
+        }
+        const char* text = nullptr;
+        if (command.containsKey("text")) {
+            text = command["text"];
+            if (text == nullptr || text[0] == '\0' || strlen(text) > MAX_TEXT_LENGTH) {
+                replyJson(id, "text", parseMicros);
+                return;
+            }
+            // 設定だけ反映されて発話が捨てられることのないよう、先に空きを確認する
+            if (uxQueueSpacesAvailable(g_speechQueue) == 0) {
+                replyJson(id, "busy", parseMicros);
+                return;
+            }
+        }
+        for (JsonPairConst member : command) {
+            const char* key = member.key().c_str();
+            bool known = strcmp(key, "id") == 0 || strcmp(key, "expression") == 0 || strcmp(key, "text") == 0;
+            for (size_t i = 0; !known && i < JSON_PARAMETER_COUNT; i++) {
+                known = strcmp(key, JSON_PARAMETERS[i].key) == 0;
+            }
+            if (!known) {
+                replyJson(id, key, parseMicros);
+                return;
+            }
+        }
+        
+        // 反映: 音声パラメータは次の合成でまとめて使われる
+        bool voice[JSON_PARAMETER_COUNT] = {};
+        portENTER_CRITICAL(&g_voiceLock);
+        for (size_t i = 0; i < JSON_PARAMETER_COUNT; i++) {
+            if (present[i]) {
+                voice[i] = storeVoiceParameter(JSON_PARAMETERS[i].id, values[i]);
+            }
+        }
+        portEXIT_CRITICAL(&g_voiceLock);
+        for (size_t i = 0; i < JSON_PARAMETER_COUNT; i++) {
+            if (present[i] && !voice[i]) {
+                setParameter(JSON_PARAMETERS[i].id, values[i]);
+            }
+        }
+        if (expression >= 0) {
+            g_restExpression = (Expression)expression;
+            if (!g_isSpeaking) {
+                avatar.setExpression(g_restExpression);
+            }
+        }
+        if (text != nullptr) {
+            queueSpeech(text, strlen(text));
+        }
+        replyJson(id, nullptr, parseMicros);
+    }
+
+    // frameはCOBSエンコードされたまま（区切りの0x00なし）
+    static void processFrame(const uint8_t* frame, size_t frameLen) {
+        using namespace BinaryProtocol;
+        TRACE_SCOPE("serial.frame");
+        static const uint8_t frameStack = stackProfiler.operation("serial.frame");
+        StackScope stackScope(frameStack, frameLen);
+        HeapScope heapScope(HeapTag::Serial);
+        static uint8_t payload[MAX_PAYLOAD];
+        size_t len = cobsDecode(frame, frameLen, payload);
+        if (len < HEADER_SIZE + CRC_SIZE || payload[0] != MAGIC) {
+            // 他のデータの可能性があるので応答しない
+            return;
+        }
+        uint16_t requestId = payload[2] | (payload[3] << 8);
+        uint16_t crc = payload[len - 2] | (payload[len - 1] << 8);
+        if (crc16(payload, len - CRC_SIZE) != crc) {
+            sendAck(requestId, STATUS_BAD_CRC);
+            return;
+        }
+        g_hostActive = true;
+        uint32_t dispatch = micros() - g_messageArrivalMicros;
+        g_commandLatency.add(dispatch);
+        metrics.record(AppMetrics::dispatchMicros, dispatch);
+        metrics.increment(AppMetrics::frames);
+        const uint8_t* body = payload + HEADER_SIZE;
+        size_t bodyLen = len - HEADER_SIZE - CRC_SIZE;
+
+        switch (payload[1]) {
+            case CMD_PING:
+                sendAck(requestId, STATUS_OK);
+                break;
+            case CMD_SPEAK: {
+                if (bodyLen == 0 || bodyLen > MAX_TEXT_LENGTH) {
+                    sendAck(requestId, STATUS_BAD_LENGTH);
+                    break;
+                }
+                // 発話の開始・終了はイベントで通知する
+                sendAck(requestId, queueSpeech((const char*)body, bodyLen) ? STATUS_OK : STATUS_BUSY);
+                break;
+            }
+            case CMD_SET_PARAMS: {
+                if (bodyLen % 3 != 0) {
+                    sendAck(requestId, STATUS_BAD_LENGTH);
+                    break;
+                }
+                // 全て検証してから適用する（一部だけ反映されることはない）
+                size_t count = bodyLen / 3;
+                for (size_t i = 0; i < count; i++) {
+                    int16_t value = body[i * 3 + 1] | (body[i * 3 + 2] << 8);
+                    if (!isValidParameter(body[i * 3], value)) {
+                        sendAck(requestId, STATUS_INVALID_PARAM, i);
+                        return;
+                    }
+                }
+                // 音声パラメータは1回のロックでまとめて書き、途中の組み合わせで合成されないようにする
+                bool voice[MAX_PAYLOAD / 3] = {};
+                portENTER_CRITICAL(&g_voiceLock);
+                for (size_t i = 0; i < count; i++) {
+                    int16_t value = body[i * 3 + 1] | (body[i * 3 + 2] << 8);
+                    voice[i] = storeVoiceParameter(body[i * 3], value);
+                }
+                portEXIT_CRITICAL(&g_voiceLock);
+                for (size_t i = 0; i < count; i++) {
+                    int16_t value = body[i * 3 + 1] | (body[i * 3 + 2] << 8);
+                    if (!voice[i]) {
+                        setParameter(body[i * 3], value);
+                    }
+                }
+                sendAck(requestId, STATUS_OK);
+                break;
+            }
+            case CMD_GET_STATUS: {
+                const int16_t values[][2] = {
+                    {PARAM_VOLUME, g_volume},
+                    {PARAM_RATE, (int16_t)g_rate},
+                    {PARAM_PITCH, (int16_t)g_pitch},
+                    {PARAM_INTERNAL_VOLUME, (int16_t)g_volume_internal},
+                    {PARAM_PITCH_RANGE, (int16_t)g_pitchRange},
+                };
+                uint8_t status[1 + sizeof(values) / sizeof(values[0]) * 3];
+                status[0] = g_isSpeaking;
+                for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+                    status[1 + i * 3] = values[i][0];
+                    status[2 + i * 3] = values[i][1] & 0xFF;
+                    status[3 + i * 3] = values[i][1] >> 8;
+                }
+                send(REPLY_STATUS, requestId, status, sizeof(status));
+                break;
+            }
+            case CMD_STREAM_BEGIN:
+                sendAck(requestId, streamBegin() ? STATUS_OK : STATUS_BUSY);
+                break;
+            case CMD_STREAM_CHUNK:
+                sendAck(requestId, streamChunk((const char*)body, bodyLen) ? STATUS_OK : STATUS_BUSY);
+                break;
+            case CMD_STREAM_END:
+                streamEnd();
+                sendAck(requestId, STATUS_OK);
+                break;
+            case CMD_PCM_BEGIN: {
+                if (bodyLen != 4) {
+                    sendAck(requestId, STATUS_BAD_LENGTH);
+                    break;
+                }
+                uint32_t rate = body[0] | (body[1] << 8) | (body[2] << 16) | ((uint32_t)body[3] << 24);
+                sendAck(requestId, PcmStream::begin(rate) ? STATUS_OK : STATUS_BUSY);
+                break;
+            }
+            case CMD_PCM_DATA:
+                if (bodyLen % 2 != 0) {
+                    sendAck(requestId, STATUS_BAD_LENGTH);
+                    break;
+                }
+                // detail: バッファ残量(%)。ホストの送信ペース調整用
+                if (PcmStream::write(body, bodyLen)) {
+                    sendAck(requestId, STATUS_OK, PcmStream::depth() * 100 / PCM_BUFFER_SAMPLES);
+                } else {
+                    sendAck(requestId, PcmStream::g_active ? STATUS_BUSY : STATUS_FAILED);
+                }
+                break;
+            case CMD_PCM_END:
+                PcmStream::end();
+                sendAck(requestId, STATUS_OK);
+                break;
+            case CMD_TELEMETRY:
+                if (bodyLen != 2) {
+                    sendAck(requestId, STATUS_BAD_LENGTH);
+                    break;
+                }
+                sendAck(requestId, Telemetry::setInterval(body[0] | (body[1] << 8)) ? STATUS_OK : STATUS_INVALID_PARAM);
+                break;
+            case CMD_DUMP:
+                if (bodyLen > MAX_TEXT_LENGTH) {
+                    sendAck(requestId, STATUS_BAD_LENGTH);
+                    break;
+                }
+                // 結果はDUMP_*フレームで返る（失敗時はFAILEDのack）
+                if (!queueDump((const char*)body, bodyLen, requestId)) {
+                    sendAck(requestId, STATUS_BUSY);
+                }
+                break;
+            default:
+                sendAck(requestId, STATUS_UNKNOWN_COMMAND);
+                break;
+        }
+    }
+
+    static void processCommand(char* line) {
+        TRACE_SCOPE("serial.command");
+        static const uint8_t commandStack = stackProfiler.operation("serial.command");
+        StackScope stackScope(commandStack, strlen(line));
+        HeapScope heapScope(HeapTag::Serial);
+        uint32_t dispatch = micros() - g_messageArrivalMicros;
+        g_commandLatency.add(dispatch);
+        metrics.record(AppMetrics::dispatchMicros, dispatch);
+        metrics.increment(AppMetrics::commands);
+        
+        if (line[0] == '{') {
+            processJson(line);
+        }
+        else if (strncmp(line, "text:", 5) == 0) {
+            queueSpeech(line + 5, strlen(line + 5));
+        }
+        else if (strcmp(line, "stream_begin") == 0) {
+            if (!streamBegin()) {
+                serialReply("[BUSY] Previous stream still waiting for the speech queue");
+            }
+        }
+        else if (strncmp(line, "stream:", 7) == 0) {
+            if (!streamChunk(line + 7, strlen(line + 7))) {
+                serialReply("[BUSY] Stream buffer full");
+            }
+        }
+        else if (strcmp(line, "stream_end") == 0) {
+            streamEnd();
+        }
+        else if (strncmp(line, "volume:", 7) == 0) {
+            int vol = atoi(line + 7);
+            if (setParameter(BinaryProtocol::PARAM_VOLUME, vol)) {
+                serialReply("[VOLUME] Set to %d", vol);
+            }
+        }
+        else if (strncmp(line, "rate:", 5) == 0) {
+            int rate = atoi(line + 5);
+            if (setParameter(BinaryProtocol::PARAM_RATE, rate)) {
+                serialReply("[RATE] Set to %d wpm", rate);
+            }
+        }
+        else if (strncmp(line, "pitch:", 6) == 0) {
+            int pitch = atoi(line + 6);
+            if (setParameter(BinaryProtocol::PARAM_PITCH, pitch)) {
+                serialReply("[PITCH] Set to %d", pitch);
+            }
+        }
+        else if (strncmp(line, "internal_volume:", 16) == 0) {
+            int vol = atoi(line + 16);
+            if (setParameter(BinaryProtocol::PARAM_INTERNAL_VOLUME, vol)) {
+                serialReply("[INTERNAL_VOLUME] Set to %d", vol);
+            }
+        }
+        else if (strncmp(line, "pitch_range:", 12) == 0) {
+            int range = atoi(line + 12);
+            if (setParameter(BinaryProtocol::PARAM_PITCH_RANGE, range)) {
+                serialReply("[PITCH_RANGE] Set to %d", range);
+            }
+        }
+        else if (strcmp(line, "display_on") == 0) {
+            g_displayEnabled = true;
+            serialReply("[DISPLAY] Enabled");
+        }
+        else if (strcmp(line, "display_off") == 0) {
             g_displayEnabled = false;
             M5.Display.clear();
-            Serial.println("[DISPLAY] Disabled");
+            serialReply("[DISPLAY] Disabled");
+        }
+        else if (strcmp(line, "demo") == 0) {
+            const char* demo = "Hello! This is eSpeak with real time lip synchronization working perfectly on M5 Atom S3.";
+            queueSpeech(demo, strlen(demo));
+        }
+        else if (strcmp(line, "dump") == 0 || strncmp(line, "dump:", 5) == 0) {
+            const char* text = line[4] == ':' ? line + 5 : "";
+            if (!queueDump(text, strlen(text), 0)) {
+                serialReply("[BUSY] Speech queue full");
+            }
+        }
+        else if (strncmp(line, "telemetry:", 10) == 0) {
+            if (!Telemetry::setInterval(atoi(line + 10))) {
+                serialReply("[ERROR] Telemetry interval must be 0 or at least %u ms", Telemetry::MIN_INTERVAL_MS);
+            }
+        }
+        else if (strcmp(line, "record_start") == 0) {
+            if (Recorder::start()) {
+                serialReply("[RECORD] Recording commands and button presses");
+            } else {
+                serialReply("[ERROR] Cannot record while replaying");
+            }
         }
-        else if (strcmp(g_serialBuffer, "demo") == 0) {
-            speak("Hello! This is eSpeak with real time lip synchronization working perfectly on M5 Atom S3.");
+        else if (strcmp(line, "record_stop") == 0) {
+            Recorder::stop();
+            Recorder::printStatus();
         }
-        else if (strcmp(g_serialBuffer, "memory") == 0) {
+        else if (strcmp(line, "record") == 0) {
+            Recorder::printStatus();
+        }
+        else if (strcmp(line, "record_dump") == 0) {
+            if (!Recorder::send(0)) {
+                serialReply("[ERROR] Cannot dump while replaying");
+            }
+        }
+        else if (strcmp(line, "replay") == 0) {
+            if (!Recorder::startReplay()) {
+                serialReply("[ERROR] Nothing to replay (stop recording first)");
+            }
+        }
+        else if (strcmp(line, "replay_stop") == 0) {
+            Recorder::stopReplay();
+        }
+        else if (strcmp(line, "button") == 0) {
+            Recorder::g_pendingButtonPresses++;
+        }
+        else if (strcmp(line, "trace_start") == 0) {
+            if (trace.getCapacity() > 0) {
+                trace.start();
+                serialReply("[TRACE] Recording events");
+            } else {
+                serialReply("[ERROR] No trace buffer");
+            }
+        }
+        else if (strcmp(line, "trace_stop") == 0) {
+            trace.stop();
+            Tracing::printStatus();
+        }
+        else if (strcmp(line, "trace") == 0) {
+            Tracing::printStatus();
+        }
+        else if (strcmp(line, "trace_dump") == 0) {
+            if (!Tracing::send(0)) {
+                serialReply("[ERROR] No trace buffer");
+            }
+        }
+        else if (strcmp(line, "boot") == 0 || strncmp(line, "boot:", 5) == 0) {
+            // boot:N はN回前の起動
+            uint32_t ago = line[4] == ':' ? atoi(line + 5) : 0;
+            const BootProfiler::Boot* boot = BootProfiler::find(ago);
+            if (boot == nullptr) {
+                serialReply("[ERROR] No record of the boot %u boots ago", ago);
+            } else {
+                BootProfiler::printWaterfall(*boot);
+                BootProfiler::printHistory();
+            }
+        }
+        else if (strcmp(line, "boot_clear") == 0) {
+            BootProfiler::clear();
+            serialReply("[BOOT] History cleared");
+        }
+        else if (strcmp(line, "stack") == 0) {
+            StackReport::print();
+        }
+        else if (strcmp(line, "stack_reset") == 0) {
+            stackProfiler.reset();
+            serialReply("[STACK] Peaks cleared");
+        }
+        else if (strcmp(line, "heap") == 0) {
+            HeapReport::print();
+        }
+        else if (strcmp(line, "heap_snapshot") == 0) {
+            HeapReport::snapshot();
+        }
+        else if (strcmp(line, "heap_leaks") == 0) {
+            HeapReport::printLeaks();
+        }
+        else if (strcmp(line, "metrics") == 0) {
+            AppMetrics::print();
+        }
+        else if (strcmp(line, "metrics_reset") == 0) {
+            metrics.reset();
+            serialReply("[METRICS] Counters and histograms cleared");
+        }
+        else if (strcmp(line, "log") == 0) {
+            AsyncLog::printStatus();
+        }
+        else if (strncmp(line, "log:", 4) == 0) {
+            // log:TAG=i/w/e/n (TAGが*なら全タグ)
+            char* tag = line + 4;
+            char* level = strchr(tag, '=');
+            const char* levels = "iwen";
+            const char* found = level != nullptr && level[1] != '\0' ? strchr(levels, tolower(level[1])) : nullptr;
+            if (found == nullptr) {
+                serialReply("[ERROR] Usage: log:TAG=i|w|e|n");
+            } else {
+                *level = '\0';
+                if (!AsyncLog::setLevel(tag, (AsyncLog::Level)(found - levels))) {
+                    serialReply("[ERROR] Unknown log tag: %s", tag);
+                }
+            }
+        }
+        else if (strcmp(line, "pcm") == 0) {
+            PcmStream::printStats();
+        }
+        else if (strcmp(line, "latency") == 0) {
+            Serial.printf("\n[LATENCY] Serial arrival to dispatch:\n");
+            printLatency("Commands", g_commandLatency);
+            printLatency("Speech", g_speechLatency);
+            printLatency("Stream first audio", g_firstAudioLatency);
+            Serial.printf("  JSON parse: %u, avg %u us, max %u us\n", g_jsonParseTime.count,
+                         g_jsonParseTime.count ? (uint32_t)(g_jsonParseTime.totalMicros / g_jsonParseTime.count) : 0,
+                         g_jsonParseTime.maxMicros);
+            Serial.printf("  RX bytes: %u, ring overflows: %u, speech dropped: %u\n",
+                         g_rxBytes, g_rxOverflows, g_speechDropped);
+            Serial.println("==========================\n");
+            g_commandLatency = {};
+            g_speechLatency = {};
+            g_firstAudioLatency = {};
+            g_jsonParseTime = {};
+        }
+        else if (strcmp(line, "memory") == 0) {
             MemoryMonitor::printStatus();
         }
-        else if (strcmp(g_serialBuffer, "buffer_info") == 0) {
+        else if (strcmp(line, "buffer_info") == 0) {
             float maxDuration = (float)MAX_AUDIO_BUFFER_SIZE / AUDIO_SAMPLE_RATE;
             Serial.printf("\n[BUFFER] Audio Buffer Information:\n");
             Serial.printf("  Maximum capacity: %d samples\n", MAX_AUDIO_BUFFER_SIZE);
@@ -377,7 +2965,7 @@ namespace SerialProcessor {
             }
             Serial.println("==========================\n");
         }
-        else if (strcmp(g_serialBuffer, "status") == 0) {
+        else if (strcmp(line, "status") == 0) {
             Serial.printf("\n[STATUS] Current Settings:\n");
             Serial.printf("  Rate: %d wpm\n", g_rate);
             Serial.printf("  Pitch: %d\n", g_pitch);
@@ -388,9 +2976,96 @@ namespace SerialProcessor {
             Serial.printf("  Speaking: %s\n", g_isSpeaking ? "YES" : "NO");
             Serial.println("========================\n");
         }
-        else if (strcmp(g_serialBuffer, "help") == 0) {
+        else if (strcmp(line, "parallel_on") == 0) {
+            avatar.setParallelRendering(true);
+            avatar.resetFrameStats();
+            serialReply("[PARALLEL] Strip rendering on both cores");
+        }
+        else if (strcmp(line, "parallel_off") == 0) {
+            avatar.setParallelRendering(false);
+            avatar.resetFrameStats();
+            serialReply("[PARALLEL] Strip rendering on one core");
+        }
+        else if (strncmp(line, "theme:", 6) == 0) {
+            int theme = atoi(line + 6);
+            if (setParameter(BinaryProtocol::PARAM_THEME, theme)) {
+                serialReply("[THEME] Switch to %d", theme);
+            }
+        }
+        else if (strcmp(line, "deadlines") == 0) {
+            DeadlineStats audio = g_audioRefillDeadline.getStats();
+            DeadlineStats render = avatar.getDrawDeadlineStats();
+            DeadlineStats control = avatar.getFacialDeadlineStats();
+            DeadlineStats loopStats = g_controlDeadline.getStats();
+            Serial.printf("\n[DEADLINES] Priority: audio %d > synthesis %d > render %d > control %d\n",
+                         TaskPriority::AUDIO_PLAYOUT, TaskPriority::SYNTHESIS,
+                         TaskPriority::RENDER, TaskPriority::CONTROL);
+            Serial.printf("  Audio refill: missed %u / %u (deadline %.1f ms, worst %.1f ms), underruns %u\n",
+                         audio.missed, audio.periods, audio.deadlineMicros / 1000.0f,
+                         audio.worstMicros / 1000.0f, g_audioUnderruns);
+            Serial.printf("  Render frames: late %u / %u (deadline %.1f ms, worst %.1f ms)\n",
+                         render.missed, render.periods, render.deadlineMicros / 1000.0f,
+                         render.worstMicros / 1000.0f);
+            Serial.printf("  Facial updates: late %u / %u (deadline %.1f ms, worst %.1f ms)\n",
+                         control.missed, control.periods, control.deadlineMicros / 1000.0f,
+                         control.worstMicros / 1000.0f);
+            Serial.printf("  Command loop: late %u / %u (deadline %.1f ms, worst %.1f ms)\n",
+                         loopStats.missed, loopStats.periods, loopStats.deadlineMicros / 1000.0f,
+                         loopStats.worstMicros / 1000.0f);
+            Serial.println("==========================\n");
+            g_audioRefillDeadline.resetStats();
+            g_controlDeadline.resetStats();
+            g_audioUnderruns = 0;
+            avatar.resetDeadlineStats();
+        }
+        else if (strcmp(line, "speaker") == 0) {
+            SpeakerMonitor::printStatus();
+        }
+        else if (strncmp(line, "speaker_adapt:", 14) == 0) {
+            SpeakerMonitor::g_adaptive = atoi(line + 14) != 0;
+            serialReply("[SPEAKER] Adaptive DMA buffering %s", SpeakerMonitor::g_adaptive ? "on" : "off");
+        }
+        else if (strncmp(line, "speaker_dma:", 12) == 0) {
+            // M5.Speakerを止め直すので、再生するタスクが次の発話の前に反映する
+            int count = constrain(atoi(line + 12), SpeakerMonitor::DMA_BUF_COUNT_MIN,
+                                  SpeakerMonitor::DMA_BUF_COUNT_MAX);
+            SpeakerMonitor::g_requestedCount = count;
+            serialReply("[SPEAKER] %d DMA buffers from the next utterance", count);
+        }
+        else if (strcmp(line, "render") == 0) {
+            FrameStats stats = avatar.getFrameStats();
+            Serial.printf("\n[RENDER] Frame Statistics (%s):\n",
+                         avatar.isParallelRendering() ? "parallel" : "single core");
+            Serial.printf("  Frames: %u (over budget: %u)\n", stats.frames, stats.overBudgetFrames);
+            Serial.printf("  Frame time: last %.1f ms, max %.1f ms, budget %.1f ms\n",
+                         stats.lastFrameMicros / 1000.0f, stats.maxFrameMicros / 1000.0f,
+                         stats.budgetMicros / 1000.0f);
+            Serial.printf("  Shed level: %d\n", stats.shedLevel);
+            Serial.printf("  Shed frames: balloon %u, effect %u, battery %u, rotation %u\n",
+                         stats.shedFrames[0], stats.shedFrames[1], stats.shedFrames[2], stats.shedFrames[3]);
+            GlyphCacheStats glyphs = glyphCache.getStats();
+            uint32_t lookups = glyphs.hits + glyphs.misses;
+            Serial.printf("  Glyph cache: hit rate %.1f%% (%u/%u), evictions %u\n",
+                         lookups ? glyphs.hits * 100.0f / lookups : 0.0f, glyphs.hits, lookups,
+                         glyphs.evictions);
+            Serial.printf("  Glyph memory: %u glyphs, %u / %u bytes\n",
+                         glyphs.glyphs, glyphs.bytes, glyphs.budget);
+            FaceSwitchStats switches = avatar.getFaceSwitchStats();
+            Serial.printf("  Switches: face %u, theme %u, latency last %u frames, max %u frames\n",
+                         switches.faceSwitches, switches.paletteSwitches,
+                         switches.lastLatencyFrames, switches.maxLatencyFrames);
+            Serial.println("==========================\n");
+            avatar.resetFrameStats();
+            glyphCache.resetStats();
+        }
+        else if (strcmp(line, "help") == 0) {
             Serial.println("\n[HELP] eSpeak Complete Commands:");
             Serial.println("text:Your message        - Speak text");
+            Serial.println("{\"rate\":180,\"text\":\"Hi\"} - JSON: set volume/rate/pitch/internal_volume/pitch_range/");
+            Serial.println("                          theme/expression and speak text in one atomic command");
+            Serial.println("stream_begin            - Start streaming text (LLM tokens)");
+            Serial.println("stream:chunk            - Append streamed text; clauses are spoken as they complete");
+            Serial.println("stream_end              - Speak the rest of the stream");
             Serial.println("volume:50               - Speaker volume (0-100)");
             Serial.println("rate:150                - Speech rate (80-450 wpm)");
             Serial.println("pitch:70                - Voice pitch (0-99)");
@@ -401,39 +3076,179 @@ namespace SerialProcessor {
             Serial.println("memory                  - Memory status");
             Serial.println("buffer_info             - Audio buffer information");
             Serial.println("status                  - Current settings");
+            Serial.println("parallel_on/parallel_off - Toggle dual-core strip rendering");
+            Serial.println("theme:1                 - Switch color theme (0:normal 1:inverted)");
+            Serial.println("speaker                 - Speaker queue occupancy, underruns per utterance and DMA buffering");
+            Serial.println("speaker_adapt:1         - Grow DMA buffers after underruns, shrink them when clean (0: fixed)");
+            Serial.println("speaker_dma:8           - Set the number of DMA buffers (4-16)");
+            Serial.println("render                  - Frame time, shed and glyph cache statistics");
+            Serial.println("deadlines               - Missed audio refills and late frames per task");
+            Serial.println("latency                 - Serial arrival-to-dispatch latency");
+            Serial.println("pcm                     - PCM stream throughput, buffer depth and underruns");
+            Serial.println("dump / dump:text        - Send the last (or a new) utterance as binary WAV frames");
+            Serial.println("telemetry:1000          - Binary stats record every N ms (0 stops)");
+            Serial.println("record_start/record_stop - Record commands and button presses with timing");
+            Serial.println("record / record_dump    - Recording status / send it as binary frames");
+            Serial.println("replay / replay_stop    - Re-inject the recording with its original timing");
+            Serial.println("button                  - Same as pressing button A");
+            Serial.println("trace_start/trace_stop  - Record begin/end events of synthesis, playout, drawing and serial");
+            Serial.println("trace / trace_dump      - Trace status / send the events as binary frames");
+            Serial.println("boot / boot:1           - Boot phase waterfall (this or N boots ago) and history");
+            Serial.println("boot_clear              - Forget the earlier boots");
+            Serial.println("stack / stack_reset     - Peak stack use per operation (synthesis by text length, frame, command) / clear");
+            Serial.println("heap                    - Heap use per subsystem (audio, render, tts, serial)");
+            Serial.println("heap_snapshot / heap_leaks - Save the heap state / show growth and live allocations since");
+            Serial.println("metrics / metrics_reset - All counters, gauges and latency histograms / clear them");
+            Serial.println("log / log:SPEAK=w       - Log levels and dropped count / set a tag's level (i/w/e/n, * for all)");
             Serial.println("help                    - Show this help");
             Serial.printf("\nMax text length: %d characters\n", MAX_TEXT_LENGTH);
             Serial.printf("Max audio duration: ~%.1f seconds\n\n", (float)MAX_AUDIO_BUFFER_SIZE / AUDIO_SAMPLE_RATE);
         }
         else {
             // Direct speech for unrecognized commands
-            if (strlen(g_serialBuffer) <= MAX_TEXT_LENGTH) {
-                speak(g_serialBuffer);
+            if (strlen(line) <= MAX_TEXT_LENGTH) {
+                queueSpeech(line, strlen(line));
             }
         }
     }
     
-    static void handleInput() {
-        while (Serial.available()) {
-            char c = Serial.read();
-            
-            if (c == '\n' || c == '\r') {
-                if (g_serialPos > 0) {
-                    g_serialBuffer[g_serialPos] = '\0';
-                    processCommand();
-                    g_serialPos = 0;
+    // 1バイトずつ行/フレームを組み立て、完成したらその場で処理する
+    static void assemble(uint8_t c, uint32_t arrivalMicros) {
+        // バイナリフレーム: 0x00 ... 0x00
+        if (g_inFrame) {
+            if (c != 0) {
+                if (g_framePos == 0) {
+                    g_messageArrivalMicros = arrivalMicros;
                 }
-                return;
+                if (g_framePos < BINARY_FRAME_SIZE) {
+                    g_frameBuffer[g_framePos++] = c;
+                } else {
+                    g_frameOverflow = true;
+                }
+            } else if (g_frameOverflow) {
+                BinaryProtocol::sendAck(0, BinaryProtocol::STATUS_BAD_LENGTH);
+                g_inFrame = false;
+            } else if (g_framePos > 0) {
+                Recorder::record(Recorder::ENTRY_FRAME, g_messageArrivalMicros, g_frameBuffer, g_framePos);
+                processFrame(g_frameBuffer, g_framePos);
+                g_inFrame = false;
             }
-            
-            if (g_serialPos < SERIAL_BUFFER_SIZE - 1) {
-                g_serialBuffer[g_serialPos++] = c;
-            } else {
-                Serial.println("[WARNING] Serial buffer overflow - resetting");
+            return;
+        }
+        if (c == 0) {
+            g_inFrame = true;
+            g_frameOverflow = false;
+            g_framePos = 0;
+            g_serialPos = 0;
+            return;
+        }
+        
+        if (c == '\n' || c == '\r') {
+            if (g_serialPos > 0) {
+                g_serialBuffer[g_serialPos] = '\0';
+                // JSONは解析でバッファを書き換えるので処理前に記録する
+                Recorder::recordLine(g_serialBuffer, g_serialPos, g_messageArrivalMicros);
+                processCommand(g_serialBuffer);
                 g_serialPos = 0;
             }
+            return;
+        }
+        
+        if (g_serialPos == 0) {
+            g_messageArrivalMicros = arrivalMicros;
+        }
+        if (g_serialPos < SERIAL_BUFFER_SIZE - 1) {
+            g_serialBuffer[g_serialPos++] = c;
+        } else {
+            serialReply("[WARNING] Serial buffer overflow - resetting");
+            g_serialPos = 0;
+        }
+    }
+
+    static void notifyRx() {
+        if (g_rxTask != nullptr) {
+            xTaskNotifyGive(g_rxTask);
         }
     }
+
+    // 記録したエントリを直接処理する。組み立て途中の受信データ（g_serialBuffer,
+    // g_frameBuffer）には触らないので、再生中にホストから届いた行やフレームも壊れない
+    static void injectReplay(const Recorder::Entry& entry, const uint8_t* data) {
+        static char line[SERIAL_BUFFER_SIZE];
+        uint32_t liveArrival = g_messageArrivalMicros;
+        g_messageArrivalMicros = micros();
+        switch (entry.type) {
+            case Recorder::ENTRY_LINE:
+                // JSONは解析で行を書き換えるのでコピーに対して処理する
+                if (entry.length > 0 && entry.length < sizeof(line)) {
+                    memcpy(line, data, entry.length);
+                    line[entry.length] = '\0';
+                    processCommand(line);
+                }
+                break;
+            case Recorder::ENTRY_FRAME:
+                if (entry.length > 0) {
+                    processFrame(data, entry.length);
+                }
+                break;
+            case Recorder::ENTRY_BUTTON:
+                Recorder::g_pendingButtonPresses++;
+                break;
+        }
+        // 組み立て途中の受信データの到着時刻を戻す
+        g_messageArrivalMicros = liveArrival;
+    }
+
+    static void rxTask(void* args) {
+        static uint8_t replayData[Recorder::MAX_ENTRY_LENGTH];
+        for (;;) {
+            TickType_t wait = pdMS_TO_TICKS(RX_POLL_MS);
+            Recorder::Entry entry;
+            while (Recorder::nextReplayEntry(&entry, replayData, &wait)) {
+                injectReplay(entry, replayData);
+            }
+            
+            // 受信イベントで即座に起床する（イベントが無い場合もRX_POLL_MSで取りこぼさない）
+            ulTaskNotifyTake(pdTRUE, wait);
+            retryStream();
+            
+            while (Serial.available()) {
+                // ドライバのバッファを先に空にしてから組み立てる
+                uint32_t now = micros();
+                uint32_t received = 0;
+                while (Serial.available()) {
+                    size_t next = (g_rxHead + 1) % RX_RING_SIZE;
+                    if (next == g_rxTail) {
+                        g_rxOverflows++;
+                        break;
+                    }
+                    g_rxRing[g_rxHead] = Serial.read();
+                    g_rxArrival[g_rxHead] = now;
+                    g_rxHead = next;
+                    received++;
+                }
+                g_rxBytes += received;
+                metrics.increment(AppMetrics::rxBytes, received);
+                while (g_rxTail != g_rxHead) {
+                    assemble(g_rxRing[g_rxTail], g_rxArrival[g_rxTail]);
+                    g_rxTail = (g_rxTail + 1) % RX_RING_SIZE;
+                }
+            }
+        }
+    }
+
+    static void begin() {
+        g_speechQueue = xQueueCreate(SPEECH_QUEUE_LENGTH, sizeof(SpeechRequest));
+        // 合成でloopが塞がっても受信できるよう、もう一方のコアで動かす
+        xTaskCreatePinnedToCore(rxTask, "serialRx", 8192, NULL,
+                                TaskPriority::CONTROL, &g_rxTask, PRO_CPU_NUM);
+#if ARDUINO_USB_MODE && ARDUINO_USB_CDC_ON_BOOT
+        Serial.onEvent(ARDUINO_HW_CDC_RX_EVENT,
+                       [](void*, esp_event_base_t, int32_t, void*) { notifyRx(); });
+#else
+        Serial.onReceive(notifyRx);
+#endif
+    }
 }
 
 // ===== Display Manager =====
@@ -463,8 +3278,16 @@ namespace DisplayManager {
 
 // ===== Setup =====
 void setup() {
+    BootProfiler::mark(BootProfiler::PHASE_ARDUINO_INIT);
+    Serial.setRxBufferSize(1024);
+    Serial.setTxBufferSize(4096);  // dumpをUSBの速度で流すため
     Serial.begin(115200);
+    AsyncLog::begin();
+    AppMetrics::setup();
+    HeapReport::setup();
+    BootProfiler::mark(BootProfiler::PHASE_SERIAL);
     delay(1000);
+    BootProfiler::mark(BootProfiler::PHASE_DELAY_1);
     Serial.println("=== eSpeak Complete Solution ===");
     
     // PSRAMにオーディオバッファを割り当て
@@ -490,6 +3313,7 @@ void setup() {
         return;
     }
     LOG_I("SETUP", "PSRAM available: %.1f KB", ESP.getPsramSize() / 1024.0f);
+    BootProfiler::mark(BootProfiler::PHASE_PSRAM_ALLOC);
     
     // M5 initialization (Display disabled by default to avoid conflicts)
     LOG_I("SETUP", "Initializing M5 with Speaker");
@@ -498,6 +3322,7 @@ void setup() {
     M5.begin(cfg);
     M5.Lcd.setRotation(1);
     LOG_I("SETUP", "M5 initialized");
+    BootProfiler::mark(BootProfiler::PHASE_M5_BEGIN);
     
     // M5.Speaker configuration
     LOG_I("SETUP", "Configuring M5.Speaker");
@@ -509,7 +3334,7 @@ void setup() {
     spk_cfg.magnification = 2;
     spk_cfg.dma_buf_len = 128;
     spk_cfg.dma_buf_count = 8;
-    spk_cfg.task_priority = 1;
+    spk_cfg.task_priority = TaskPriority::AUDIO_PLAYOUT;
     spk_cfg.pin_data_out = 5;
     spk_cfg.pin_bck = 8;
     spk_cfg.pin_ws = 6;
@@ -523,25 +3348,43 @@ void setup() {
     }
     
     M5.Speaker.setVolume(g_volume);
+    SpeakerMonitor::setup();
     LOG_I("SETUP", "M5.Speaker initialized successfully");
+    BootProfiler::mark(BootProfiler::PHASE_SPEAKER);
     
     // Avatar initialization
     LOG_I("SETUP", "Initializing avatar");
     avatar.setScale(0.45);
     avatar.setPosition(-72, -100);
+    avatar.setExpressionTransition(200);  // Happy/Neutral をモーフィングで切り替え
+    avatar.setFrameBudget(33000);         // 超過時はオーバーレイ処理を間引く
+    avatar.setTaskPriorities(TaskPriority::RENDER, TaskPriority::CONTROL);
+    {
+        // テーマは起動時に作っておき、切り替え時はフレーム境界で差し替えるだけにする
+        ColorPalette normal;
+        ColorPalette inverted;
+        inverted.set(COLOR_PRIMARY, TFT_BLACK);
+        inverted.set(COLOR_BACKGROUND, TFT_WHITE);
+        avatar.preloadColorPalette(normal);
+        avatar.preloadColorPalette(inverted);
+        g_themeCount = 2;
+    }
     avatar.init();
     LOG_I("SETUP", "Avatar initialized");
+    BootProfiler::mark(BootProfiler::PHASE_AVATAR_INIT);
     
     // eSpeak initialization
     LOG_I("SETUP", "Initializing eSpeak");
     espeak.add("/mem/data/voices/!v/f4", 
                espeak_ng_data_voices__v_f4, 
                espeak_ng_data_voices__v_f4_len);
+    BootProfiler::mark(BootProfiler::PHASE_ESPEAK_ADD);
     
     if (!espeak.begin()) {
         LOG_E("SETUP", "eSpeak initialization failed");
         return;
     }
+    BootProfiler::mark(BootProfiler::PHASE_ESPEAK_BEGIN);
     
     espeak.setVoice("en+f4");
     espeak.setRate(g_rate);
@@ -549,6 +3392,7 @@ void setup() {
     espeak.setVolume(g_volume_internal);
     espeak.setPitchRange(g_pitchRange);
     LOG_I("SETUP", "eSpeak initialized");
+    BootProfiler::mark(BootProfiler::PHASE_ESPEAK_VOICE);
     
     g_systemReady = true;
     LOG_I("SETUP", "System ready");
@@ -556,23 +3400,48 @@ void setup() {
     // Initial memory report
     MemoryMonitor::printStatus();
     
+    // loop()は合成タスクとして描画より優先する
+    vTaskPrioritySet(NULL, TaskPriority::SYNTHESIS);
+    
+    // PCM入力のジッタバッファと再生タスク
+    PcmStream::setup();
+    
+    // テレメトリ送信タスク（telemetry:Nで開始）
+    Telemetry::setup();
+    
+    // 入力の記録・再生用バッファ
+    Recorder::setup();
+    
+    // イベントトレース用バッファ（trace_startで記録開始）
+    Tracing::setup();
+    
+    // シリアル受信は専用タスクで行う
+    SerialProcessor::begin();
+    BootProfiler::mark(BootProfiler::PHASE_SUBSYSTEMS);
+
     delay(1000);
+    BootProfiler::mark(BootProfiler::PHASE_DELAY_2);
     speak("eSpeak complete system ready with advanced features");
+    BootProfiler::mark(BootProfiler::PHASE_GREETING);
     
     Serial.println("\n=== System Ready ===");
+    Serial.printf("Boot took %.1f ms (type 'boot' for the breakdown)\n",
+                  BootProfiler::totalMicros(*BootProfiler::g_current) / 1000.0f);
     Serial.println("Type 'help' for commands");
 }
 
 // ===== Main Loop =====
 void loop() {
+    g_controlDeadline.tick(micros());
     M5.update();
     esp_task_wdt_reset();
     
-    // Handle serial input
-    SerialProcessor::handleInput();
-    
-    // Button handling
-    if (M5.BtnA.wasPressed()) {
+    // Button handling（replay・buttonコマンドによる入力も同じ扱い）
+    bool pressed = M5.BtnA.wasPressed();
+    if (pressed) {
+        Recorder::recordButton();
+    }
+    if (pressed || Recorder::takeButtonPress()) {
         // speak("Button A pressed. System working perfectly.");
         speak("Button A pressed. I am Stack-chan minimal voice of English!");
     }
@@ -584,7 +3453,8 @@ void loop() {
         lastDisplayUpdate = millis();
     }
     
-    delay(50);
+    // シリアルから届いた発話を待つ（最大50ms）
+    SerialProcessor::dispatchSpeech(50);
 }
 
 /*
@@ -608,6 +3478,8 @@ void loop() {
  * 
  * 4. 使用可能コマンド:
  *    - text:メッセージ - テキスト音声出力
+ *    - {"rate":180,"expression":"happy","text":"..."} - JSONコマンド（設定・表情・発話を一括で反映）
+ *    - stream_begin / stream:断片 / stream_end - ストリーミング発話（節ごとに合成開始）
  *    - volume:値 - スピーカー音量 (0-100)
  *    - rate:値 - 話速 (80-450 wpm)
  *    - pitch:値 - 音程 (0-99)
@@ -617,6 +3489,28 @@ void loop() {
  *    - demo - デモ音声
  *    - memory - メモリ状況
  *    - status - 現在の設定
+ *    - parallel_on/off - 短冊描画のデュアルコア並列化
+ *    - theme:値 - カラーテーマ切り替え (0:通常 1:反転)
+ *    - speaker - スピーカーのキュー状態・発話ごとの途切れ・DMAバッファ数
+ *    - speaker_adapt:0|1 - 途切れに応じたDMAバッファ数の自動調整
+ *    - speaker_dma:値 - DMAバッファ数の指定 (4-16)
+ *    - render - 描画時間・間引き・グリフキャッシュ統計
+ *    - deadlines - タスク別のデッドライン超過(音声補充・描画・制御)
+ *    - latency - シリアル受信から処理開始までの遅延
+ *    - pcm - PCMストリームの転送速度・バッファ量・途切れ回数
+ *    - dump / dump:テキスト - 直前(または新規合成)の音声をWAVフレームで出力
+ *    - telemetry:ミリ秒 - 統計のバイナリレコードを定期送信 (0で停止)
+ *    - record_start / record_stop / record / record_dump - 入力の時刻付き記録と取り出し
+ *    - replay / replay_stop - 記録した入力を同じ間隔で再注入
+ *    - button - ボタンAを押したのと同じ
+ *    - trace_start / trace_stop / trace / trace_dump - タスクをまたいだイベントのトレース記録と取り出し
+ *    - boot / boot:N / boot_clear - 起動の段階別時間(今回またはN回前)と履歴 / 履歴の消去
+ *    - stack / stack_reset - 操作ごと(合成はテキスト長別)のスタック最大使用量 / クリア
+ *    - heap - サブシステム別のヒープ使用量と確保レート
+ *    - heap_snapshot / heap_leaks - ヒープ状態の保存 / 保存時からの増加と残っている確保
+ *    - metrics / metrics_reset - カウンタ・ゲージ・遅延ヒストグラムの一覧 / クリア
+ *    - log / log:タグ=i|w|e|n - ログの出力数・破棄数 / タグごとの出力レベル (*で全タグ)
+ *    - 0x00で囲まれたフレームはバイナリプロトコル (tools/stackchan_serial.py)
  *    - help - ヘルプ表示
  * 
  * 5. 制限事項:
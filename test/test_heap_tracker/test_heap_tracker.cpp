@@ -0,0 +1,171 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+// Heap tracker table: attribution to scopes, frees, leaks since a snapshot
+// and a full table. The allocator wrappers are not linked here, so the tests
+// report allocations themselves.
+// Run with: pio test -e native -f test_heap_tracker
+
+#include <unity.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include "HeapTracker.cpp"
+
+using namespace m5avatar;
+
+namespace {
+
+void *address(uintptr_t n) { return reinterpret_cast<void *>(n * 16); }
+
+const HeapTagStats &tagStats(const HeapSnapshot &s, HeapTag tag) {
+  return s.tags[static_cast<uint8_t>(tag)];
+}
+
+void test_counts_under_the_scope_tag() {
+  static HeapTracker t;
+  // nothing is counted before begin()
+  t.onAlloc(address(1), 100);
+  t.begin();
+  t.onFree(address(1));
+
+  HeapTag previous = t.enter(HeapTag::Tts);
+  t.onAlloc(address(2), 64);
+  HeapTag inner = t.enter(HeapTag::Audio);
+  t.onAlloc(address(3), 32);
+  t.leave(inner);
+  t.onAlloc(address(4), 8);
+  t.leave(previous);
+  t.onAlloc(address(5), 4);
+  // freed outside the scope, still counted under the tag that allocated it
+  t.onFree(address(2));
+
+  HeapSnapshot s = t.snapshot();
+  TEST_ASSERT_EQUAL_UINT32(2, tagStats(s, HeapTag::Tts).allocations);
+  TEST_ASSERT_EQUAL_UINT32(1, tagStats(s, HeapTag::Tts).frees);
+  TEST_ASSERT_EQUAL_UINT32(8, tagStats(s, HeapTag::Tts).liveBytes);
+  TEST_ASSERT_EQUAL_UINT32(72, tagStats(s, HeapTag::Tts).peakLiveBytes);
+  TEST_ASSERT_EQUAL_UINT32(32, tagStats(s, HeapTag::Audio).liveBytes);
+  TEST_ASSERT_EQUAL_UINT32(4, tagStats(s, HeapTag::Other).liveBytes);
+  TEST_ASSERT_EQUAL_UINT32(3, tagStats(s, HeapTag::Other).liveAllocations +
+                                  tagStats(s, HeapTag::Audio).liveAllocations +
+                                  tagStats(s, HeapTag::Tts).liveAllocations);
+  // the free of the block allocated before begin()
+  TEST_ASSERT_EQUAL_UINT32(1, s.untrackedFrees);
+}
+
+void test_finds_leaks_since_snapshot() {
+  static HeapTracker t;
+  t.begin();
+  t.onAlloc(address(1), 500);
+  HeapSnapshot before = t.snapshot();
+  TEST_ASSERT_EQUAL_UINT32(0, t.findLeaks(before, nullptr, 0));
+
+  HeapTag previous = t.enter(HeapTag::Render);
+  for (uintptr_t i = 0; i < 10; i++) {
+    t.onAlloc(address(100 + i), 10 + i);
+  }
+  t.leave(previous);
+  // freed again: not a leak
+  for (uintptr_t i = 0; i < 10; i += 2) {
+    t.onFree(address(100 + i));
+  }
+
+  HeapLeak leaks[3];
+  TEST_ASSERT_EQUAL_UINT32(5, t.findLeaks(before, leaks, 3));
+  const uint32_t largest[] = {19, 17, 15};
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL_UINT32(largest[i], leaks[i].size);
+    TEST_ASSERT_TRUE(leaks[i].tag == HeapTag::Render);
+  }
+  TEST_ASSERT_EQUAL_PTR(address(109), leaks[0].ptr);
+}
+
+// an address handed out again without a free seen in between
+void test_reused_address_replaces_stale_entry() {
+  static HeapTracker t;
+  t.begin();
+  t.onAlloc(address(7), 40);
+  t.onAlloc(address(7), 24);
+  HeapSnapshot s = t.snapshot();
+  TEST_ASSERT_EQUAL_UINT32(24, tagStats(s, HeapTag::Other).liveBytes);
+  TEST_ASSERT_EQUAL_UINT32(1, tagStats(s, HeapTag::Other).liveAllocations);
+  TEST_ASSERT_EQUAL_UINT32(1, s.untrackedFrees);
+}
+
+void test_full_table() {
+  static HeapTracker t;
+  t.begin();
+  const uint32_t limit = HEAP_TRACK_CAPACITY * 3 / 4;
+  for (uintptr_t i = 0; i < limit + 10; i++) {
+    t.onAlloc(address(1000 + i), 1);
+  }
+  HeapSnapshot s = t.snapshot();
+  TEST_ASSERT_EQUAL_UINT32(limit, tagStats(s, HeapTag::Other).liveAllocations);
+  TEST_ASSERT_EQUAL_UINT32(limit + 10, tagStats(s, HeapTag::Other).allocations);
+  TEST_ASSERT_EQUAL_UINT32(10, s.untrackedAllocations);
+
+  // removals keep every remaining entry reachable
+  for (uintptr_t i = 0; i < limit; i += 3) {
+    t.onFree(address(1000 + i));
+  }
+  for (uintptr_t i = 0; i < limit; i++) {
+    if (i % 3 != 0) {
+      t.onFree(address(1000 + i));
+    }
+  }
+  s = t.snapshot();
+  TEST_ASSERT_EQUAL_UINT32(0, tagStats(s, HeapTag::Other).liveAllocations);
+  TEST_ASSERT_EQUAL_UINT32(0, tagStats(s, HeapTag::Other).liveBytes);
+  TEST_ASSERT_EQUAL_UINT32(0, s.untrackedFrees);
+}
+
+void test_concurrent_tasks() {
+  const int THREADS = 4;
+  const uintptr_t BLOCKS = 20000;
+  static HeapTracker t;
+  t.begin();
+  const HeapTag tags[THREADS] = {HeapTag::Audio, HeapTag::Render,
+                                 HeapTag::Tts, HeapTag::Serial};
+  std::vector<std::thread> threads;
+  for (int n = 0; n < THREADS; n++) {
+    threads.emplace_back([n, &tags] {
+      HeapTag previous = t.enter(tags[n]);
+      for (uintptr_t i = 0; i < BLOCKS; i++) {
+        void *ptr = address((n + 1) * 100000 + i % 50);
+        t.onAlloc(ptr, 8);
+        t.onFree(ptr);
+      }
+      // one left alive per thread
+      t.onAlloc(address((n + 1) * 100000 + 99), 16);
+      t.leave(previous);
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  HeapSnapshot s = t.snapshot();
+  for (HeapTag tag : tags) {
+    TEST_ASSERT_EQUAL_UINT32(BLOCKS + 1, tagStats(s, tag).allocations);
+    TEST_ASSERT_EQUAL_UINT32(BLOCKS, tagStats(s, tag).frees);
+    TEST_ASSERT_EQUAL_UINT32(16, tagStats(s, tag).liveBytes);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, tagStats(s, HeapTag::Other).allocations);
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_counts_under_the_scope_tag);
+  RUN_TEST(test_finds_leaks_since_snapshot);
+  RUN_TEST(test_reused_address_replaces_stale_entry);
+  RUN_TEST(test_full_table);
+  RUN_TEST(test_concurrent_tasks);
+  return UNITY_END();
+}
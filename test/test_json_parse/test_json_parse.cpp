@@ -0,0 +1,109 @@
+// Host benchmark of the JSON command parse in src/main.cpp (processJson).
+// Same document size, nesting limit and zero-copy input as on the device,
+// so the times compare with the parse_us of `stackchan_serial.py json-bench`.
+// Run with: pio test -e native -f test_json_parse
+
+#include <ArduinoJson.h>
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+// SerialProcessor::JSON_MAX_MEMBERS and SERIAL_BUFFER_SIZE of src/main.cpp
+const size_t JSON_MAX_MEMBERS = 12;
+const size_t SERIAL_BUFFER_SIZE = 512;
+
+StaticJsonDocument<JSON_OBJECT_SIZE(JSON_MAX_MEMBERS)> document;
+char line[SERIAL_BUFFER_SIZE];
+
+// JSON_BENCH_COMMANDS of tools/stackchan_serial.py, as it serializes them
+const char* const COMMANDS[] = {
+    "{\"rate\":150,\"id\":0}",
+    "{\"rate\":180,\"pitch\":60,\"volume\":70,\"internal_volume\":100,"
+    "\"pitch_range\":80,\"id\":0}",
+    "{\"expression\":\"happy\",\"theme\":0,\"id\":0}",
+    "{\"expression\":\"neutral\",\"rate\":150,\"pitch\":70,\"volume\":50,"
+    "\"internal_volume\":100,\"pitch_range\":100,\"theme\":0,\"id\":0}",
+};
+
+// deserializes in place like processJson; zero-copy writes into the line
+DeserializationError parse(const char* json) {
+  strncpy(line, json, sizeof(line) - 1);
+  return deserializeJson(document, line,
+                         DeserializationOption::NestingLimit(1));
+}
+
+void test_bench_commands_parse() {
+  for (const char* command : COMMANDS) {
+    TEST_ASSERT_TRUE_MESSAGE(parse(command) == DeserializationError::Ok,
+                             command);
+    JsonObjectConst object = document.as<JsonObjectConst>();
+    TEST_ASSERT_FALSE(object.isNull());
+    TEST_ASSERT_TRUE(object["id"].is<int>());
+  }
+  JsonObjectConst object = document.as<JsonObjectConst>();
+  TEST_ASSERT_EQUAL_INT(100, object["pitch_range"].as<int>());
+  const char* expression = object["expression"];
+  TEST_ASSERT_EQUAL_STRING("neutral", expression);
+  // strings point into the input line instead of the document
+  TEST_ASSERT_TRUE(expression >= line && expression < line + sizeof(line));
+}
+
+void test_rejects_nesting() {
+  TEST_ASSERT_TRUE(parse("{\"rate\":{\"value\":150}}") ==
+                   DeserializationError::TooDeep);
+}
+
+void test_rejects_too_many_members() {
+  char json[SERIAL_BUFFER_SIZE] = "{";
+  for (size_t i = 0; i <= JSON_MAX_MEMBERS; i++) {
+    char member[16];
+    snprintf(member, sizeof(member), "%s\"k%u\":%u", i ? "," : "",
+             (unsigned)i, (unsigned)i);
+    strcat(json, member);
+  }
+  strcat(json, "}");
+  TEST_ASSERT_TRUE(parse(json) == DeserializationError::NoMemory);
+}
+
+void test_benchmark() {
+  const int ROUNDS = 20000;
+  for (size_t i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++) {
+    // the copy into the line is timed separately and subtracted
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < ROUNDS; n++) {
+      strncpy(line, COMMANDS[i], sizeof(line) - 1);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int n = 0; n < ROUNDS; n++) {
+      parse(COMMANDS[i]);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double copy =
+        std::chrono::duration<double, std::micro>(middle - start).count();
+    double total =
+        std::chrono::duration<double, std::micro>(end - middle).count();
+    char message[96];
+    snprintf(message, sizeof(message), "#%u %3u bytes: parse %.3f us",
+             (unsigned)i, (unsigned)strlen(COMMANDS[i]),
+             (total - copy) / ROUNDS);
+    TEST_MESSAGE(message);
+  }
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_commands_parse);
+  RUN_TEST(test_rejects_nesting);
+  RUN_TEST(test_rejects_too_many_members);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,144 @@
+// The lock-free log ring and the argument formatting behind LOG_* in
+// src/main.cpp.
+// Run with: pio test -e native -f test_log_ring
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LogRing.h"
+
+using namespace AsyncLog;
+
+namespace {
+
+typedef Ring<64, 128> LogRing;
+
+TagLevel tag = {"TEST", LEVEL_INFO};
+
+// the line the log task would print for the oldest slot
+std::string take(LogRing& ring) {
+  const LogRing::Slot* slot = ring.front();
+  if (slot == nullptr) return "";
+  char line[512];
+  size_t len = format(line, sizeof(line), slot->level, slot->tag->tag,
+                      slot->format, slot->args, slot->argBytes);
+  ring.pop();
+  return std::string(line, len);
+}
+
+template <typename... Args>
+std::string formatted(const char* fmt, Args... args) {
+  static LogRing ring;
+  TEST_ASSERT_TRUE(ring.push(LEVEL_WARN, &tag, fmt, args...));
+  return take(ring);
+}
+
+void test_format_matches_printf() {
+  TEST_ASSERT_EQUAL_STRING("[W][TEST] Hello world 42\n",
+                           formatted("Hello %s %d", "world", 42).c_str());
+  TEST_ASSERT_EQUAL_STRING("[W][TEST] 3.14 100% -7 ff\n",
+                           formatted("%.2f 100%% %ld %x", 3.14159, -7L,
+                                     255u).c_str());
+  TEST_ASSERT_EQUAL_STRING(
+      "[W][TEST] 18446744073709551615 |  12|\n",
+      formatted("%llu |%4u|", 18446744073709551615ULL, 12u).c_str());
+  TEST_ASSERT_EQUAL_STRING("[W][TEST] 0x0000abcd\n",
+                           formatted("%p", (const void*)0xabcd).c_str());
+}
+
+void test_format_mismatched_arguments() {
+  // missing arguments and strings given for numbers print ?
+  TEST_ASSERT_EQUAL_STRING("[W][TEST] 1 ?\n", formatted("%d %d", 1).c_str());
+  TEST_ASSERT_EQUAL_STRING("[W][TEST] ? ?\n",
+                           formatted("%d %s", "text", 5).c_str());
+  TEST_ASSERT_EQUAL_STRING("[W][TEST] (null)\n",
+                           formatted("%s", (const char*)nullptr).c_str());
+  // a double for %d is converted
+  TEST_ASSERT_EQUAL_STRING("[W][TEST] 2\n", formatted("%d", 2.9).c_str());
+}
+
+void test_long_string_is_truncated() {
+  std::string text(300, 'x');
+  std::string line = formatted("%s|%d", text.c_str(), 1);
+  // the string fills the slot, so the following argument is lost
+  TEST_ASSERT_EQUAL_STRING("?\n", line.substr(line.size() - 2).c_str());
+  TEST_ASSERT_TRUE(line.size() < 128);
+  TEST_ASSERT_EQUAL_STRING("[W][TEST] xxx", line.substr(0, 13).c_str());
+}
+
+void test_full_ring_rejects_and_keeps_order() {
+  static LogRing ring;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 64; i++) {
+      TEST_ASSERT_TRUE(ring.push(LEVEL_INFO, &tag, "%d", round * 100 + i));
+    }
+    TEST_ASSERT_FALSE(ring.push(LEVEL_INFO, &tag, "%d", -1));
+    for (int i = 0; i < 64; i++) {
+      char expected[32];
+      snprintf(expected, sizeof(expected), "[I][TEST] %d\n", round * 100 + i);
+      TEST_ASSERT_EQUAL_STRING(expected, take(ring).c_str());
+    }
+    TEST_ASSERT_NULL(ring.front());
+  }
+}
+
+// producers on several threads against one consumer, as with the app tasks
+// and the log task
+void test_concurrent_producers() {
+  const int PRODUCERS = 4;
+  const int MESSAGES = 50000;
+  static LogRing ring;
+  std::atomic<int> dropped(0);
+  std::atomic<int> running(PRODUCERS);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < PRODUCERS; p++) {
+    producers.emplace_back([&, p] {
+      for (int i = 0; i < MESSAGES; i++) {
+        if (!ring.push(LEVEL_INFO, &tag, "%d %d", p, i)) dropped++;
+      }
+      running--;
+    });
+  }
+  int last[PRODUCERS];
+  for (int& n : last) n = -1;
+  int received = 0;
+  bool ordered = true;
+  for (;;) {
+    bool done = running.load() == 0;
+    std::string line;
+    while (!(line = take(ring)).empty()) {
+      int p, i;
+      if (sscanf(line.c_str(), "[I][TEST] %d %d\n", &p, &i) != 2 || p < 0 ||
+          p >= PRODUCERS || i <= last[p]) {
+        ordered = false;
+        break;
+      }
+      last[p] = i;
+      received++;
+    }
+    if (done || !ordered) break;
+  }
+  for (std::thread& t : producers) t.join();
+  TEST_ASSERT_TRUE_MESSAGE(ordered, "corrupted or reordered message");
+  TEST_ASSERT_EQUAL_INT(PRODUCERS * MESSAGES, received + dropped.load());
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_format_matches_printf);
+  RUN_TEST(test_format_mismatched_arguments);
+  RUN_TEST(test_long_string_is_truncated);
+  RUN_TEST(test_full_ring_rejects_and_keeps_order);
+  RUN_TEST(test_concurrent_producers);
+  return UNITY_END();
+}
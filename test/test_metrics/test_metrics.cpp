@@ -0,0 +1,148 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+// Metrics registry, histogram buckets and percentile estimates.
+// Run with: pio test -e native -f test_metrics
+// tools/test_stackchan_serial.py checks the host's percentile against the
+// same cases.
+
+#include <unity.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "Metrics.cpp"
+
+using namespace m5avatar;
+
+namespace {
+
+MetricSnapshot histogramOf(Metrics &m, const char *name,
+                           std::initializer_list<uint32_t> samples) {
+  uint8_t id = m.histogram(name);
+  for (uint32_t micros : samples) {
+    m.record(id, micros);
+  }
+  return m.read(id);
+}
+
+void test_bucket_bounds_are_inclusive() {
+  Metrics m;
+  MetricSnapshot s = histogramOf(m, "h", {0, 50, 51, 100, 2000000, 2000001,
+                                          UINT32_MAX});
+  TEST_ASSERT_EQUAL_UINT32(2, s.buckets[0]);
+  TEST_ASSERT_EQUAL_UINT32(2, s.buckets[1]);
+  TEST_ASSERT_EQUAL_UINT32(1, s.buckets[HISTOGRAM_BUCKETS - 2]);
+  TEST_ASSERT_EQUAL_UINT32(2, s.buckets[HISTOGRAM_BUCKETS - 1]);
+  TEST_ASSERT_EQUAL_UINT32(7, s.count);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, s.maxMicros);
+}
+
+void test_percentile() {
+  Metrics m;
+  MetricSnapshot empty = histogramOf(m, "empty", {});
+  TEST_ASSERT_EQUAL_UINT32(0, Metrics::percentile(empty, 50));
+
+  // one sample: every percentile is capped at the maximum
+  MetricSnapshot one = histogramOf(m, "one", {730});
+  TEST_ASSERT_EQUAL_UINT32(730, Metrics::percentile(one, 0));
+  TEST_ASSERT_EQUAL_UINT32(730, Metrics::percentile(one, 99));
+
+  // 99 fast samples and one slow one
+  Metrics tail;
+  uint8_t id = tail.histogram("tail");
+  for (int i = 0; i < 99; i++) {
+    tail.record(id, 30);
+  }
+  tail.record(id, 4200);
+  MetricSnapshot s = tail.read(id);
+  TEST_ASSERT_EQUAL_UINT32(50, Metrics::percentile(s, 50));
+  TEST_ASSERT_EQUAL_UINT32(50, Metrics::percentile(s, 99));
+  TEST_ASSERT_EQUAL_UINT32(4200, Metrics::percentile(s, 100));
+
+  // the rank rounds up: the 51st of 101 samples is in the upper bucket,
+  // whose bound is capped at the maximum
+  Metrics half;
+  id = half.histogram("half");
+  for (int i = 0; i < 50; i++) {
+    half.record(id, 80);
+  }
+  for (int i = 0; i < 51; i++) {
+    half.record(id, 15000);
+  }
+  s = half.read(id);
+  TEST_ASSERT_EQUAL_UINT32(15000, Metrics::percentile(s, 50));
+  TEST_ASSERT_EQUAL_UINT32(100, Metrics::percentile(s, 49));
+
+  // the open-ended last bucket reports the maximum
+  MetricSnapshot slow = histogramOf(m, "slow", {3000000, 9000000});
+  TEST_ASSERT_EQUAL_UINT32(9000000, Metrics::percentile(slow, 50));
+}
+
+void test_registry() {
+  Metrics m;
+  uint8_t c = m.counter("frames");
+  TEST_ASSERT_EQUAL_UINT8(c, m.counter("frames"));
+  uint8_t g = m.gauge("queue");
+  TEST_ASSERT_EQUAL_UINT8(2, m.size());
+  m.increment(c, 3);
+  m.increment(c);
+  m.set(g, -5);
+  TEST_ASSERT_EQUAL_INT32(4, m.read(c).value);
+  TEST_ASSERT_EQUAL_INT32(-5, m.read(g).value);
+
+  m.reset();
+  TEST_ASSERT_EQUAL_INT32(0, m.read(c).value);
+  TEST_ASSERT_EQUAL_INT32(-5, m.read(g).value);
+
+  static char names[METRICS_MAX][8];
+  for (uint8_t i = m.size(); i < METRICS_MAX; i++) {
+    snprintf(names[i], sizeof(names[i]), "m%u", i);
+    TEST_ASSERT_EQUAL_UINT8(i, m.counter(names[i]));
+  }
+  uint8_t full = m.counter("extra");
+  TEST_ASSERT_EQUAL_UINT8(METRIC_INVALID, full);
+  m.increment(full);
+  m.record(full, 10);
+  m.set(full, 1);
+  TEST_ASSERT_EQUAL_UINT8(METRICS_MAX, m.size());
+}
+
+void test_concurrent_updates() {
+  const int THREADS = 4;
+  const int UPDATES = 100000;
+  static Metrics m;
+  uint8_t c = m.counter("c");
+  uint8_t h = m.histogram("h");
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; t++) {
+    threads.emplace_back([=] {
+      for (int i = 0; i < UPDATES; i++) {
+        m.increment(c);
+        m.record(h, t * 1000 + i % 7);
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  TEST_ASSERT_EQUAL_INT32(THREADS * UPDATES, m.read(c).value);
+  MetricSnapshot s = m.read(h);
+  TEST_ASSERT_EQUAL_UINT32(THREADS * UPDATES, s.count);
+  TEST_ASSERT_EQUAL_UINT32((THREADS - 1) * 1000 + 6, s.maxMicros);
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_bucket_bounds_are_inclusive);
+  RUN_TEST(test_percentile);
+  RUN_TEST(test_registry);
+  RUN_TEST(test_concurrent_updates);
+  return UNITY_END();
+}
@@ -0,0 +1,154 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+// Span fills of SpanCache against M5GFX's own fillCircle/fillEllipse.
+// Run with: pio test -e native -f test_span_cache
+
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include "SpanCache.cpp"
+
+using m5avatar::spanCache;
+
+namespace {
+
+const int32_t CANVAS_W = 160;
+const int32_t CANVAS_H = 120;
+
+// centers inside, near the edges and outside of the canvas
+const int32_t CENTERS[][2] = {{80, 60}, {3, 4}, {157, 117}, {-10, 60},
+                              {80, 130}};
+
+struct Canvases {
+  M5Canvas expected;
+  M5Canvas actual;
+
+  Canvases() {
+    expected.setColorDepth(16);
+    actual.setColorDepth(16);
+    expected.createSprite(CANVAS_W, CANVAS_H);
+    actual.createSprite(CANVAS_W, CANVAS_H);
+  }
+
+  void clear() {
+    expected.fillSprite(TFT_BLACK);
+    actual.fillSprite(TFT_BLACK);
+  }
+
+  // first differing pixel as y * CANVAS_W + x, or -1
+  int32_t diff() {
+    for (int32_t y = 0; y < CANVAS_H; y++) {
+      for (int32_t x = 0; x < CANVAS_W; x++) {
+        if (expected.readPixelValue(x, y) != actual.readPixelValue(x, y)) {
+          return y * CANVAS_W + x;
+        }
+      }
+    }
+    return -1;
+  }
+};
+
+void test_circle_matches_fill_circle() {
+  Canvases c;
+  char message[64];
+  for (int32_t r = 1; r <= 60; r++) {
+    for (auto &center : CENTERS) {
+      c.clear();
+      c.expected.fillCircle(center[0], center[1], r, TFT_WHITE);
+      spanCache.fillCircle(&c.actual, center[0], center[1], r, TFT_WHITE);
+      snprintf(message, sizeof(message), "r=%d at (%d, %d)", r, center[0],
+               center[1]);
+      TEST_ASSERT_EQUAL_INT32_MESSAGE(-1, c.diff(), message);
+    }
+  }
+}
+
+void test_ellipse_matches_fill_ellipse() {
+  Canvases c;
+  char message[64];
+  for (int32_t rx = 1; rx <= 48; rx += 3) {
+    for (int32_t ry = 1; ry <= 48; ry += 2) {
+      for (auto &center : CENTERS) {
+        c.clear();
+        c.expected.fillEllipse(center[0], center[1], rx, ry, TFT_WHITE);
+        spanCache.fillEllipse(&c.actual, center[0], center[1], rx, ry,
+                              TFT_WHITE);
+        snprintf(message, sizeof(message), "rx=%d ry=%d at (%d, %d)", rx, ry,
+                 center[0], center[1]);
+        TEST_ASSERT_EQUAL_INT32_MESSAGE(-1, c.diff(), message);
+      }
+    }
+  }
+}
+
+void test_degenerate_radius_falls_back() {
+  Canvases c;
+  c.clear();
+  c.expected.fillCircle(40, 40, 0, TFT_WHITE);
+  spanCache.fillCircle(&c.actual, 40, 40, 0, TFT_WHITE);
+  c.expected.fillEllipse(80, 40, 0, 5, TFT_WHITE);
+  spanCache.fillEllipse(&c.actual, 80, 40, 0, 5, TFT_WHITE);
+  TEST_ASSERT_EQUAL_INT32(-1, c.diff());
+}
+
+void test_cache_hits_after_first_fill() {
+  Canvases c;
+  spanCache.clear();
+  uint32_t hits = spanCache.getHits();
+  uint32_t misses = spanCache.getMisses();
+  for (int i = 0; i < 10; i++) {
+    spanCache.fillCircle(&c.actual, 50, 50, 20, TFT_WHITE);
+  }
+  TEST_ASSERT_EQUAL_UINT32(misses + 1, spanCache.getMisses());
+  TEST_ASSERT_EQUAL_UINT32(hits + 9, spanCache.getHits());
+}
+
+// eye and mouth sized shapes, as drawn on every frame
+void test_benchmark() {
+  Canvases c;
+  const int ROUNDS = 2000;
+  const int32_t RADII[] = {8, 12, 18, 25, 30};
+  for (int32_t r : RADII) {
+    spanCache.fillCircle(&c.actual, 80, 60, r, TFT_WHITE);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ROUNDS; i++) {
+    for (int32_t r : RADII) {
+      c.expected.fillCircle(80, 60, r, TFT_WHITE);
+    }
+  }
+  auto middle = std::chrono::steady_clock::now();
+  for (int i = 0; i < ROUNDS; i++) {
+    for (int32_t r : RADII) {
+      spanCache.fillCircle(&c.actual, 80, 60, r, TFT_WHITE);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  double direct =
+      std::chrono::duration<double, std::micro>(middle - start).count();
+  double cached =
+      std::chrono::duration<double, std::micro>(end - middle).count();
+  char message[96];
+  snprintf(message, sizeof(message),
+           "fillCircle %.3f us/shape, span cache %.3f us/shape",
+           direct / (ROUNDS * 5), cached / (ROUNDS * 5));
+  TEST_MESSAGE(message);
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_circle_matches_fill_circle);
+  RUN_TEST(test_ellipse_matches_fill_ellipse);
+  RUN_TEST(test_degenerate_radius_falls_back);
+  RUN_TEST(test_cache_hits_after_first_fill);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
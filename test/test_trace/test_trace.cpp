@@ -0,0 +1,149 @@
+// Copyright (c) Shinya Ishikawa. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+
+// Trace ring: ordering, overwriting when full and concurrent recording.
+// Run with: pio test -e native -f test_trace
+
+#include <unity.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "Trace.cpp"
+
+using namespace m5avatar;
+
+namespace {
+
+void test_records_in_order() {
+  Trace t;
+  TEST_ASSERT_TRUE(t.begin(16));
+  uint8_t frame = t.name("frame");
+  uint8_t speech = t.name("speech");
+  TEST_ASSERT_EQUAL_UINT8(frame, t.name("frame"));
+  // nothing is recorded before start()
+  t.record(TracePhase::Instant, frame);
+  TEST_ASSERT_EQUAL_UINT32(0, t.size());
+
+  t.start();
+  t.record(TracePhase::Begin, frame);
+  t.record(TracePhase::Instant, speech);
+  t.record(TracePhase::End, frame);
+  t.stop();
+  t.record(TracePhase::Instant, speech);
+  TEST_ASSERT_EQUAL_UINT32(3, t.size());
+  TEST_ASSERT_EQUAL_UINT32(0, t.getDropped());
+
+  const char phases[] = {'B', 'i', 'E'};
+  const uint8_t names[] = {frame, speech, frame};
+  TraceEvent event;
+  for (uint32_t i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(t.read(i, &event));
+    TEST_ASSERT_EQUAL_INT(phases[i], event.phase);
+    TEST_ASSERT_EQUAL_UINT8(names[i], event.name);
+    TEST_ASSERT_EQUAL_UINT8(0, event.task);
+  }
+  TEST_ASSERT_FALSE(t.read(3, &event));
+  TEST_ASSERT_EQUAL_UINT8(1, t.getTaskCount());
+  TEST_ASSERT_EQUAL_STRING("speech", t.getName(speech));
+  TEST_ASSERT_EQUAL_STRING("", t.getName(TRACE_INVALID));
+}
+
+void test_overwrites_oldest_when_full() {
+  Trace t;
+  TEST_ASSERT_TRUE(t.begin(8));
+  static char labels[20][8];
+  uint8_t ids[20];
+  for (int i = 0; i < 20; i++) {
+    snprintf(labels[i], sizeof(labels[i]), "e%d", i);
+    ids[i] = t.name(labels[i]);
+  }
+  t.start();
+  for (int i = 0; i < 20; i++) {
+    t.record(TracePhase::Instant, ids[i]);
+  }
+  t.stop();
+  TEST_ASSERT_EQUAL_UINT32(8, t.size());
+  TEST_ASSERT_EQUAL_UINT32(12, t.getDropped());
+  TraceEvent event;
+  for (uint32_t i = 0; i < 8; i++) {
+    TEST_ASSERT_TRUE(t.read(i, &event));
+    TEST_ASSERT_EQUAL_UINT8(ids[12 + i], event.name);
+  }
+
+  // start() clears the ring
+  t.start();
+  TEST_ASSERT_EQUAL_UINT32(0, t.size());
+  t.stop();
+}
+
+void test_name_table_full() {
+  Trace t;
+  TEST_ASSERT_TRUE(t.begin(4));
+  static char labels[TRACE_NAMES][8];
+  for (uint8_t i = 0; i < TRACE_NAMES; i++) {
+    snprintf(labels[i], sizeof(labels[i]), "n%u", i);
+    TEST_ASSERT_EQUAL_UINT8(i, t.name(labels[i]));
+  }
+  TEST_ASSERT_EQUAL_UINT8(TRACE_INVALID, t.name("extra"));
+  t.start();
+  t.record(TracePhase::Instant, TRACE_INVALID);
+  TEST_ASSERT_EQUAL_UINT32(0, t.size());
+  t.stop();
+}
+
+// every event written by several threads reads back complete
+void test_concurrent_recording() {
+  const int THREADS = 4;
+  const int EVENTS = 20000;
+  static Trace t;
+  TEST_ASSERT_TRUE(t.begin(THREADS * EVENTS));
+  static uint8_t ids[THREADS];
+  static char labels[THREADS][8];
+  for (int i = 0; i < THREADS; i++) {
+    snprintf(labels[i], sizeof(labels[i]), "t%d", i);
+    ids[i] = t.name(labels[i]);
+  }
+  t.start();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < THREADS; i++) {
+    threads.emplace_back([i] {
+      for (int n = 0; n < EVENTS; n++) {
+        t.record(n % 2 ? TracePhase::End : TracePhase::Begin, ids[i]);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  t.stop();
+  TEST_ASSERT_EQUAL_UINT32(THREADS * EVENTS, t.size());
+  int perName[THREADS] = {};
+  int begins = 0;
+  TraceEvent event;
+  for (uint32_t i = 0; i < t.size(); i++) {
+    TEST_ASSERT_TRUE(t.read(i, &event));
+    TEST_ASSERT_TRUE(event.name < THREADS);
+    perName[event.name]++;
+    begins += event.phase == 'B';
+  }
+  for (int i = 0; i < THREADS; i++) {
+    TEST_ASSERT_EQUAL_INT(EVENTS, perName[i]);
+  }
+  TEST_ASSERT_EQUAL_INT(THREADS * EVENTS / 2, begins);
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_records_in_order);
+  RUN_TEST(test_overwrites_oldest_when_full);
+  RUN_TEST(test_name_table_full);
+  RUN_TEST(test_concurrent_recording);
+  return UNITY_END();
+}
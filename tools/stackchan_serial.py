@@ -0,0 +1,721 @@
+#!/usr/bin/env python3
+"""Host side of the binary serial protocol of src/main.cpp.
+
+Frames are 0x00-delimited COBS packets carrying
+  [magic 0xA5][type][request id (u16 LE)][body...][CRC16-CCITT (u16 LE)]
+Log text printed by the firmware between frames is ignored.
+
+Usage:
+  stackchan_serial.py PORT ping
+  stackchan_serial.py PORT speak "Hello"
+  stackchan_serial.py PORT set volume=60 rate=180
+  stackchan_serial.py PORT status
+  stackchan_serial.py PORT stream < text      (streams stdin word by word)
+  stackchan_serial.py PORT pcm FILE.wav        (16-bit mono WAV)
+  stackchan_serial.py PORT dump OUT.wav [TEXT] (last utterance, or TEXT
+                                                synthesized without playing;
+                                                metadata goes to OUT.json)
+  stackchan_serial.py PORT telemetry [MS] [OUT.csv]  (records until Ctrl-C)
+  stackchan_serial.py PORT bench [COUNT]
+  stackchan_serial.py PORT json '{"rate":180,"text":"Hello"}'
+  stackchan_serial.py PORT json-bench [COUNT]  (device parse time per command)
+  stackchan_serial.py PORT record-dump OUT.rec (after record_start/record_stop)
+  stackchan_serial.py PORT replay FILE.rec     (re-sends with original timing)
+  stackchan_serial.py PORT trace OUT.json      (after trace_start; Chrome/Perfetto
+                                                trace event format)
+
+Requires pyserial.
+"""
+
+import csv
+import json
+import struct
+import sys
+import time
+import wave
+
+MAGIC = 0xA5
+
+CMD_PING = 0x01
+CMD_SPEAK = 0x02
+CMD_SET_PARAMS = 0x03
+CMD_GET_STATUS = 0x04
+CMD_STREAM_BEGIN = 0x05
+CMD_STREAM_CHUNK = 0x06
+CMD_STREAM_END = 0x07
+CMD_PCM_BEGIN = 0x08
+CMD_PCM_DATA = 0x09
+CMD_PCM_END = 0x0A
+CMD_DUMP = 0x0B
+CMD_TELEMETRY = 0x0C
+
+REPLY_ACK = 0x80
+REPLY_STATUS = 0x81
+REPLY_EVENT = 0x82
+REPLY_DUMP_INFO = 0x83
+REPLY_DUMP_LEVELS = 0x84
+REPLY_DUMP_DATA = 0x85
+REPLY_DUMP_END = 0x86
+REPLY_TELEMETRY = 0x87
+REPLY_RECORD_DATA = 0x88
+REPLY_RECORD_END = 0x89
+REPLY_METRICS = 0x8A
+REPLY_TRACE_INFO = 0x8B
+REPLY_TRACE_DATA = 0x8C
+REPLY_TRACE_END = 0x8D
+
+# entry types of a recording (Recorder in src/main.cpp)
+ENTRY_LINE = 1
+ENTRY_FRAME = 2
+ENTRY_BUTTON = 3
+
+PARAMS = {
+    "volume": 1,
+    "rate": 2,
+    "pitch": 3,
+    "internal_volume": 4,
+    "pitch_range": 5,
+    "theme": 6,
+}
+STATUS_NAMES = ["ok", "bad_crc", "unknown_command", "bad_length", "busy",
+                "invalid_param", "failed"]
+EVENT_NAMES = {1: "speech_started", 2: "speech_finished"}
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_pos = 0
+    code = 1
+    for byte in data:
+        if byte == 0:
+            out[code_pos] = code
+            code_pos = len(out)
+            out.append(0)
+            code = 1
+            continue
+        out.append(byte)
+        code += 1
+        if code == 0xFF:
+            out[code_pos] = code
+            code_pos = len(out)
+            out.append(0)
+            code = 1
+    out[code_pos] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        i += 1
+        block = data[i:i + code - 1]
+        # encoded data never holds a zero; the frame ends at the first one
+        if code == 0 or len(block) != code - 1 or 0 in block:
+            raise ValueError("malformed COBS frame")
+        out += block
+        i += code - 1
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def encode(msg_type, request_id, body=b""):
+    payload = struct.pack("<BBH", MAGIC, msg_type, request_id) + body
+    payload += struct.pack("<H", crc16(payload))
+    return b"\x00" + cobs_encode(payload) + b"\x00"
+
+
+def decode(frame):
+    """Returns (type, request id, body) or None for anything but a valid frame."""
+    try:
+        payload = cobs_decode(frame)
+    except ValueError:
+        return None
+    if len(payload) < 6 or payload[0] != MAGIC:
+        return None
+    if crc16(payload[:-2]) != struct.unpack("<H", payload[-2:])[0]:
+        return None
+    _, msg_type, request_id = struct.unpack("<BBH", payload[:4])
+    return msg_type, request_id, payload[4:-2]
+
+
+def encode_params(pairs):
+    return b"".join(struct.pack("<Bh", PARAMS[k], v) for k, v in pairs)
+
+
+class Connection:
+    def __init__(self, port, baudrate=115200):
+        import serial
+        self.port = serial.Serial(port, baudrate, timeout=0.1)
+        self.buffer = bytearray()
+        self.request_id = 0
+
+    def send(self, msg_type, body=b""):
+        self.request_id = (self.request_id + 1) & 0xFFFF
+        self.port.write(encode(msg_type, self.request_id, body))
+        return self.request_id
+
+    def receive(self, timeout=2.0):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            self.buffer += self.port.read(self.port.in_waiting or 1)
+            while b"\x00" in self.buffer:
+                segment, _, rest = bytes(self.buffer).partition(b"\x00")
+                self.buffer = bytearray(rest)
+                if segment:
+                    message = decode(segment)
+                    if message is not None:
+                        return message
+        return None
+
+    def receive_json(self, timeout=2.0):
+        """Returns the next JSON line printed by the firmware, or None."""
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            self.buffer += self.port.read(self.port.in_waiting or 1)
+            while b"\n" in self.buffer:
+                line, _, rest = bytes(self.buffer).partition(b"\n")
+                self.buffer = bytearray(rest)
+                line = line.strip(b"\r\x00")
+                if line.startswith(b"{"):
+                    try:
+                        return json.loads(line)
+                    except ValueError:
+                        pass
+        return None
+
+    def request_json(self, command, timeout=2.0):
+        self.port.write(json.dumps(command, separators=(",", ":")).encode()
+                        + b"\n")
+        while True:
+            reply = self.receive_json(timeout)
+            if reply is None:
+                raise TimeoutError("no reply to %r" % command)
+            if reply.get("id") == command.get("id"):
+                return reply
+
+    def request(self, msg_type, body=b"", timeout=2.0):
+        request_id = self.send(msg_type, body)
+        while True:
+            message = self.receive(timeout)
+            if message is None:
+                raise TimeoutError("no reply to request %d" % request_id)
+            if message[0] == REPLY_EVENT:
+                print_message(message)
+                continue
+            if message[1] == request_id:
+                return message
+
+
+def print_message(message):
+    msg_type, request_id, body = message
+    if msg_type == REPLY_ACK:
+        print("ack #%d %s (%d)" % (request_id, STATUS_NAMES[body[0]], body[1]))
+    elif msg_type == REPLY_STATUS:
+        names = {v: k for k, v in PARAMS.items()}
+        values = [struct.unpack("<Bh", body[i:i + 3])
+                  for i in range(1, len(body), 3)]
+        print("status #%d speaking=%d %s" % (request_id, body[0], " ".join(
+            "%s=%d" % (names.get(k, k), v) for k, v in values)))
+    elif msg_type == REPLY_EVENT:
+        print("event %s" % EVENT_NAMES.get(body[0], body[0]))
+
+
+def bench(conn, count):
+    """Round trips and throughput of pings carrying a full-size body."""
+    body = bytes(range(256)) * 2
+    start = time.monotonic()
+    for _ in range(count):
+        conn.request(CMD_PING, body)
+    elapsed = time.monotonic() - start
+    sent = count * len(encode(CMD_PING, 0, body))
+    print("%d round trips in %.2f s: %.1f req/s, %.1f KB/s upstream, "
+          "%.2f ms/request" % (count, elapsed, count / elapsed,
+                               sent / elapsed / 1024, elapsed / count * 1000))
+
+
+# representative JSON commands without text, so nothing is queued for speech
+JSON_BENCH_COMMANDS = [
+    {"rate": 150},
+    {"rate": 180, "pitch": 60, "volume": 70, "internal_volume": 100,
+     "pitch_range": 80},
+    {"expression": "happy", "theme": 0},
+    {"expression": "neutral", "rate": 150, "pitch": 70, "volume": 50,
+     "internal_volume": 100, "pitch_range": 100, "theme": 0},
+]
+
+
+def json_bench(conn, count):
+    """Device-side parse time (parse_us) and round trip per JSON command."""
+    for index, template in enumerate(JSON_BENCH_COMMANDS):
+        parse = []
+        start = time.monotonic()
+        for i in range(count):
+            command = dict(template, id=i)
+            reply = conn.request_json(command)
+            if not reply["ok"]:
+                raise RuntimeError("rejected: %r" % reply)
+            parse.append(reply["parse_us"])
+        elapsed = time.monotonic() - start
+        parse.sort()
+        size = len(json.dumps(dict(template, id=count),
+                              separators=(",", ":")))
+        print("#%d %3d bytes: parse avg %.1f us, p99 %d us, max %d us; "
+              "round trip %.2f ms" % (index, size, sum(parse) / count,
+                                      parse[min(count - 1, count * 99 // 100)],
+                                      parse[-1], elapsed / count * 1000))
+
+
+def stream(conn, text, interval=0.05):
+    """Sends text like an LLM emitting tokens, one word every interval.
+
+    The firmware replies busy instead of blocking while the speech queue is
+    full; the same chunk is then sent again after a short wait.
+    """
+    def send(cmd, body=b""):
+        while True:
+            status = conn.request(cmd, body)[2][0]
+            if status != 4:
+                return status
+            time.sleep(0.1)
+
+    send(CMD_STREAM_BEGIN)
+    words = text.split(" ")
+    for i, word in enumerate(words):
+        chunk = word if i == 0 else " " + word
+        send(CMD_STREAM_CHUNK, chunk.encode())
+        time.sleep(interval)
+    send(CMD_STREAM_END)
+
+
+# samples per PCM_DATA frame; keeps the COBS frame under 600 bytes
+PCM_FRAME_SAMPLES = 288
+
+
+def send_pcm(conn, path):
+    """Streams a WAV file, backing off while the jitter buffer is full."""
+    with wave.open(path, "rb") as wav:
+        if wav.getsampwidth() != 2 or wav.getnchannels() != 1:
+            raise ValueError("expected 16-bit mono WAV")
+        rate = wav.getframerate()
+        data = wav.readframes(wav.getnframes())
+    status = conn.request(CMD_PCM_BEGIN, struct.pack("<I", rate))[2][0]
+    if status != 0:
+        raise RuntimeError("PCM_BEGIN rejected: %s" % STATUS_NAMES[status])
+    step = PCM_FRAME_SAMPLES * 2
+    busy = 0
+    start = time.monotonic()
+    offset = 0
+    while offset < len(data):
+        body = conn.request(CMD_PCM_DATA, data[offset:offset + step])[2]
+        if body[0] == 4:
+            busy += 1
+            time.sleep(0.01)
+            continue
+        if body[0] != 0:
+            raise RuntimeError("PCM_DATA failed: %s" % STATUS_NAMES[body[0]])
+        offset += step
+    elapsed = time.monotonic() - start
+    conn.request(CMD_PCM_END)
+    print("%d samples at %d Hz in %.2f s: %.1f KB/s (%.2fx realtime), "
+          "%d busy replies" % (len(data) // 2, rate, elapsed,
+                               len(data) / elapsed / 1024,
+                               len(data) / 2 / rate / elapsed, busy))
+
+
+def dump(conn, path, text=""):
+    """Reassembles a WAV dump and writes its metadata next to it as JSON."""
+    request_id = conn.send(CMD_DUMP, text.encode())
+    info = {}
+    levels = bytearray()
+    wav = bytearray()
+    start = time.monotonic()
+    while True:
+        message = conn.receive(timeout=20.0)
+        if message is None:
+            raise TimeoutError("dump did not finish")
+        msg_type, reply_id, body = message
+        if reply_id != request_id:
+            continue
+        if msg_type == REPLY_ACK:
+            raise RuntimeError("dump failed: %s" % STATUS_NAMES[body[0]])
+        if msg_type == REPLY_DUMP_INFO:
+            for line in body.decode(errors="replace").split("\n"):
+                key, _, value = line.partition("=")
+                info[key] = value if key == "text" else float(value)
+        elif msg_type == REPLY_DUMP_LEVELS:
+            levels += body
+        elif msg_type == REPLY_DUMP_DATA:
+            offset = struct.unpack("<I", body[:4])[0]
+            if offset != len(wav):
+                raise RuntimeError("lost data at offset %d (have %d)"
+                                   % (offset, len(wav)))
+            wav += body[4:]
+        elif msg_type == REPLY_DUMP_END:
+            total, crc = struct.unpack("<IH", body)
+            break
+    elapsed = time.monotonic() - start
+    if total != len(wav) or crc != crc16(wav):
+        raise RuntimeError("WAV corrupted: %d of %d bytes, CRC %04x != %04x"
+                           % (len(wav), total, crc16(wav), crc))
+    with open(path, "wb") as f:
+        f.write(wav)
+    info["levels"] = list(levels)
+    with open(path.rsplit(".", 1)[0] + ".json", "w") as f:
+        json.dump(info, f, indent=2)
+    print("%s: %d bytes in %.2f s (%.1f KB/s), %d ms of audio, "
+          "synthesized in %.1f ms" % (path, len(wav), elapsed,
+                                      len(wav) / elapsed / 1024,
+                                      info.get("duration_ms", 0),
+                                      info.get("synth_ms", 0)))
+
+
+# Telemetry::Record and Telemetry::TaskRecord of src/main.cpp (version 1)
+TELEMETRY_RECORD = struct.Struct("<BIIIIIIIHIIBBHIBIB")
+TELEMETRY_FIELDS = [
+    "version", "sequence", "millis", "heap_free", "heap_min_free",
+    "heap_largest", "psram_free", "psram_largest", "fps", "frame_us",
+    "max_frame_us", "speaking", "shed_level", "synth_realtime",
+    "pcm_buffered_samples", "speaker_queued", "audio_underruns", "task_count",
+]
+TELEMETRY_TASK = struct.Struct("<8sHI")
+CPU_UNAVAILABLE = 0xFFFF
+
+
+def decode_telemetry(body):
+    """Returns a flat dict with <task>_cpu and <task>_stack columns."""
+    values = TELEMETRY_RECORD.unpack_from(body)
+    row = dict(zip(TELEMETRY_FIELDS, values))
+    if row["version"] != 1:
+        raise ValueError("unknown telemetry version %d" % row["version"])
+    row["fps"] /= 10.0
+    row["synth_realtime"] /= 1000.0
+    for i in range(row["task_count"]):
+        name, cpu, stack = TELEMETRY_TASK.unpack_from(
+            body, TELEMETRY_RECORD.size + i * TELEMETRY_TASK.size)
+        name = name.rstrip(b"\0").decode(errors="replace")
+        row[name + "_cpu"] = "" if cpu == CPU_UNAVAILABLE else cpu / 10.0
+        row[name + "_stack"] = stack
+    return row
+
+
+# m5avatar::Metrics (lib/M5Stack-Avatar/src/Metrics.cpp)
+METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM = range(3)
+HISTOGRAM_BOUNDS = [50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000,
+                    100000, 200000, 500000, 1000000, 2000000, None]
+
+
+def histogram_percentile(count, max_us, buckets, percent):
+    """Upper bound of the bucket holding the percentile, like the device."""
+    if count == 0:
+        return 0
+    rank = (count * percent + 99) // 100
+    seen = 0
+    for bound, n in zip(HISTOGRAM_BOUNDS, buckets):
+        seen += n
+        if seen >= rank and seen > 0:
+            return max_us if bound is None else min(bound, max_us)
+    return max_us
+
+
+def decode_metrics(body):
+    """Returns (telemetry sequence, flat dict of metric columns)."""
+    sequence = struct.unpack_from("<I", body)[0]
+    row = {}
+    offset = 4
+    while offset < len(body):
+        metric_type, name_len = body[offset], body[offset + 1]
+        name = body[offset + 2:offset + 2 + name_len].decode(errors="replace")
+        offset += 2 + name_len
+        if metric_type != METRIC_HISTOGRAM:
+            row[name] = struct.unpack_from("<i", body, offset)[0]
+            offset += 4
+            continue
+        values = struct.unpack_from("<%dI" % (3 + len(HISTOGRAM_BOUNDS)),
+                                    body, offset)
+        offset += 4 * len(values)
+        count, sum_us, max_us, buckets = values[0], values[1], values[2], \
+            values[3:]
+        row[name + ".count"] = count
+        row[name + ".mean"] = sum_us // count if count else 0
+        row[name + ".p50"] = histogram_percentile(count, max_us, buckets, 50)
+        row[name + ".p99"] = histogram_percentile(count, max_us, buckets, 99)
+        row[name + ".max"] = max_us
+    return sequence, row
+
+
+def telemetry(conn, interval, path=None):
+    """Writes telemetry records, with the metrics sent after each, as CSV
+    until interrupted.
+
+    Columns are fixed by the first row; tasks and metrics that appear later
+    are dropped.
+    """
+    status = conn.request(CMD_TELEMETRY, struct.pack("<H", interval))[2][0]
+    if status != 0:
+        raise RuntimeError("telemetry rejected: %s" % STATUS_NAMES[status])
+    out = open(path, "w", newline="") if path else sys.stdout
+    writer = None
+    last_sequence = None
+    lost = 0
+    row = None
+
+    def write(row):
+        nonlocal writer
+        if writer is None:
+            writer = csv.DictWriter(out, fieldnames=list(row),
+                                    extrasaction="ignore")
+            writer.writeheader()
+        writer.writerow(row)
+        out.flush()
+
+    try:
+        while True:
+            message = conn.receive(timeout=max(2.0, interval / 500.0))
+            if message is None:
+                continue
+            if message[0] == REPLY_METRICS:
+                sequence, metrics = decode_metrics(message[2])
+                if row is not None and row["sequence"] == sequence:
+                    row.update(metrics)
+                continue
+            if message[0] != REPLY_TELEMETRY:
+                continue
+            # a row is complete once the next record arrives
+            if row is not None:
+                write(row)
+            row = decode_telemetry(message[2])
+            if last_sequence is not None:
+                lost += (row["sequence"] - last_sequence - 1) & 0xFFFFFFFF
+            last_sequence = row["sequence"]
+    except KeyboardInterrupt:
+        if row is not None:
+            write(row)
+    finally:
+        conn.request(CMD_TELEMETRY, struct.pack("<H", 0))
+        if path:
+            out.close()
+        print("%d records lost" % lost, file=sys.stderr)
+
+
+def record_dump(conn, path):
+    """Downloads the device's recording as the raw entry stream."""
+    conn.port.write(b"record_dump\n")
+    data = bytearray()
+    while True:
+        message = conn.receive(timeout=5.0)
+        if message is None:
+            raise TimeoutError("record_dump did not finish")
+        msg_type, _, body = message
+        if msg_type == REPLY_RECORD_DATA:
+            offset = struct.unpack("<I", body[:4])[0]
+            if offset != len(data):
+                raise RuntimeError("lost data at offset %d" % offset)
+            data += body[4:]
+        elif msg_type == REPLY_RECORD_END:
+            total, entries, crc = struct.unpack("<IIH", body)
+            break
+    if total != len(data) or crc != crc16(data):
+        raise RuntimeError("recording corrupted")
+    with open(path, "wb") as f:
+        f.write(data)
+    duration = sum(delta for delta, _, _ in read_recording(data)[1:]) / 1e6
+    print("%s: %d entries, %d bytes, %.1f s" % (path, entries, total, duration))
+
+
+def read_recording(data):
+    """Returns [(delta us, type, payload)] of a recording."""
+    entries = []
+    offset = 0
+    while offset < len(data):
+        delta, entry_type, length = struct.unpack_from("<IBH", data, offset)
+        offset += 7
+        entries.append((delta, entry_type, bytes(data[offset:offset + length])))
+        offset += length
+    return entries
+
+
+def replay(conn, path):
+    """Re-sends a recording with its original timing.
+
+    Button presses are sent as the `button` command.
+    """
+    with open(path, "rb") as f:
+        entries = read_recording(f.read())
+    start = time.monotonic()
+    due = start
+    late = 0.0
+    for i, (delta, entry_type, payload) in enumerate(entries):
+        if i > 0:
+            due += delta / 1e6
+        wait = due - time.monotonic()
+        if wait > 0:
+            time.sleep(wait)
+        else:
+            late = max(late, -wait)
+        if entry_type == ENTRY_LINE:
+            conn.port.write(payload + b"\n")
+        elif entry_type == ENTRY_FRAME:
+            conn.port.write(b"\x00" + payload + b"\x00")
+        elif entry_type == ENTRY_BUTTON:
+            conn.port.write(b"button\n")
+    print("%d entries in %.1f s, max %.1f ms late"
+          % (len(entries), time.monotonic() - start, late * 1000))
+
+
+# event of a trace dump (Tracing::send in src/main.cpp)
+TRACE_EVENT = struct.Struct("<IIBBBc")
+
+
+def trace_timestamps(events, cpu_mhz):
+    """Returns the time of each event in microseconds.
+
+    The cycle counter gives sub-microsecond resolution but wraps every
+    2^32 / cpu_mhz us and runs separately on each core, so each core's cycles
+    are anchored to the shared microsecond clock and re-anchored whenever the
+    two disagree (a wrap, or a gap longer than one).
+    """
+    anchors = {}
+    stamps = []
+    micros_base = 0
+    last_micros = None
+    for cycles, micros, _, _, core, _ in events:
+        if last_micros is not None and micros < last_micros - (1 << 31):
+            micros_base += 1 << 32
+        last_micros = micros
+        micros += micros_base
+        anchor = anchors.get(core)
+        if anchor is not None:
+            ts = anchor[1] + ((cycles - anchor[0]) & 0xFFFFFFFF) / cpu_mhz
+            if abs(ts - micros) < 2.0:
+                stamps.append(ts)
+                continue
+        anchors[core] = (cycles, micros)
+        stamps.append(float(micros))
+    return stamps
+
+
+def chrome_trace(info, events):
+    """Converts a trace dump to the Chrome trace event format."""
+    names = {int(k[5:]): v for k, v in info.items() if k.startswith("name.")}
+    tasks = {int(k[5:]): v for k, v in info.items() if k.startswith("task.")}
+    stamps = trace_timestamps(events, float(info.get("cpu_mhz", 240)))
+    start = min(stamps) if stamps else 0.0
+    out = [{"name": "process_name", "ph": "M", "pid": 0,
+            "args": {"name": "stackchan"}}]
+    for task, name in sorted(tasks.items()):
+        out.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": task,
+                    "args": {"name": name}})
+    depth = {}
+    for (_, _, name, task, core, phase), ts in zip(events, stamps):
+        phase = phase.decode()
+        # the ring may start in the middle of a span
+        if phase == "E":
+            if depth.get(task, 0) == 0:
+                continue
+            depth[task] -= 1
+        elif phase == "B":
+            depth[task] = depth.get(task, 0) + 1
+        event = {"name": names.get(name, "#%d" % name), "ph": phase,
+                 "ts": round(ts - start, 3), "pid": 0, "tid": task,
+                 "args": {"core": core}}
+        if phase == "i":
+            event["s"] = "t"
+        out.append(event)
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def trace(conn, path):
+    """Downloads the device's trace and writes it as Chrome trace JSON."""
+    conn.port.write(b"trace_dump\n")
+    info = {}
+    data = bytearray()
+    while True:
+        message = conn.receive(timeout=5.0)
+        if message is None:
+            raise TimeoutError("trace_dump did not finish")
+        msg_type, _, body = message
+        if msg_type == REPLY_TRACE_INFO:
+            for line in body.decode(errors="replace").split("\n"):
+                key, _, value = line.partition("=")
+                info[key] = value
+        elif msg_type == REPLY_TRACE_DATA:
+            index = struct.unpack("<I", body[:4])[0]
+            if index * TRACE_EVENT.size != len(data):
+                raise RuntimeError("lost events at %d" % index)
+            data += body[4:]
+        elif msg_type == REPLY_TRACE_END:
+            count, crc = struct.unpack("<IH", body)
+            break
+    if count * TRACE_EVENT.size != len(data) or crc != crc16(data):
+        raise RuntimeError("trace corrupted")
+    events = list(TRACE_EVENT.iter_unpack(data))
+    with open(path, "w") as f:
+        json.dump(chrome_trace(info, events), f)
+    stamps = trace_timestamps(events, float(info.get("cpu_mhz", 240)))
+    span = (max(stamps) - min(stamps)) / 1e3 if stamps else 0.0
+    print("%s: %d events over %.1f ms, %s overwritten (open in "
+          "ui.perfetto.dev or chrome://tracing)"
+          % (path, count, span, info.get("dropped", "0")))
+
+
+def main(argv):
+    if len(argv) < 3:
+        print(__doc__)
+        return 1
+    conn = Connection(argv[1])
+    command = argv[2]
+    if command == "ping":
+        print_message(conn.request(CMD_PING))
+    elif command == "speak":
+        print_message(conn.request(CMD_SPEAK, " ".join(argv[3:]).encode()))
+        for _ in range(2):
+            message = conn.receive(timeout=20.0)
+            if message is not None:
+                print_message(message)
+    elif command == "set":
+        pairs = [(k, int(v)) for k, v in (a.split("=") for a in argv[3:])]
+        print_message(conn.request(CMD_SET_PARAMS, encode_params(pairs)))
+    elif command == "status":
+        print_message(conn.request(CMD_GET_STATUS))
+    elif command == "stream":
+        stream(conn, sys.stdin.read())
+    elif command == "pcm":
+        send_pcm(conn, argv[3])
+    elif command == "dump":
+        dump(conn, argv[3], " ".join(argv[4:]))
+    elif command == "telemetry":
+        telemetry(conn, int(argv[3]) if len(argv) > 3 else 1000,
+                  argv[4] if len(argv) > 4 else None)
+    elif command == "json":
+        print(conn.request_json(json.loads(argv[3])))
+    elif command == "json-bench":
+        json_bench(conn, int(argv[3]) if len(argv) > 3 else 200)
+    elif command == "record-dump":
+        record_dump(conn, argv[3])
+    elif command == "replay":
+        replay(conn, argv[3])
+    elif command == "trace":
+        trace(conn, argv[3])
+    elif command == "bench":
+        bench(conn, int(argv[3]) if len(argv) > 3 else 200)
+    else:
+        print(__doc__)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,558 @@
+#!/usr/bin/env python3
+"""Tests of the host side of the serial protocol (stackchan_serial.py).
+
+Run from the repository root:
+  python3 -m unittest discover -s tools
+Needs no device and no pyserial.
+"""
+
+import contextlib
+import csv
+import io
+import json
+import os
+import random
+import re
+import struct
+import sys
+import tempfile
+import unittest
+import wave
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import stackchan_serial as sc  # noqa: E402
+
+
+def payload(msg_type, request_id, body):
+    """Unframed payload as the firmware builds it."""
+    data = struct.pack("<BBH", sc.MAGIC, msg_type, request_id) + body
+    return data + struct.pack("<H", sc.crc16(data))
+
+
+class FakePort:
+    """Serial port replaying what the firmware would have printed.
+
+    incoming is bytes, or a list of chunks that arrive one read at a time.
+    """
+
+    def __init__(self, incoming=b"", after_interrupt=None):
+        if isinstance(incoming, bytes):
+            incoming = [incoming]
+        self.chunks = [bytearray(c) for c in incoming]
+        self.written = bytearray()
+        # once incoming runs dry, raise KeyboardInterrupt like Ctrl-C and
+        # continue with these bytes
+        self.after_interrupt = after_interrupt
+
+    @property
+    def in_waiting(self):
+        return len(self.chunks[0]) if self.chunks else 0
+
+    def read(self, size):
+        if not self.chunks:
+            if self.after_interrupt is None:
+                return b""
+            self.chunks = [bytearray(self.after_interrupt)]
+            self.after_interrupt = None
+            raise KeyboardInterrupt
+        data = bytes(self.chunks[0][:size])
+        del self.chunks[0][:size]
+        if not self.chunks[0]:
+            del self.chunks[0]
+        return data
+
+    def write(self, data):
+        self.written += data
+
+
+def connection(incoming, after_interrupt=None):
+    """A Connection reading from a FakePort; the first request gets id 1."""
+    conn = sc.Connection.__new__(sc.Connection)
+    conn.port = FakePort(incoming, after_interrupt)
+    conn.buffer = bytearray()
+    conn.request_id = 0
+    return conn
+
+
+def quiet():
+    return contextlib.redirect_stdout(io.StringIO())
+
+
+def dump_frames(request_id, samples, text="hello"):
+    """Frames of AudioDump::send (src/main.cpp) for the given samples."""
+    pcm = struct.pack("<%dh" % len(samples), *samples)
+    header = (b"RIFF" + struct.pack("<I", 36 + len(pcm)) + b"WAVEfmt " +
+              struct.pack("<IHHIIHH", 16, 1, 1, 22050, 22050 * 2, 2, 16) +
+              b"data" + struct.pack("<I", len(pcm)))
+    wav = header + pcm
+    info = ("sample_rate=22050\nsamples=%d\nduration_ms=%d\nsynth_ms=12.5\n"
+            "text=%s" % (len(samples), len(samples) * 1000 // 22050, text))
+    levels = bytes(i % 13 for i in range((len(samples) + 511) // 512))
+    frames = [sc.encode(sc.REPLY_DUMP_INFO, request_id, info.encode()),
+              sc.encode(sc.REPLY_DUMP_LEVELS, request_id, levels)]
+    for offset in range(0, len(wav), 512):
+        frames.append(sc.encode(sc.REPLY_DUMP_DATA, request_id,
+                                struct.pack("<I", offset) +
+                                wav[offset:offset + 512]))
+    frames.append(sc.encode(sc.REPLY_DUMP_END, request_id,
+                            struct.pack("<IH", len(wav), sc.crc16(wav))))
+    return frames, levels
+
+
+class CrcTest(unittest.TestCase):
+    def test_check_value(self):
+        # CRC-16/CCITT-FALSE
+        self.assertEqual(sc.crc16(b"123456789"), 0x29B1)
+
+    def test_empty(self):
+        self.assertEqual(sc.crc16(b""), 0xFFFF)
+
+
+class CobsTest(unittest.TestCase):
+    def assert_round_trip(self, data):
+        encoded = sc.cobs_encode(data)
+        self.assertNotIn(0, encoded)
+        self.assertEqual(sc.cobs_decode(encoded), data)
+
+    def test_round_trip_sizes(self):
+        rng = random.Random(1)
+        for size in (0, 1, 2, 253, 254, 255, 256, 508, 509, 597):
+            with self.subTest(size=size):
+                self.assert_round_trip(
+                    bytes(rng.randrange(256) for _ in range(size)))
+                self.assert_round_trip(bytes(size))
+                self.assert_round_trip(
+                    bytes(rng.randrange(1, 256) for _ in range(size)))
+
+    def test_run_of_254_non_zero_bytes(self):
+        data = bytes(range(1, 255))
+        encoded = sc.cobs_encode(data)
+        # a full block needs no implied zero, then an empty final block
+        self.assertEqual(encoded, b"\xff" + data + b"\x01")
+        self.assertEqual(sc.cobs_decode(encoded), data)
+
+    def test_run_of_255_non_zero_bytes(self):
+        data = bytes(range(1, 255)) + b"\x07"
+        self.assertEqual(sc.cobs_encode(data),
+                         b"\xff" + data[:254] + b"\x02\x07")
+        self.assert_round_trip(data)
+
+    def test_zero_after_full_block(self):
+        self.assert_round_trip(bytes(range(1, 255)) + b"\x00\x01")
+
+    def test_known_encodings(self):
+        self.assertEqual(sc.cobs_encode(b""), b"\x01")
+        self.assertEqual(sc.cobs_encode(b"\x00"), b"\x01\x01")
+        self.assertEqual(sc.cobs_encode(b"\x11\x00\x22"), b"\x02\x11\x02\x22")
+
+    def test_malformed(self):
+        for frame in (b"\x00", b"\x03\x11\x00", b"\x05\x11\x22",
+                      b"\x02\x11\x04\x22"):
+            with self.subTest(frame=frame):
+                with self.assertRaises(ValueError):
+                    sc.cobs_decode(frame)
+
+
+class FrameTest(unittest.TestCase):
+    def test_round_trip(self):
+        body = bytes(range(256)) * 2
+        frame = sc.encode(sc.CMD_PING, 0x1234, body)
+        self.assertEqual(frame[:1], b"\x00")
+        self.assertEqual(frame[-1:], b"\x00")
+        self.assertNotIn(0, frame[1:-1])
+        self.assertEqual(sc.decode(frame[1:-1]), (sc.CMD_PING, 0x1234, body))
+
+    def test_empty_body(self):
+        frame = sc.encode(sc.CMD_GET_STATUS, 7)
+        self.assertEqual(sc.decode(frame[1:-1]), (sc.CMD_GET_STATUS, 7, b""))
+
+    def test_rejects_bad_crc(self):
+        data = bytearray(payload(sc.REPLY_ACK, 1, b"\x00\x00"))
+        data[-1] ^= 0x01
+        self.assertIsNone(sc.decode(sc.cobs_encode(bytes(data))))
+
+    def test_rejects_corrupted_body(self):
+        data = bytearray(payload(sc.REPLY_ACK, 1, b"\x00\x00"))
+        data[4] ^= 0x80
+        self.assertIsNone(sc.decode(sc.cobs_encode(bytes(data))))
+
+    def test_rejects_bad_magic(self):
+        data = bytearray(payload(sc.REPLY_ACK, 1, b""))
+        data[0] = 0x5A
+        data[-2:] = struct.pack("<H", sc.crc16(bytes(data[:-2])))
+        self.assertIsNone(sc.decode(sc.cobs_encode(bytes(data))))
+
+    def test_rejects_short(self):
+        self.assertIsNone(sc.decode(sc.cobs_encode(b"\xa5\x80\x01\x00\x00")))
+
+    def test_rejects_malformed_cobs(self):
+        self.assertIsNone(sc.decode(b"\x09\xa5\x80"))
+
+    def test_encode_params(self):
+        self.assertEqual(sc.encode_params([("rate", 180), ("pitch", -1)]),
+                         b"\x02\xb4\x00\x03\xff\xff")
+
+
+class DumpTest(unittest.TestCase):
+    SAMPLES = [int(8000 * ((i % 50) - 25) / 25) for i in range(3000)]
+
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.dir.name, "out.wav")
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def run_dump(self, frames, text=""):
+        conn = connection(b"".join(frames))
+        with quiet():
+            sc.dump(conn, self.path, text)
+        return conn
+
+    def test_writes_wav_and_metadata(self):
+        frames, levels = dump_frames(1, self.SAMPLES)
+        # log text and replies to other requests are skipped
+        frames.insert(1, b"\n[I][DUMP] Sent\n")
+        frames.insert(2, sc.encode(sc.REPLY_ACK, 9, b"\x00"))
+        conn = self.run_dump(frames, "hello")
+        self.assertEqual(sc.decode(bytes(conn.port.written[1:-1])),
+                         (sc.CMD_DUMP, 1, b"hello"))
+        with wave.open(self.path, "rb") as wav:
+            self.assertEqual(wav.getnchannels(), 1)
+            self.assertEqual(wav.getsampwidth(), 2)
+            self.assertEqual(wav.getframerate(), 22050)
+            data = wav.readframes(wav.getnframes())
+        self.assertEqual(list(struct.unpack("<%dh" % len(self.SAMPLES), data)),
+                         self.SAMPLES)
+        with open(os.path.join(self.dir.name, "out.json")) as f:
+            info = json.load(f)
+        self.assertEqual(info["text"], "hello")
+        self.assertEqual(info["samples"], len(self.SAMPLES))
+        self.assertEqual(info["synth_ms"], 12.5)
+        self.assertEqual(info["levels"], list(levels))
+
+    def test_lost_frame(self):
+        frames, _ = dump_frames(1, self.SAMPLES)
+        del frames[3]
+        with self.assertRaisesRegex(RuntimeError, "lost data"):
+            self.run_dump(frames)
+
+    def test_crc_mismatch(self):
+        frames, _ = dump_frames(1, self.SAMPLES)
+        end = sc.decode(frames[-1][1:-1])[2]
+        total, crc = struct.unpack("<IH", end)
+        frames[-1] = sc.encode(sc.REPLY_DUMP_END, 1,
+                               struct.pack("<IH", total, crc ^ 1))
+        with self.assertRaisesRegex(RuntimeError, "WAV corrupted"):
+            self.run_dump(frames)
+        self.assertFalse(os.path.exists(self.path))
+
+    def test_failure_ack(self):
+        with self.assertRaisesRegex(RuntimeError, "failed"):
+            self.run_dump([sc.encode(sc.REPLY_ACK, 1, b"\x06")])
+
+
+def telemetry_body(sequence, tasks=(), version=1):
+    """Telemetry::Record followed by its TaskRecords (src/main.cpp)."""
+    body = struct.pack("<BIIIIIIIHIIBBHIBIB", version, sequence, 1000 * sequence,
+                       200000, 150000, 110000, 7000000, 4000000, 297,
+                       33000, 41000, 1, 2, 1250, 4410, 3, 5, len(tasks))
+    for name, cpu, stack in tasks:
+        body += struct.pack("<8sHI", name, cpu, stack)
+    return body
+
+
+class TelemetryTest(unittest.TestCase):
+    TASKS = [(b"loopTask", 412, 3100), (b"rx", sc.CPU_UNAVAILABLE, 900)]
+
+    def test_layout_matches_packed_structs(self):
+        self.assertEqual(sc.TELEMETRY_RECORD.size, 53)
+        self.assertEqual(sc.TELEMETRY_TASK.size, 14)
+        self.assertEqual(len(sc.TELEMETRY_FIELDS),
+                         len(sc.TELEMETRY_RECORD.unpack(bytes(53))))
+
+    def test_decode(self):
+        row = sc.decode_telemetry(telemetry_body(7, self.TASKS))
+        self.assertEqual(row["sequence"], 7)
+        self.assertEqual(row["millis"], 7000)
+        self.assertEqual(row["psram_largest"], 4000000)
+        self.assertEqual(row["fps"], 29.7)
+        self.assertEqual(row["synth_realtime"], 1.25)
+        self.assertEqual(row["audio_underruns"], 5)
+        self.assertEqual(row["task_count"], 2)
+        # a name filling all 8 bytes has no terminator
+        self.assertEqual(row["loopTask_cpu"], 41.2)
+        self.assertEqual(row["loopTask_stack"], 3100)
+        self.assertEqual(row["rx_cpu"], "")
+        self.assertEqual(row["rx_stack"], 900)
+
+    def test_rejects_unknown_version(self):
+        with self.assertRaises(ValueError):
+            sc.decode_telemetry(telemetry_body(1, version=2))
+
+    def test_csv(self):
+        frames = [sc.encode(sc.REPLY_ACK, 1, b"\x00")]
+        for sequence, tasks in ((1, self.TASKS[:1]), (2, self.TASKS[:1]),
+                                (4, self.TASKS)):
+            frames.append(sc.encode(sc.REPLY_TELEMETRY, 0,
+                                    telemetry_body(sequence, tasks)))
+        conn = connection(frames, after_interrupt=sc.encode(sc.REPLY_ACK, 2, b"\x00"))
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "t.csv")
+            stderr = io.StringIO()
+            with contextlib.redirect_stderr(stderr):
+                sc.telemetry(conn, 100, path)
+            with open(path, newline="") as f:
+                rows = list(csv.DictReader(f))
+        self.assertEqual([r["sequence"] for r in rows], ["1", "2", "4"])
+        # columns come from the first row; the later task is dropped
+        self.assertIn("loopTask_cpu", rows[0])
+        self.assertNotIn("rx_cpu", rows[2])
+        self.assertIn("1 records lost", stderr.getvalue())
+        # start at 100 ms, then stop
+        written = [sc.decode(f) for f in bytes(conn.port.written).split(b"\0")
+                   if f]
+        self.assertEqual(written, [(sc.CMD_TELEMETRY, 1, b"\x64\x00"),
+                                   (sc.CMD_TELEMETRY, 2, b"\x00\x00")])
+
+
+def recording(*entries):
+    """Recorder ring contents: [delta u32][type u8][length u16][payload]."""
+    return b"".join(struct.pack("<IBH", delta, entry_type, len(data)) + data
+                    for delta, entry_type, data in entries)
+
+
+class RecordingTest(unittest.TestCase):
+    FRAME = sc.encode(sc.CMD_PING, 3)[1:-1]
+    ENTRIES = [(0, sc.ENTRY_LINE, b"rate:180"),
+               (1500, sc.ENTRY_FRAME, FRAME),
+               (2500, sc.ENTRY_BUTTON, b""),
+               (1000, sc.ENTRY_LINE, b'{"id":1,"text":"Hi"}')]
+
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.dir.name, "out.rec")
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def dump_frames(self, data, piece=16):
+        frames = [sc.encode(sc.REPLY_RECORD_DATA, 0,
+                            struct.pack("<I", offset) +
+                            data[offset:offset + piece])
+                  for offset in range(0, len(data), piece)]
+        frames.append(sc.encode(sc.REPLY_RECORD_END, 0, struct.pack(
+            "<IIH", len(data), len(self.ENTRIES), sc.crc16(data))))
+        return frames
+
+    def test_read_recording(self):
+        data = recording(*self.ENTRIES)
+        self.assertEqual(sc.read_recording(data), self.ENTRIES)
+        self.assertEqual(sc.read_recording(b""), [])
+
+    def test_record_dump(self):
+        data = recording(*self.ENTRIES)
+        conn = connection(self.dump_frames(data))
+        with quiet() as out:
+            sc.record_dump(conn, self.path)
+        self.assertEqual(bytes(conn.port.written), b"record_dump\n")
+        with open(self.path, "rb") as f:
+            self.assertEqual(f.read(), data)
+        self.assertIn("4 entries", out.getvalue())
+        self.assertIn("0.0 s", out.getvalue())
+
+    def test_record_dump_lost_piece(self):
+        frames = self.dump_frames(recording(*self.ENTRIES))
+        del frames[1]
+        with self.assertRaisesRegex(RuntimeError, "lost data"):
+            sc.record_dump(connection(frames), self.path)
+
+    def test_record_dump_bad_crc(self):
+        data = recording(*self.ENTRIES)
+        frames = self.dump_frames(data)
+        frames[-1] = sc.encode(sc.REPLY_RECORD_END, 0, struct.pack(
+            "<IIH", len(data), 4, sc.crc16(data) ^ 0x8000))
+        with self.assertRaisesRegex(RuntimeError, "corrupted"):
+            sc.record_dump(connection(frames), self.path)
+        self.assertFalse(os.path.exists(self.path))
+
+    def test_replay(self):
+        with open(self.path, "wb") as f:
+            f.write(recording(*self.ENTRIES))
+        conn = connection(b"")
+        with quiet():
+            sc.replay(conn, self.path)
+        self.assertEqual(bytes(conn.port.written),
+                         b"rate:180\n" + b"\x00" + self.FRAME + b"\x00" +
+                         b"button\n" + b'{"id":1,"text":"Hi"}\n')
+
+
+def histogram(samples):
+    """(count, max, buckets) as Metrics::record would accumulate them."""
+    buckets = [0] * len(sc.HISTOGRAM_BOUNDS)
+    for us in samples:
+        buckets[next(i for i, bound in enumerate(sc.HISTOGRAM_BOUNDS)
+                     if bound is None or us <= bound)] += 1
+    return len(samples), max(samples, default=0), buckets
+
+
+class MetricsTest(unittest.TestCase):
+    def test_bounds_match_device(self):
+        path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..",
+                            "lib", "M5Stack-Avatar", "src", "Metrics.cpp")
+        with open(path) as f:
+            source = f.read()
+        table = re.search(r"HISTOGRAM_BOUNDS\[HISTOGRAM_BUCKETS\] = \{(.*?)\}",
+                          source, re.S).group(1)
+        bounds = [None if v.strip() == "UINT32_MAX" else int(v)
+                  for v in table.split(",")]
+        self.assertEqual(bounds, sc.HISTOGRAM_BOUNDS)
+
+    # the same cases as test/test_metrics (Metrics::percentile)
+    def test_percentile(self):
+        cases = [
+            ([], 50, 0),
+            ([730], 0, 730),
+            ([730], 99, 730),
+            ([30] * 99 + [4200], 50, 50),
+            ([30] * 99 + [4200], 99, 50),
+            ([30] * 99 + [4200], 100, 4200),
+            ([80] * 50 + [15000] * 51, 50, 15000),
+            ([80] * 50 + [15000] * 51, 49, 100),
+            ([3000000, 9000000], 50, 9000000),
+        ]
+        for samples, percent, expected in cases:
+            with self.subTest(samples=samples[-1:], n=len(samples),
+                              percent=percent):
+                count, max_us, buckets = histogram(samples)
+                self.assertEqual(sc.histogram_percentile(
+                    count, max_us, buckets, percent), expected)
+
+    def test_decode_metrics(self):
+        count, max_us, buckets = histogram([30] * 99 + [4200])
+        body = struct.pack("<I", 42)
+        body += struct.pack("<BB", sc.METRIC_COUNTER, 6) + b"frames"
+        body += struct.pack("<i", 1234)
+        body += struct.pack("<BB", sc.METRIC_GAUGE, 5) + b"queue"
+        body += struct.pack("<i", -3)
+        body += struct.pack("<BB", sc.METRIC_HISTOGRAM, 6) + b"refill"
+        body += struct.pack("<19I", count, 30 * 99 + 4200, max_us, *buckets)
+        sequence, row = sc.decode_metrics(body)
+        self.assertEqual(sequence, 42)
+        self.assertEqual(row, {
+            "frames": 1234, "queue": -3,
+            "refill.count": 100, "refill.mean": 71, "refill.p50": 50,
+            "refill.p99": 50, "refill.max": 4200,
+        })
+
+    def test_decode_empty_histogram(self):
+        body = struct.pack("<I", 1) + struct.pack("<BB", sc.METRIC_HISTOGRAM,
+                                                  1) + b"h" + bytes(19 * 4)
+        _, row = sc.decode_metrics(body)
+        self.assertEqual(row["h.mean"], 0)
+        self.assertEqual(row["h.p99"], 0)
+
+
+def event(cycles, micros, name=0, task=0, core=0, phase=b"B"):
+    return (cycles, micros, name, task, core, phase)
+
+
+class TraceTest(unittest.TestCase):
+    INFO = {"cpu_mhz": "240", "dropped": "0", "name.0": "frame",
+            "name.1": "speech.queued", "task.0": "loopTask", "task.1": "rx"}
+
+    def test_cycles_refine_micros(self):
+        events = [event(1000, 100),
+                  event(1000 + 240 * 5 + 120, 105),
+                  # the other core has its own counter
+                  event(999999, 103, core=1),
+                  event(999999 + 240 * 2, 105, core=1)]
+        self.assertEqual(sc.trace_timestamps(events, 240.0),
+                         [100.0, 105.5, 103.0, 105.0])
+
+    def test_cycle_counter_wrap(self):
+        events = [event(0xFFFFFF00, 1000), event(0x100, 1002)]
+        stamps = sc.trace_timestamps(events, 240.0)
+        self.assertAlmostEqual(stamps[1], 1000 + 0x200 / 240.0)
+
+    def test_reanchors_when_clocks_disagree(self):
+        # a gap longer than one wrap of the cycle counter
+        events = [event(1000, 100), event(500, 5000), event(500 + 240, 5001)]
+        self.assertEqual(sc.trace_timestamps(events, 240.0),
+                         [100.0, 5000.0, 5001.0])
+
+    def test_micros_wrap(self):
+        events = [event(0, 0xFFFFFFF0), event(32 * 240, 0x10)]
+        self.assertEqual(sc.trace_timestamps(events, 240.0),
+                         [float(0xFFFFFFF0), float((1 << 32) + 0x10)])
+
+    def test_chrome_trace(self):
+        events = [event(0, 1000, name=0, phase=b"E"),  # span begun earlier
+                  event(240, 1001, name=0, phase=b"B"),
+                  event(480, 1002, name=1, task=1, core=1, phase=b"i"),
+                  event(720, 1003, name=0, phase=b"E"),
+                  event(960, 1004, name=7, phase=b"i")]
+        out = sc.chrome_trace(self.INFO, events)
+        self.assertEqual(out["displayTimeUnit"], "ms")
+        meta = [e for e in out["traceEvents"] if e["ph"] == "M"]
+        self.assertEqual([(e.get("tid"), e["args"]["name"]) for e in meta],
+                         [(None, "stackchan"), (0, "loopTask"), (1, "rx")])
+        self.assertEqual(
+            [e for e in out["traceEvents"] if e["ph"] != "M"], [
+                {"name": "frame", "ph": "B", "ts": 1.0, "pid": 0, "tid": 0,
+                 "args": {"core": 0}},
+                {"name": "speech.queued", "ph": "i", "ts": 2.0, "pid": 0,
+                 "tid": 1, "args": {"core": 1}, "s": "t"},
+                {"name": "frame", "ph": "E", "ts": 3.0, "pid": 0, "tid": 0,
+                 "args": {"core": 0}},
+                {"name": "#7", "ph": "i", "ts": 4.0, "pid": 0, "tid": 0,
+                 "args": {"core": 0}, "s": "t"},
+            ])
+
+    def dump_frames(self, events, crc_error=0):
+        """Frames of Tracing::send (src/main.cpp)."""
+        lines = ["%s=%s" % item for item in self.INFO.items()]
+        frames = [sc.encode(sc.REPLY_TRACE_INFO, 0,
+                            "\n".join(lines[:3]).encode()),
+                  sc.encode(sc.REPLY_TRACE_INFO, 0,
+                            "\n".join(lines[3:]).encode())]
+        data = b"".join(sc.TRACE_EVENT.pack(*e) for e in events)
+        for index in range(0, len(events), 2):
+            frames.append(sc.encode(
+                sc.REPLY_TRACE_DATA, 0, struct.pack("<I", index) +
+                data[index * 12:(index + 2) * 12]))
+        frames.append(sc.encode(sc.REPLY_TRACE_END, 0, struct.pack(
+            "<IH", len(events), sc.crc16(data) ^ crc_error)))
+        return frames
+
+    def test_trace_dump(self):
+        # Tracing::EVENT_SIZE
+        self.assertEqual(sc.TRACE_EVENT.size, 12)
+        events = [event(240 * i, 1000 + i, name=i % 2,
+                        phase=b"B" if i % 2 == 0 else b"i")
+                  for i in range(5)]
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "trace.json")
+            conn = connection(self.dump_frames(events))
+            with quiet() as out:
+                sc.trace(conn, path)
+            with open(path) as f:
+                written = json.load(f)
+        self.assertEqual(bytes(conn.port.written), b"trace_dump\n")
+        self.assertEqual(written, sc.chrome_trace(self.INFO, events))
+        self.assertIn("5 events over 0.0 ms", out.getvalue())
+
+    def test_trace_dump_errors(self):
+        events = [event(240 * i, 1000 + i) for i in range(4)]
+        frames = self.dump_frames(events)
+        del frames[2]
+        with self.assertRaisesRegex(RuntimeError, "lost events"):
+            sc.trace(connection(frames), os.devnull)
+        with self.assertRaisesRegex(RuntimeError, "corrupted"):
+            sc.trace(connection(self.dump_frames(events, crc_error=1)),
+                     os.devnull)
+
+
+if __name__ == "__main__":
+    unittest.main()